@@ -2,6 +2,8 @@
 #include "winbase.h"
 #include "math.h"
 #include "memory.h"
+#include "stdlib.h"
+#include "string.h"
 
 #include "openjpeg\openjpeg.h"
 #include "convert.h"
@@ -15,16 +17,40 @@ wchar_t const* in_files[] = {
 	L"..\\test_bmp\\Image4", L"..\\test_bmp\\Image5", L"..\\test_bmp\\Image6",
 	L"..\\test_bmp\\Image7", L"..\\test_bmp\\Image8" };
 
-int main(int argc, wchar_t* argv[])
+int main(int argc, char* argv[])
 {
+	int opt, img;
+	int codes[16] = { 37, 38, 40, 43, 45, 48, 51, 53, 56, 64, 75, 80, 85, 96, 112, 128 };
+
+	// Non-interactive stage benchmark: bench <image 1-8> <code> <loss %> [warmup] [repetitions]
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		if (argc < 5) {
+			wprintf(L"Usage: %S bench <image 1-8> <code> <loss %%> [warmup] [repetitions]\n", argv[0]);
+			return 1;
+		}
+		img = atoi(argv[2]);
+		if (1 > img || img > 8) {
+			wprintf(L"No image with such index\n");
+			return 1;
+		}
+		return benchmark_pipeline(in_files[img - 1], DEFAULT_COMPRESSION, atoi(argv[3]), atoi(argv[4]),
+			argc > 5 ? atoi(argv[5]) : PIPE_WARMUP, argc > 6 ? atoi(argv[6]) : PIPE_REPETITIONS,
+			L"..\\Backup\\benchmark_pipeline") ? 1 : 0;
+	}
+
 	wprintf(L"hello\n");
 
-	int opt, img;
 	wprintf(L"Select test\n");
 	wprintf(L"0 - single image full cycle\n");
 	wprintf(L"1 - error resilience\n");
 	wprintf(L"2 - adaptive test\n");
 	wprintf(L"3 - adaptive deep test\n");
+	wprintf(L"4 - adaptive matrix calibration\n");
+	wprintf(L"5 - channel models benchmark\n");
+	wprintf(L"6 - packet interleaver benchmark\n");
+	wprintf(L"7 - RTP loopback test\n");
+	wprintf(L"8 - RED tile positions test\n");
+	wprintf(L"9 - streaming encoder to streaming decoder test\n");
 	wscanf_s(L"%d", &opt);
 	switch (opt)
 	{
@@ -38,11 +64,10 @@ int main(int argc, wchar_t* argv[])
 		int ep, prot, i;
 		wprintf(L"Protection code: ");
 		wscanf_s(L"%d", &prot);
-		int codes[16] = { 37, 38, 40, 43, 45, 48, 51, 53, 56, 64, 75, 80, 85, 96, 112, 128 };
 		for (i = 0; i < 16; i++) {
 			if (codes[i] == prot) break;
 		}
-		if (i == 16) {
+		if (i == 16 && prot != 1) {	// 1 - UEP
 			wprintf(L"Code is not supported\n");
 			break;
 		}
@@ -80,7 +105,15 @@ int main(int argc, wchar_t* argv[])
 		wprintf(L"3 - falling\n");
 		error_functions ef;
 		wscanf_s(L"%d", &ef);
-		test_adaptive_algorithm(in_files[img - 1], 20, 50, ef);
+		wprintf(L"Select controller mode:\n");
+		wprintf(L"0 - sliding window\n");
+		wprintf(L"1 - model-predictive (RS statistics)\n");
+		adaptive_mode am;
+		wscanf_s(L"%d", &am);
+		wprintf(L"Per-tile codes (0 - no, 1 - yes): ");
+		int tc;
+		wscanf_s(L"%d", &tc);
+		test_adaptive_algorithm(in_files[img - 1], 20, 50, ef, am, tc);
 		break;
 
 	case 3:
@@ -94,11 +127,107 @@ int main(int argc, wchar_t* argv[])
 			int error_prob[6] = { 99, 90, 80, 70, 60, 50 };
 			for (int j = 0; j < 6; j++) {
 				wprintf(L"Testing with %d%% target tiles and with %d mode\n", error_prob[j], i);
-				test_adaptive_algorithm(in_files[img - 1], 20, error_prob[j], i);
+				test_adaptive_algorithm(in_files[img - 1], 20, error_prob[j], i, ADAPTIVE_WINDOW, 0);
 			}
 		}
 		break;
 
+	case 4:
+		wprintf(L"Image index (1-8): ");
+		wscanf_s(L"%d", &img);
+		if (1 > img || img > 8) {
+			wprintf(L"No image with such index\n");
+			break;
+		}
+		int iterations;
+		wprintf(L"Iterations per point: ");
+		wscanf_s(L"%d", &iterations);
+		calibrate_err_matrix(in_files[img - 1], DEFAULT_COMPRESSION, iterations, 0);
+		break;
+
+	case 5:
+		wprintf(L"Image index (1-8): ");
+		wscanf_s(L"%d", &img);
+		if (1 > img || img > 8) {
+			wprintf(L"No image with such index\n");
+			break;
+		}
+		wprintf(L"Frames per cell: ");
+		wscanf_s(L"%d", &iterations);
+		benchmark_channels(in_files[img - 1], DEFAULT_COMPRESSION, iterations, 0);
+		break;
+
+	case 6:
+		wprintf(L"Iterations: ");
+		wscanf_s(L"%d", &iterations);
+		benchmark_interleave(iterations);
+		break;
+
+	case 7:
+		wprintf(L"Image index (1-8): ");
+		wscanf_s(L"%d", &img);
+		if (1 > img || img > 8) {
+			wprintf(L"No image with such index\n");
+			break;
+		}
+		wprintf(L"Protection code: ");
+		wscanf_s(L"%d", &prot);
+		for (i = 0; i < 16; i++) {
+			if (codes[i] == prot) break;
+		}
+		if (i == 16) {
+			wprintf(L"Code is not supported\n");
+			break;
+		}
+		wprintf(L"Packet loss, percent: ");
+		wscanf_s(L"%d", &ep);
+		if (ep > 50 || ep < 0) {
+			wprintf(L"Wrong value\n");
+			break;
+		}
+		wprintf(L"Frames: ");
+		wscanf_s(L"%d", &iterations);
+		test_rtp_loopback(in_files[img - 1], DEFAULT_COMPRESSION, prot, ep, iterations);
+		break;
+
+	case 8:
+		wprintf(L"Image index (1-8): ");
+		wscanf_s(L"%d", &img);
+		if (1 > img || img > 8) {
+			wprintf(L"No image with such index\n");
+			break;
+		}
+		wprintf(L"Protection code: ");
+		wscanf_s(L"%d", &prot);
+		for (i = 0; i < 16; i++) {
+			if (codes[i] == prot) break;
+		}
+		if (i == 16) {
+			wprintf(L"Code is not supported\n");
+			break;
+		}
+		test_red_positions(in_files[img - 1], DEFAULT_COMPRESSION, prot);
+		break;
+
+	case 9:
+		wprintf(L"Image index (1-8): ");
+		wscanf_s(L"%d", &img);
+		if (1 > img || img > 8) {
+			wprintf(L"No image with such index\n");
+			break;
+		}
+		wprintf(L"Protection code: ");
+		wscanf_s(L"%d", &prot);
+		for (i = 0; i < 16; i++) {
+			if (codes[i] == prot) break;
+		}
+		if (i == 16) {
+			wprintf(L"Code is not supported\n");
+			break;
+		}
+		test_stream_round_trip(in_files[img - 1], DEFAULT_COMPRESSION, prot);
+		break;
+
 	default:
 		break;
 	}
@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench_timer.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+
+uint64_t bench_now_ns(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	/* split so that ticks * 10^9 does not overflow after a few days of uptime */
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ULL +
+		(uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+}
+#else
+#include <time.h>
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+static int compare_ns(void const* a, void const* b)
+{
+	uint64_t x = *(uint64_t const*)a, y = *(uint64_t const*)b;
+	return (x > y) - (x < y);
+}
+
+void bench_summarize(uint64_t* samples, int count, size_t bytes, bench_stats_t* stats)
+{
+	uint64_t sum = 0;
+	int i;
+
+	memset(stats, 0, sizeof(bench_stats_t));
+	if (count <= 0)
+		return;
+	qsort(samples, count, sizeof(uint64_t), compare_ns);
+	for (i = 0; i < count; i++)
+		sum += samples[i];
+	stats->count = count;
+	stats->min = samples[0];
+	stats->median = count & 1 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+	stats->p99 = samples[(99 * count + 99) / 100 - 1];
+	stats->mean = sum / count;
+	/* a stage faster than the clock still gets a finite speed */
+	stats->mbps = bytes / 1048576.0 * 1e9 / (stats->median ? stats->median : 1);
+}
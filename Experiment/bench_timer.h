@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Monotonic clock in nanoseconds: QueryPerformanceCounter on Windows, */
+/* clock_gettime(CLOCK_MONOTONIC) elsewhere                            */
+uint64_t bench_now_ns(void);
+
+typedef struct {
+	int count;			// samples behind the figures
+	uint64_t min;		// ns
+	uint64_t median;	// ns
+	uint64_t p99;		// ns, nearest rank
+	uint64_t mean;		// ns
+	double mbps;		// MB/s at the median time
+} bench_stats_t;
+
+/* Sorts samples in place and fills stats; bytes is the stage input per sample */
+void bench_summarize(uint64_t* samples, int count, size_t bytes, bench_stats_t* stats);
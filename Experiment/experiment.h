@@ -4,6 +4,20 @@
 #define TILES_Y 10
 #define BUFFER_SIZE (1ULL << 25)
 #define DEFAULT_COMPRESSION 5
+#define SENS_PROBE_STEP 4	// packets dropped per truncation step of the distortion probe
+#define CALIB_MAX_ERROR 30	// highest packet loss probability of the calibration sweep, percent
+#define CALIB_ERROR_STEPS 60	// loss probabilities swept from 0 to CALIB_MAX_ERROR in equal steps
+#define CALIB_BATCH 64		// frames decoded by one jpwl_dec_run_batch call of the calibration
+#define CALIB_SEED 0x4A50574Cu	// base seed of the per-cell error generators
+#define CHAOS_SEED 0x43484F53u	// seed of the add_chaos loss generator, see chaos_seed
+#define CHANNEL_SEED 0x43484E4Cu	// base seed of the channel models of benchmark_channels
+#define BENCH_STREAM_SIZE (BUFFER_SIZE >> 3)	// synthetic stream of benchmark_interleave, bytes
+#define RTP_SSRC 0x4A50574Cu	// source of test_rtp_loopback
+#define RTP_FIRST_SEQUENCE 65000	// first sequence number, wraps around within a few frames
+#define RTP_FRAME_TICKS 3000	// timestamp step per frame: 90 kHz clock at 30 frames/s
+#define RTP_TIMEOUT_MS 100	// receiver gives up on a frame after this pause
+#define PIPE_WARMUP 3	// untimed frames of benchmark_pipeline before the repetitions
+#define PIPE_REPETITIONS 50	// timed frames of benchmark_pipeline per run
 
 typedef enum error_func { SINEWAVE, STEPPER, RISING, FALLING } error_functions;
 
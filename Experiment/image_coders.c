@@ -1,6 +1,7 @@
 #include <memory.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <math.h>
 #include <Windows.h>
 
@@ -9,6 +10,7 @@
 #include "memstream.h"
 #include "format_defs.h"
 #include "image_coders.h"
+#include "..\jpwl\jpwl_types.h"
 
 static void error_callback(const char* msg, void* client_data)
 {
@@ -137,7 +139,7 @@ errno_t encode_BMP_to_J2K(uint8_t* bmp, opj_memory_stream* out_stream, opj_cpara
 	return 0;
 }
 
-errno_t decode_J2K_to_BMP(opj_memory_stream* in_stream, opj_memory_stream* out_stream, int* tile_positions) {
+errno_t decode_J2K_to_BMP(opj_memory_stream* in_stream, opj_memory_stream* out_stream, size_t* tile_positions) {
 	opj_dparameters_t* parameters = (opj_dparameters_t*)malloc(sizeof(opj_dparameters_t));
 	if (!parameters)
 		return -1;
@@ -198,6 +200,156 @@ errno_t decode_J2K_to_BMP(opj_memory_stream* in_stream, opj_memory_stream* out_s
 
 	errno_t err = image_to_bmp(image, out_stream->pData, out_stream->dataSize, &out_stream->offset);
 	free_res3(decompressor, image, parameters);
+	free(p_data);
 
 	return err;
 }
+
+errno_t skip_RED_ranges(uint8_t* j2k, size_t* length, size_t* tile_positions, int tiles) {
+	size_t len = *length, rd = 2, wr = 2;
+	if (len < 4 || j2k[0] != 0xFF || j2k[1] != SOC_LOW)
+		return -1;
+	/* Main header: drop EPC, it only announces RED */
+	while (rd + 4 <= len && j2k[rd] == 0xFF && j2k[rd + 1] != SOT_LOW) {
+		size_t seg = 2 + (size_t)_byteswap_ushort(*(uint16_t*)(j2k + rd + 2));
+		if (rd + seg > len)
+			return -2;
+		if (j2k[rd + 1] != EPC_LOW) {
+			memmove(j2k + wr, j2k + rd, seg);
+			wr += seg;
+		}
+		rd += seg;
+	}
+	while (rd + SOT_LN + 6 <= len && j2k[rd] == 0xFF && j2k[rd + 1] == SOT_LOW) {
+		uint32_t psot = _byteswap_ulong(*(uint32_t*)(j2k + rd + 6));
+		uint16_t isot = _byteswap_ushort(*(uint16_t*)(j2k + rd + 4));
+		size_t tile_end = psot && rd + psot <= len ? rd + psot : len - 2;
+		size_t red_len = 0, first_bad = SIZE_MAX;
+		uint8_t* red = j2k + rd + SOT_LN + 2;
+
+		if (red[0] == 0xFF && red[1] == RED_LOW) {
+			red_len = 2 + (size_t)_byteswap_ushort(*(uint16_t*)(red + 2));
+			if (rd + SOT_LN + 2 + red_len > tile_end)
+				return -3;
+			if (red[4] == RED_PRED) {
+				for (uint8_t* r = red + RED_LN + 2; r + REDINT_LN <= red + red_len; r += REDINT_LN) {
+					size_t start = _byteswap_ulong(*(uint32_t*)r);
+					if (*(uint16_t*)(r + 8) && start < first_bad)
+						first_bad = start;
+				}
+			}
+		}
+		/* Copy the tile without its RED segment */
+		memmove(j2k + wr, j2k + rd, SOT_LN + 2);
+		memmove(j2k + wr + SOT_LN + 2, red + red_len, tile_end - (rd + SOT_LN + 2 + red_len));
+		size_t tile_len = tile_end - rd - red_len;
+		if (psot)
+			*(uint32_t*)(j2k + wr + 6) = _byteswap_ulong((uint32_t)tile_len);
+		if (tile_positions && isot < tiles && tile_positions[isot])
+			tile_positions[isot] = wr;
+		/* Everything from the first damaged byte to the end of the tile is replaced with
+		 * empty packet headers, so the code-blocks behind it are not decoded at all */
+		if (first_bad != SIZE_MAX) {
+			size_t data = SOT_LN + 2;
+			while (data + 4 <= tile_len && j2k[wr + data] == 0xFF && j2k[wr + data + 1] != SOD_LOW)
+				data += 2 + (size_t)_byteswap_ushort(*(uint16_t*)(j2k + wr + data + 2));
+			if (data + 2 <= tile_len && j2k[wr + data + 1] == SOD_LOW) {
+				data += 2;
+				first_bad -= red_len;
+				if (first_bad < data)
+					first_bad = data;
+				if (first_bad < tile_len)
+					memset(j2k + wr + first_bad, 0, tile_len - first_bad);
+			}
+		}
+		wr += tile_len;
+		rd = tile_end;
+	}
+	memmove(j2k + wr, j2k + rd, len - rd);
+	*length = wr + len - rd;
+	return 0;
+}
+
+static errno_t probe_mse(uint8_t* bmp, uint8_t* j2k, size_t length, opj_memory_stream* decoded, float* mse) {
+	opj_memory_stream probe = {
+		.dataSize = length,
+		.offset = 0,
+		.pData = j2k
+	};
+	quality_factors qf;
+	decoded->offset = 0;
+	errno_t err = decode_J2K_to_BMP(&probe, decoded, NULL);
+	if (!err)
+		err = calculate_qf(bmp, decoded->pData, &qf);
+	if (!err)
+		*mse = qf.MSE;
+	return err;
+}
+
+errno_t probe_packet_distortion(uint8_t* bmp, opj_memory_stream* j2k, uint16_t* tile_packets, int tiles,
+	int step, float* pack_dist) {
+	uint8_t* stream = j2k->pData, * saved;
+	size_t len = j2k->offset, pos = 2, p_no = 0;
+	size_t* packet_start;
+	float mse_full, mse_prev, mse;
+	errno_t err;
+	opj_memory_stream decoded = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	saved = (uint8_t*)malloc(len);
+	packet_start = (size_t*)malloc(MAX_EPBSIZE * sizeof(size_t));
+	if (!decoded.pData || !saved || !packet_start) {
+		err = -1;
+		goto out;
+	}
+	if (step < 1)
+		step = 1;
+	err = probe_mse(bmp, stream, len, &decoded, &mse_full);
+	if (err)
+		goto out;
+	/* Skip the main header */
+	while (pos + 4 <= len && stream[pos] == 0xFF && stream[pos + 1] != SOT_LOW)
+		pos += 2 + (size_t)_byteswap_ushort(*(uint16_t*)(stream + pos + 2));
+	for (int t = 0; t < tiles; t++) {
+		if (pos + SOT_LN + 2 > len || stream[pos] != 0xFF || stream[pos + 1] != SOT_LOW) {
+			err = -2;
+			goto out;
+		}
+		uint32_t psot = _byteswap_ulong(*(uint32_t*)(stream + pos + 6));
+		size_t tile_end = psot ? pos + psot : len - 2;
+		int packets = tile_packets[t], found = 0;
+		/* Packet boundaries come from the SOP markers */
+		for (size_t i = pos + SOT_LN + 2; i + 1 < tile_end && found < packets; i++)
+			if (stream[i] == 0xFF && stream[i + 1] == SOP_LOW)
+				packet_start[found++] = i;
+		if (found != packets || tile_end > len) {
+			err = -3;
+			goto out;
+		}
+		/* Drop the tail of the tile step by step; the MSE increase between two
+		 * truncation points is shared by the packets removed in that step */
+		memcpy(saved, stream + pos, tile_end - pos);
+		mse_prev = mse_full;
+		for (int kept = packets; kept > 0; ) {
+			int cut = kept > step ? kept - step : 0;
+			memset(stream + packet_start[cut], 0, tile_end - packet_start[cut]);
+			err = probe_mse(bmp, stream, len, &decoded, &mse);
+			memcpy(stream + pos, saved, tile_end - pos);
+			if (err)
+				goto out;
+			for (int k = cut; k < kept; k++)
+				pack_dist[p_no + k] = (mse - mse_prev) / (kept - cut);
+			mse_prev = mse;
+			kept = cut;
+		}
+		p_no += packets;
+		pos = tile_end;
+	}
+out:
+	free(decoded.pData);
+	free(saved);
+	free(packet_start);
+	return err;
+}
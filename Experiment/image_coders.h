@@ -5,6 +5,18 @@
 errno_t encode_BMP_to_J2K(uint8_t* bmp, opj_memory_stream* out_stream, opj_cparameters_t* parameters,
 	int tiles_x, int tiles_y);
 
-errno_t decode_J2K_to_BMP(opj_memory_stream* in_stream, opj_memory_stream* out_stream, int* tile_positions);
+errno_t decode_J2K_to_BMP(opj_memory_stream* in_stream, opj_memory_stream* out_stream, size_t* tile_positions);
+
+/* Removes the RED segments (and the EPC announcing them) left by the JPWL decoder.
+ * Each damaged tile is cut at its first residual-error range: the rest of its data
+ * becomes empty packets, so OpenJPEG skips those code-blocks instead of decoding garbage.
+ * tile_positions are moved along with the tiles they point to. */
+errno_t skip_RED_ranges(uint8_t* j2k, size_t* length, size_t* tile_positions, int tiles);
+
+/* Estimates how much each packet lowers the image MSE by truncating one tile at a time
+ * after every step-th packet (the cut data becomes empty packets) and decoding the result.
+ * Requires SOP markers. pack_dist is filled in the pack_sens order, ready for sens_from_distortion. */
+errno_t probe_packet_distortion(uint8_t* bmp, opj_memory_stream* j2k, uint16_t* tile_packets, int tiles,
+	int step, float* pack_dist);
 
 errno_t calculate_qf(uint8_t* original_bmp, uint8_t* decoded_bmp, quality_factors* qf_result);
@@ -10,6 +10,7 @@
 #include "format_defs.h"
 #include "tests.h"
 #include "image_coders.h"
+#include "bench_timer.h"
 
 #include "..\jpwl\jpwl_types.h"
 #include "..\jpwl\jpwl_params.h"
@@ -19,9 +20,11 @@
 #include "..\add_chaos\add_chaos.h"
 #include "..\add_chaos\chaos_params.h"
 #include "..\add_chaos\mt19937.h"
+#include "..\add_chaos\channel.h"
+#include "..\add_chaos\rtp.h"
 
 opj_cparameters_t parameters;
-int tile_positions[TILES_X * TILES_Y];
+size_t tile_positions[TILES_X * TILES_Y];
 
 errno_t read_BMP_from_file(wchar_t const* filename, uint8_t** bmp, size_t* length) {
 	FILE* in;
@@ -56,22 +59,25 @@ errno_t save_BMP_to_file(wchar_t const* filename, uint8_t* bmp, size_t length) {
 	return 0;
 }
 
-void print_stats(LARGE_INTEGER start, LARGE_INTEGER end, LARGE_INTEGER freq, size_t size)
+void print_stats(uint64_t elapsed_ns, size_t size)
 {
-	LARGE_INTEGER elapsed = {
-		.QuadPart = (end.QuadPart - start.QuadPart) * 1000 / freq.QuadPart
-	};
-	int msecs = elapsed.LowPart;
-	if (!msecs)
-		msecs = 15;
-	wprintf(L"time %.3f s, speed %zd Kb/s\n", msecs / 1000.0f, ((size >> 10) * 1000) / msecs);
+	double secs = elapsed_ns * 1e-9;
+	if (elapsed_ns)
+		wprintf(L"time %.6f s, speed %.1f MB/s\n", secs, size / 1048576.0 / secs);
+	else
+		wprintf(L"time below timer resolution\n");
 }
 
-float get_secs(LARGE_INTEGER start, LARGE_INTEGER end, LARGE_INTEGER freq) {
-	LARGE_INTEGER elapsed = {
-		.QuadPart = (end.QuadPart - start.QuadPart) * 1000 / freq.QuadPart
-	};
-	return elapsed.LowPart * .001f;
+void print_mem_stats() {
+	jpwl_mem_stats enc_mem, dec_mem;
+	jpwl_enc_mem_stats(&enc_mem);
+	jpwl_dec_mem_stats(&dec_mem);
+	wprintf(L"Frame scratch: encoder peak %zd Kb, decoder peak %zd Kb, heap allocations %d/%d\n",
+		enc_mem.high_water >> 10, dec_mem.high_water >> 10, enc_mem.heap_allocs, dec_mem.heap_allocs);
+}
+
+float get_secs(uint64_t elapsed_ns) {
+	return elapsed_ns * 1e-9f;
 }
 
 void test_full_cycle(wchar_t const* bmp_name, float compression, int protection, int err_probability) {
@@ -86,8 +92,8 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 	}
 
 	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
-	uint16_t* tile_packets = (uint16_t*)malloc(MAX_TILES);
-	LARGE_INTEGER StartingTime, EndingTime, Frequency;
+	uint16_t* tile_packets = (uint16_t*)malloc(TILES_X * TILES_Y * sizeof(uint16_t));
+	uint64_t StartingTime, EndingTime;
 	opj_memory_stream in_stream = {
 		.dataSize = BUFFER_SIZE,
 		.offset = 0,
@@ -99,13 +105,12 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 		.pData = (uint8_t*)malloc(BUFFER_SIZE)
 	};
 	opj_memory_stream jpwl_stream = {
-		.dataSize = BUFFER_SIZE,
+		.dataSize = 0,
 		.offset = 0,
-		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+		.pData = NULL
 	};
 	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
-	if (!pack_sens || !tile_packets || !in_stream.pData || !out_stream.pData 
-		|| !jpwl_stream.pData || !enc_bResults) {
+	if (!pack_sens || !tile_packets || !in_stream.pData || !out_stream.pData || !enc_bResults) {
 		wprintf(L"Memory allocation error, aborting\n");
 		return;
 	}
@@ -117,6 +122,8 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 	parameters.cp_disto_alloc = 1;
 	parameters.irreversible = 1;
 	parameters.tile_size_on = 1;
+	if (protection == 1)	// UEP needs packet boundaries
+		parameters.csty |= 0x02;
 
 	if (jpwl_init())
 	{
@@ -135,47 +142,65 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 
 	quality_factors qf;
 
-	chaos_init();
+	chaos_seed(CHAOS_SEED);
 	in_stream.offset = 0;
 
-	QueryPerformanceFrequency(&Frequency);
-	QueryPerformanceCounter(&StartingTime);
+	StartingTime = bench_now_ns();
 	err = encode_BMP_to_J2K(bmp, &in_stream, &parameters, TILES_X, TILES_Y);
 	if (err) {
 		wprintf(L"Something went wrong while encoding: code %d\n", err);
 		return;
 	}
-	QueryPerformanceCounter(&EndingTime);
+	EndingTime = bench_now_ns();
 
 	wprintf(L"BMP to %.2f Mb J2K: ", in_stream.offset / 1048576.0f);
-	print_stats(StartingTime, EndingTime, Frequency, bmp_size);
+	print_stats(EndingTime - StartingTime, bmp_size);
 
 	sens_create(in_stream.pData, tile_packets, pack_sens);
+	if (protection == 1) {	// UEP: sensitivities from measured packet distortion instead of packet order
+		float* pack_dist = (float*)malloc(MAX_EPBSIZE * sizeof(float));
+		StartingTime = bench_now_ns();
+		err = pack_dist ? probe_packet_distortion(bmp, &in_stream, tile_packets, TILES_X * TILES_Y,
+			SENS_PROBE_STEP, pack_dist) : -1;
+		EndingTime = bench_now_ns();
+		if (err)
+			wprintf(L"Distortion probe failed: code %d, using packet order\n", err);
+		else {
+			sens_from_distortion(TILES_X * TILES_Y, tile_packets, pack_dist, pack_sens);
+			wprintf(L"Packet sensitivities probed: ");
+			print_stats(EndingTime - StartingTime, in_stream.offset);
+		}
+		free(pack_dist);
+	}
 
 	jpwl_enc_bParams enc_bParams = {
-		.stream_len = (uint32_t)in_stream.offset,
+		.stream_len = in_stream.offset,
 		.tile_packets = tile_packets,
 		.pack_sens = pack_sens
 	};
 
-	QueryPerformanceFrequency(&Frequency);
-	QueryPerformanceCounter(&StartingTime);
+	// Exact jpwl length: transmit_with_interleave corrupts the stream in place
+	if (jpwl_enc_plan(in_stream.pData, &enc_bParams, &jpwl_stream.dataSize))
+		return;
+	jpwl_stream.pData = (uint8_t*)malloc(jpwl_stream.dataSize);
+	if (!jpwl_stream.pData) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return;
+	}
+
+	StartingTime = bench_now_ns();
 	if (jpwl_enc_run(in_stream.pData, jpwl_stream.pData, &enc_bParams, enc_bResults))
 		return;
-	QueryPerformanceCounter(&EndingTime);
+	EndingTime = bench_now_ns();
 
 	wprintf(L"J2K to %.2f Mb JPWL: ", enc_bResults->wcoder_out_len / 1048576.0f);
-	print_stats(StartingTime, EndingTime, Frequency, in_stream.offset);
+	print_stats(EndingTime - StartingTime, in_stream.offset);
 
 	if (err_probability > 0) {
 		memcpy(out_stream.pData, jpwl_stream.pData, enc_bResults->wcoder_mh_len);
-		size_t packets = write_packets_with_interleave(
-			jpwl_stream.pData, enc_bResults->wcoder_out_len, enc_params.wcoder_data);
-		int errors = create_packet_errors((int)packets, err_probability * .01f, 1);
-		size_t read_bytes = read_packets_with_deinterleave(
-			jpwl_stream.pData, packets, enc_params.wcoder_data);
+		int errors = transmit_with_interleave(jpwl_stream.pData, enc_bResults->wcoder_out_len,
+			enc_params.wcoder_data, err_probability * .01f);
 		memcpy(jpwl_stream.pData, out_stream.pData, enc_bResults->wcoder_mh_len);
-		enc_bResults->wcoder_out_len = (uint32_t)read_bytes;
 		wprintf(L"Tampered buffer with ~%.1f%% packet errors\n",
 			errors * 100.0f / enc_bResults->wcoder_out_len);
 	}
@@ -183,24 +208,28 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 	jpwl_dec_bParams dec_bParams = {
 		.inp_buffer = jpwl_stream.pData,
 		.inp_length = enc_bResults->wcoder_out_len,
-		.out_buffer = in_stream.pData
+		.out_buffer = in_stream.pData,
+		.use_red = 1
 	};
 	memcpy(tile_positions, enc_bResults->tile_position, sizeof(tile_positions));
-	QueryPerformanceFrequency(&Frequency);
-	QueryPerformanceCounter(&StartingTime);
+	StartingTime = bench_now_ns();
 	if (jpwl_dec_run(&dec_bParams, &dec_bResults, tile_positions))
 		return;
-	QueryPerformanceCounter(&EndingTime);
+	EndingTime = bench_now_ns();
 
 	wprintf(L"JPWL to %.2f Mb J2K: ", dec_bResults.out_length / 1048576.0f);
-	print_stats(StartingTime, EndingTime, Frequency, enc_bResults->wcoder_out_len);
-	wprintf(L"All bad: %d, partially restored: %d, fully restored: %d\n",
+	print_stats(EndingTime - StartingTime, enc_bResults->wcoder_out_len);
+	wprintf(L"All bad: %zd, partially restored: %d, fully restored: %d\n",
 		dec_bResults.all_bad_length, dec_bResults.tile_part_rest_cnt, dec_bResults.tile_all_rest_cnt);
 	restore_stats* stats = jpwl_dec_stats();
 	wprintf(L"Corrected/uncorrected bytes: %.1f%%/%.1f%%\n",
 		stats->corrected_rs_bytes * 100.0f / enc_bResults->wcoder_out_len,
 		stats->uncorrected_rs_bytes * 100.0f / enc_bResults->wcoder_out_len);
 
+	size_t j2k_length = dec_bResults.out_length;
+	if (skip_RED_ranges(in_stream.pData, &j2k_length, tile_positions, TILES_X * TILES_Y))
+		wprintf(L"RED segments could not be parsed\n");
+
 	jpwl_stream.offset = 0;
 	out_stream.offset = 0;
 	in_stream.offset = 0;
@@ -210,17 +239,16 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 			sizeof(enc_bResults->tile_headers[0]));
 	}
 
-	QueryPerformanceFrequency(&Frequency);
-	QueryPerformanceCounter(&StartingTime);
+	StartingTime = bench_now_ns();
 	err = decode_J2K_to_BMP(&in_stream, &out_stream, enc_bResults->tile_position);
 	if (err) {
 		wprintf(L"Something went wrong while decoding: code %d\n", err);
 		return;
 	}
-	QueryPerformanceCounter(&EndingTime);
+	EndingTime = bench_now_ns();
 
 	wprintf(L"J2K to %.2f Mb BMP: ", out_stream.offset / 1048576.0f);
-	print_stats(StartingTime, EndingTime, Frequency, dec_bResults.out_length);
+	print_stats(EndingTime - StartingTime, dec_bResults.out_length);
 
 	err = calculate_qf(bmp, out_stream.pData, &qf);
 	if (err) {
@@ -238,6 +266,7 @@ void test_full_cycle(wchar_t const* bmp_name, float compression, int protection,
 	}
 	wprintf(L"BMP file saved: %lld bytes\n\n", out_stream.offset);
 
+	print_mem_stats();
 	jpwl_destroy();
 	free(pack_sens);
 	free(jpwl_stream.pData);
@@ -262,8 +291,8 @@ void test_error_recovery(wchar_t const* bmp_name, float compression, int iterati
 	if (_wfopen_s(&test_data, L"..\\Backup\\test_error_recovery.tsv", L"wt, ccs=UTF-8"))
 		return;
 	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
-	uint16_t* tile_packets = (uint16_t*)malloc(MAX_TILES);
-	LARGE_INTEGER StartingTime, EndingTime, Frequency;
+	uint16_t* tile_packets = (uint16_t*)malloc(TILES_X * TILES_Y * sizeof(uint16_t));
+	uint64_t StartingTime, EndingTime;
 	opj_memory_stream in_stream = {
 		.dataSize = BUFFER_SIZE,
 		.offset = 0,
@@ -320,12 +349,12 @@ void test_error_recovery(wchar_t const* bmp_name, float compression, int iterati
 
 	sens_create(in_stream.pData, tile_packets, pack_sens);
 	jpwl_enc_bParams enc_bParams = {
-		.stream_len = (uint32_t)in_stream.offset,
+		.stream_len = in_stream.offset,
 		.tile_packets = tile_packets,
 		.pack_sens = pack_sens
 	};
 
-	chaos_init();
+	chaos_seed(CHAOS_SEED);
 	int err_probability = 0;
 	fwprintf(test_data, L"RS code\tBuffer errors\tRecovered tiles\tTime\n");
 
@@ -347,15 +376,11 @@ void test_error_recovery(wchar_t const* bmp_name, float compression, int iterati
 			};
 			int recovered_tiles = 0;
 			float errors = 0;
-			QueryPerformanceFrequency(&Frequency);
-			QueryPerformanceCounter(&StartingTime);
+			StartingTime = bench_now_ns();
 			for (int j = 0; j < iterations; j++) {
-				size_t packets = write_packets_with_interleave(
-					jpwl_stream.pData, enc_bResults->wcoder_out_len, enc_params.wcoder_data);
-				errors += create_packet_errors((int)packets, err_probability * .01f, 1)
-					* 100.0f / enc_bResults->wcoder_out_len;
-				(void)read_packets_with_deinterleave(
-					jpwl_copy_stream.pData, packets, enc_params.wcoder_data);
+				memcpy(jpwl_copy_stream.pData, jpwl_stream.pData, enc_bResults->wcoder_out_len);
+				errors += transmit_with_interleave(jpwl_copy_stream.pData, enc_bResults->wcoder_out_len,
+					enc_params.wcoder_data, err_probability * .01f) * 100.0f / enc_bResults->wcoder_out_len;
 				// Restore main header - we assume that it will be intact
 				memcpy(jpwl_copy_stream.pData, jpwl_stream.pData, enc_bResults->wcoder_mh_len);
 				if (jpwl_dec_run(&dec_bParams, &dec_bResults, tile_positions)) {
@@ -367,11 +392,11 @@ void test_error_recovery(wchar_t const* bmp_name, float compression, int iterati
 				jpwl_copy_stream.offset = 0;
 				out_stream.offset = 0;
 			}
-			QueryPerformanceCounter(&EndingTime);
+			EndingTime = bench_now_ns();
 			errors /= iterations;
 			recovered_tiles /= iterations;
 			fwprintf(test_data, L"%d\t%.1f\t%d\t%.3f\n", enc_params.wcoder_data, errors, recovered_tiles,
-				get_secs(StartingTime, EndingTime, Frequency) / iterations);
+				get_secs(EndingTime - StartingTime) / iterations);
 
 			if (recovered_tiles > ((TILES_X * TILES_Y) >> 1)) {
 				err_probability++;
@@ -386,6 +411,7 @@ void test_error_recovery(wchar_t const* bmp_name, float compression, int iterati
 		wprintf(L"Tested with jpwl %d\n", enc_params.wcoder_data);
 	};
 
+	print_mem_stats();
 	jpwl_destroy();
 	free(pack_sens);
 	free(jpwl_stream.pData);
@@ -398,7 +424,1114 @@ void test_error_recovery(wchar_t const* bmp_name, float compression, int iterati
 	fclose(test_data);
 }
 
-void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int min_tiles_percent, error_functions func) {
+/* Tile layouts swept by calibrate_err_matrix, tiles_x by tiles_y */
+static int const calib_layouts[][2] = { { 5, 5 }, { 10, 10 }, { 16, 16 } };
+
+/* Fits the error ratio at which the recovered tiles ratio falls to target.
+ * errors and tiles hold the sweep means in order of growing loss probability. */
+static float calib_fit_threshold(double const* errors, double const* tiles, int points, float target) {
+	if (tiles[0] < target)
+		return 0;
+	for (int i = 1; i < points; i++) {
+		if (tiles[i] < target) {
+			double k = (tiles[i - 1] - target) / (tiles[i - 1] - tiles[i]);
+			return (float)(errors[i - 1] + (errors[i] - errors[i - 1]) * k);
+		}
+	}
+	return (float)errors[points - 1];
+}
+
+/* Regenerates err_matrix: sweeps RS code x packet loss probability x tile layout and
+ * writes one matrix section per layout to ..\Backup\err_matrix.tsv (see adaptive_ctrl_load_matrix).
+ * Decoding runs on all cores through jpwl_dec_run_batch. Errors of each
+ * (layout, code, probability) cell come from a generator seeded by the cell index,
+ * so the result does not depend on the number of threads. */
+void calibrate_err_matrix(wchar_t const* bmp_name, float compression, int iterations, int threads) {
+	uint8_t* bmp = NULL;
+	size_t bmp_size = 0;
+	wchar_t name[64];
+	swprintf(name, 64, L"%s.bmp", bmp_name);
+	errno_t err = read_BMP_from_file(name, &bmp, &bmp_size);
+	if (!bmp || err) {
+		wprintf(L"Something went wrong while reading bmp: code %d\n", err);
+		return;
+	}
+
+	FILE* matrix_file;
+	if (_wfopen_s(&matrix_file, L"..\\Backup\\err_matrix.tsv", L"wt"))
+		return;
+	if (iterations < 1)
+		iterations = 1;
+	int const points = CALIB_ERROR_STEPS + 1;
+	int const layouts = sizeof(calib_layouts) / sizeof(calib_layouts[0]);
+	int max_tiles = 0;
+	for (int l = 0; l < layouts; l++) {
+		if (calib_layouts[l][0] * calib_layouts[l][1] > max_tiles)
+			max_tiles = calib_layouts[l][0] * calib_layouts[l][1];
+	}
+	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
+	uint16_t* tile_packets = (uint16_t*)malloc(max_tiles * sizeof(uint16_t));
+	opj_memory_stream in_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	opj_memory_stream jpwl_stream = {
+		.dataSize = BUFFER_SIZE >> 1,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE >> 1)
+	};
+	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
+	jpwl_dec_frame* frames = (jpwl_dec_frame*)calloc(CALIB_BATCH, sizeof(jpwl_dec_frame));
+	size_t* frame_positions = (size_t*)malloc(CALIB_BATCH * max_tiles * sizeof(size_t));
+	channel_model_t* channels = (channel_model_t*)malloc(points * sizeof(channel_model_t));
+	double sum_errors[CALIB_ERROR_STEPS + 1], sum_tiles[CALIB_ERROR_STEPS + 1];
+	float thresholds[ERR_MATRIX_ROWS][JPWL_CODES];
+	if (!pack_sens || !tile_packets || !in_stream.pData || !jpwl_stream.pData || !enc_bResults
+		|| !frames || !frame_positions || !channels) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return;
+	}
+	uint8_t* batch_buf = NULL;
+	size_t batch_cap = 0;
+
+	opj_cparameters_t calib_parameters;
+	opj_set_default_encoder_parameters(&calib_parameters);
+	calib_parameters.decod_format = BMP_DFMT;
+	calib_parameters.tcp_numlayers = 1;
+	calib_parameters.tcp_rates[0] = compression;
+	calib_parameters.cp_disto_alloc = 1;
+	calib_parameters.irreversible = 1;
+	calib_parameters.tile_size_on = 1;
+
+	if (jpwl_init())
+	{
+		wprintf(L"JPWL init failed\n");
+		return;
+	}
+	jpwl_enc_params enc_params;
+	jpwl_enc_set_default_params(&enc_params);
+	enc_params.wcoder_mh = 1;
+	enc_params.wcoder_th = 1;
+
+	uint64_t StartingTime, EndingTime;
+	StartingTime = bench_now_ns();
+	fprintf(matrix_file, "# JPWL err_matrix calibration: %d iterations, loss 0..%d%% in %d steps\n",
+		iterations, CALIB_MAX_ERROR, CALIB_ERROR_STEPS);
+
+	for (int l = 0; l < layouts; l++) {
+		int const tiles = calib_layouts[l][0] * calib_layouts[l][1];
+		in_stream.offset = 0;
+		err = encode_BMP_to_J2K(bmp, &in_stream, &calib_parameters, calib_layouts[l][0], calib_layouts[l][1]);
+		if (err) {
+			wprintf(L"Something went wrong while encoding to J2K code %d\n", err);
+			continue;
+		}
+		sens_create(in_stream.pData, tile_packets, pack_sens);
+		jpwl_enc_bParams enc_bParams = {
+			.stream_len = in_stream.offset,
+			.tile_packets = tile_packets,
+			.pack_sens = pack_sens
+		};
+		fprintf(matrix_file, "# RS code\tLoss\tBuffer errors\tRecovered tiles\n");
+
+		for (int c = 0; c < JPWL_CODES; c++) {
+			enc_params.wcoder_data = jpwl_codes[c];
+			jpwl_enc_init(&enc_params);
+			if (jpwl_enc_run(in_stream.pData, jpwl_stream.pData, &enc_bParams, enc_bResults)) {
+				wprintf(L"Something went wrong while encoding to jpwl %d\n", enc_params.wcoder_data);
+				for (int r = 0; r < ERR_MATRIX_ROWS; r++)
+					thresholds[r][c] = 0;
+				continue;
+			}
+			size_t length = enc_bResults->wcoder_out_len;
+			if (length > batch_cap) {
+				free(batch_buf);
+				batch_cap = length;
+				batch_buf = (uint8_t*)malloc(CALIB_BATCH * batch_cap);
+				if (!batch_buf) {
+					wprintf(L"Memory allocation error, aborting\n");
+					return;
+				}
+			}
+			// Every probability draws from a substream of its own
+			for (int p = 0; p < points; p++) {
+				channel_init_iid(channels + p, CALIB_SEED, (float)p / CALIB_ERROR_STEPS * CALIB_MAX_ERROR * .01f, 0);
+				channel_reset(channels + p, CALIB_SEED + (l * JPWL_CODES + c) * 2654435761u, p);
+				sum_errors[p] = sum_tiles[p] = 0;
+			}
+
+			// Trials are numbered probability-major, each batch decodes CALIB_BATCH of them
+			int const trials = points * iterations;
+			for (int t = 0; t < trials; t += CALIB_BATCH) {
+				int n = trials - t < CALIB_BATCH ? trials - t : CALIB_BATCH;
+				for (int k = 0; k < n; k++) {
+					int p = (t + k) / iterations;
+					uint8_t* buf = batch_buf + k * batch_cap;
+					memcpy(buf, jpwl_stream.pData, length);
+					int errors = channel_buffer_errors(channels + p, buf, length, enc_params.wcoder_data);
+					// Restore main header - we assume that it will be intact
+					memcpy(buf, jpwl_stream.pData, enc_bResults->wcoder_mh_len);
+					sum_errors[p] += (double)errors / length;
+					jpwl_dec_bParams dec_bParams = {
+						.inp_buffer = buf,
+						.inp_length = length,
+						.out_buffer = NULL
+					};
+					frames[k].params = dec_bParams;
+					frames[k].tile_positions = frame_positions + k * max_tiles;
+				}
+				(void)jpwl_dec_run_batch(frames, n, threads, NULL);
+				for (int k = 0; k < n; k++) {
+					if (!frames[k].status)
+						sum_tiles[(t + k) / iterations] += (double)frames[k].results.tile_all_rest_cnt / tiles;
+				}
+			}
+
+			for (int p = 0; p < points; p++) {
+				sum_errors[p] /= iterations;
+				sum_tiles[p] /= iterations;
+				fprintf(matrix_file, "# %d\t%.3f\t%.4f\t%.4f\n", enc_params.wcoder_data,
+					(float)p / CALIB_ERROR_STEPS * CALIB_MAX_ERROR * .01f, sum_errors[p], sum_tiles[p]);
+			}
+			for (int r = 0; r < ERR_MATRIX_ROWS; r++)
+				thresholds[r][c] = calib_fit_threshold(sum_errors, sum_tiles, points, err_matrix[r].tiles);
+			wprintf(L"\rCalibrated %dx%d tiles with jpwl %d  ", calib_layouts[l][0], calib_layouts[l][1],
+				enc_params.wcoder_data);
+		}
+
+		fprintf(matrix_file, "tiles %d\n", tiles);
+		for (int r = 0; r < ERR_MATRIX_ROWS; r++) {
+			fprintf(matrix_file, "%.2f", err_matrix[r].tiles);
+			for (int c = 0; c < JPWL_CODES; c++)
+				fprintf(matrix_file, "\t%.4f", thresholds[r][c]);
+			fprintf(matrix_file, "\n");
+		}
+		fflush(matrix_file);
+	}
+	EndingTime = bench_now_ns();
+	wprintf(L"\nCalibration took %.1f s\n", get_secs(EndingTime - StartingTime));
+
+	jpwl_destroy();
+	free(batch_buf);
+	free(channels);
+	free(frame_positions);
+	free(frames);
+	free(enc_bResults);
+	free(jpwl_stream.pData);
+	free(in_stream.pData);
+	free(tile_packets);
+	free(pack_sens);
+	free(bmp);
+	fclose(matrix_file);
+}
+
+/* Channels of benchmark_channels, all with about 5% of packets hit */
+#define BENCH_CHANNELS 4
+static wchar_t const* const bench_names[BENCH_CHANNELS] = { L"iid", L"gilbert", L"gilbert-ber", L"trace" };
+
+static int bench_channel_init(channel_model_t* ch, int c) {
+	channel_state_t good = { 0, 0 }, lossy = { 1, 0 }, noisy = { 0, 2e-3f };
+	switch (c) {
+	case 0:
+		channel_init_iid(ch, CHANNEL_SEED, .05f, 0);
+		return 0;
+	case 1:		// mean burst of 1 / .19 = 5.3 packets
+		channel_init_gilbert_elliott(ch, CHANNEL_SEED, .01f, .19f, good, lossy);
+		return 0;
+	case 2:		// same bursts corrupting bits instead of dropping packets
+		channel_init_gilbert_elliott(ch, CHANNEL_SEED, .01f, .19f, good, noisy);
+		return 0;
+	default:	// recorded loss pattern, if there is one
+		channel_init_iid(ch, CHANNEL_SEED, 0, 0);
+		return channel_load_trace(ch, L"..\\Backup\\loss_trace.txt");
+	}
+}
+
+/* One simulated link of benchmark_channels: a channel with a stripe, transmitting count frames per batch */
+typedef struct {
+	chaos_sim_t* sim;
+	uint8_t const* stream;
+	size_t length;
+	size_t mh_len;
+	size_t stripe;
+	uint8_t* frames;		/* count frames, frame_cap bytes apart */
+	size_t frame_cap;
+	int count;
+	int failed;
+	double errors;
+	double tiles;
+} bench_link;
+
+static DWORD WINAPI bench_link_run(LPVOID param) {
+	bench_link* link = (bench_link*)param;
+	for (int k = 0; k < link->count; k++) {
+		uint8_t* buf = link->frames + k * link->frame_cap;
+		memcpy(buf, link->stream, link->length);
+		int errors = chaos_sim_transmit(link->sim, buf, link->length, link->stripe);
+		if (errors < 0) {
+			link->failed = 1;
+			break;
+		}
+		link->errors += (double)errors / link->length;
+		// Restore main header - we assume that it will be intact
+		memcpy(buf, link->stream, link->mh_len);
+	}
+	return 0;
+}
+
+/* Compares RS codes and interleaving stripes against the channel models of add_chaos:
+ * for every channel, stripe (1 or the code length, as in the adaptive test) and code
+ * decodes iterations frames and writes mean errors, recovered tiles and stream length
+ * to ..\Backup\channels.tsv. Every channel and stripe is a link with a simulator of its
+ * own, the links of a code transmit their frames in parallel threads and the frames of
+ * all links are decoded by one jpwl_dec_run_batch call. Each link restarts its channel
+ * on a substream of CHANNEL_SEED of its own for every code, so the figures are
+ * reproducible, the links are independent and the codes see the same draws per link. */
+void benchmark_channels(wchar_t const* bmp_name, float compression, int iterations, int threads) {
+	uint8_t* bmp = NULL;
+	size_t bmp_size = 0;
+	wchar_t name[64];
+	swprintf(name, 64, L"%s.bmp", bmp_name);
+	errno_t err = read_BMP_from_file(name, &bmp, &bmp_size);
+	if (!bmp || err) {
+		wprintf(L"Something went wrong while reading bmp: code %d\n", err);
+		return;
+	}
+
+	FILE* bench_file;
+	if (_wfopen_s(&bench_file, L"..\\Backup\\channels.tsv", L"wt, ccs=UTF-8"))
+		return;
+	if (iterations < 1)
+		iterations = 1;
+	int const tiles = TILES_X * TILES_Y;
+	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
+	uint16_t* tile_packets = (uint16_t*)malloc(tiles * sizeof(uint16_t));
+	opj_memory_stream in_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	opj_memory_stream jpwl_stream = {
+		.dataSize = BUFFER_SIZE >> 1,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE >> 1)
+	};
+	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
+	jpwl_dec_frame* frames = (jpwl_dec_frame*)calloc(CALIB_BATCH, sizeof(jpwl_dec_frame));
+	size_t* frame_positions = (size_t*)malloc(CALIB_BATCH * tiles * sizeof(size_t));
+	if (!pack_sens || !tile_packets || !in_stream.pData || !jpwl_stream.pData || !enc_bResults
+		|| !frames || !frame_positions) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return;
+	}
+	uint8_t* batch_buf = NULL;
+	size_t batch_cap = 0;
+
+	channel_model_t channels[BENCH_CHANNELS];
+	bench_link links[BENCH_CHANNELS * 2];
+	wchar_t const* link_names[BENCH_CHANNELS * 2];
+	HANDLE handles[BENCH_CHANNELS * 2];
+	int link_count = 0;
+	for (int c = 0; c < BENCH_CHANNELS; c++) {
+		if (bench_channel_init(channels + c, c)) {
+			wprintf(L"Channel %s skipped\n", bench_names[c]);
+			continue;
+		}
+		for (int s = 0; s < 2; s++, link_count++) {
+			memset(links + link_count, 0, sizeof(bench_link));
+			links[link_count].sim = chaos_sim_create(channels + c);
+			link_names[link_count] = bench_names[c];
+			if (!links[link_count].sim) {
+				wprintf(L"Memory allocation error, aborting\n");
+				return;
+			}
+		}
+	}
+	// Frames of one link per batch, so that a batch of all links fits into frames
+	int const per_link = link_count ? max(CALIB_BATCH / link_count, 1) : 0;
+
+	opj_cparameters_t bench_parameters;
+	opj_set_default_encoder_parameters(&bench_parameters);
+	bench_parameters.decod_format = BMP_DFMT;
+	bench_parameters.tcp_numlayers = 1;
+	bench_parameters.tcp_rates[0] = compression;
+	bench_parameters.cp_disto_alloc = 1;
+	bench_parameters.irreversible = 1;
+	bench_parameters.tile_size_on = 1;
+
+	if (jpwl_init())
+	{
+		wprintf(L"JPWL init failed\n");
+		return;
+	}
+	jpwl_enc_params enc_params;
+	jpwl_enc_set_default_params(&enc_params);
+	enc_params.wcoder_mh = 1;
+	enc_params.wcoder_th = 1;
+
+	err = encode_BMP_to_J2K(bmp, &in_stream, &bench_parameters, TILES_X, TILES_Y);
+	if (err) {
+		wprintf(L"Something went wrong while encoding to J2K code %d\n", err);
+		return;
+	}
+	sens_create(in_stream.pData, tile_packets, pack_sens);
+	jpwl_enc_bParams enc_bParams = {
+		.stream_len = in_stream.offset,
+		.tile_packets = tile_packets,
+		.pack_sens = pack_sens
+	};
+	fwprintf(bench_file, L"Channel\tStripe\tRS code\tJPWL length\tBuffer errors\tRecovered tiles\n");
+
+	for (int code = 0; code < JPWL_CODES && link_count; code++) {
+		enc_params.wcoder_data = jpwl_codes[code];
+		jpwl_enc_init(&enc_params);
+		if (jpwl_enc_run(in_stream.pData, jpwl_stream.pData, &enc_bParams, enc_bResults)) {
+			wprintf(L"Something went wrong while encoding to jpwl %d\n", enc_params.wcoder_data);
+			continue;
+		}
+		size_t length = enc_bResults->wcoder_out_len;
+		if (length > batch_cap) {
+			free(batch_buf);
+			batch_cap = length;
+			batch_buf = (uint8_t*)malloc(CALIB_BATCH * batch_cap);
+			if (!batch_buf) {
+				wprintf(L"Memory allocation error, aborting\n");
+				return;
+			}
+		}
+		for (int i = 0; i < link_count; i++) {
+			int s = i & 1;
+			links[i].stream = jpwl_stream.pData;
+			links[i].length = length;
+			links[i].mh_len = enc_bResults->wcoder_mh_len;
+			links[i].stripe = s ? enc_params.wcoder_data : 1;
+			links[i].frames = batch_buf + i * per_link * batch_cap;
+			links[i].frame_cap = batch_cap;
+			links[i].errors = links[i].tiles = 0;
+			channel_reset(&links[i].sim->channel, CHANNEL_SEED, i);
+		}
+
+		for (int t = 0; t < iterations; t += per_link) {
+			int n = iterations - t < per_link ? iterations - t : per_link;
+			for (int i = 0; i < link_count; i++) {
+				links[i].count = n;
+				handles[i] = CreateThread(NULL, 0, bench_link_run, links + i, 0, NULL);
+				if (!handles[i])		// no thread - transmit in this one
+					bench_link_run(links + i);
+			}
+			for (int i = 0; i < link_count; i++) {
+				if (handles[i]) {
+					WaitForSingleObject(handles[i], INFINITE);
+					CloseHandle(handles[i]);
+				}
+				if (links[i].failed) {
+					wprintf(L"Memory allocation error, aborting\n");
+					return;
+				}
+			}
+			for (int i = 0; i < link_count; i++) {
+				for (int k = 0; k < n; k++) {
+					jpwl_dec_bParams dec_bParams = {
+						.inp_buffer = links[i].frames + k * batch_cap,
+						.inp_length = length,
+						.out_buffer = NULL
+					};
+					frames[i * n + k].params = dec_bParams;
+					frames[i * n + k].tile_positions = frame_positions + (i * n + k) * tiles;
+				}
+			}
+			(void)jpwl_dec_run_batch(frames, link_count * n, threads, NULL);
+			for (int i = 0; i < link_count; i++) {
+				for (int k = 0; k < n; k++) {
+					if (!frames[i * n + k].status)
+						links[i].tiles += (double)frames[i * n + k].results.tile_all_rest_cnt / tiles;
+				}
+			}
+		}
+		for (int i = 0; i < link_count; i++)
+			fwprintf(bench_file, L"%s\t%zu\t%d\t%zu\t%.4f\t%.4f\n", link_names[i], links[i].stripe,
+				enc_params.wcoder_data, length, links[i].errors / iterations, links[i].tiles / iterations);
+		fflush(bench_file);
+		wprintf(L"\rChannels with jpwl %d done  ", enc_params.wcoder_data);
+	}
+	wprintf(L"\n");
+
+	for (int i = 0; i < link_count; i++)
+		chaos_sim_destroy(links[i].sim);
+	for (int c = 0; c < BENCH_CHANNELS; c++)
+		channel_free(channels + c);
+	jpwl_destroy();
+	free(batch_buf);
+	free(frame_positions);
+	free(frames);
+	free(enc_bResults);
+	free(jpwl_stream.pData);
+	free(in_stream.pData);
+	free(tile_packets);
+	free(pack_sens);
+	free(bmp);
+	fclose(bench_file);
+}
+
+/* Throughput of the packet interleaver (write_packets_with_interleave and
+ * read_packets_with_deinterleave) on a synthetic stream of BENCH_STREAM_SIZE bytes
+ * for stripe 1 and every code length, with a round trip check. Writes MB/s of both
+ * directions to ..\Backup\interleave.tsv */
+void benchmark_interleave(int iterations) {
+	if (iterations < 1)
+		iterations = 1;
+	FILE* bench_file;
+	if (_wfopen_s(&bench_file, L"..\\Backup\\interleave.tsv", L"wt, ccs=UTF-8"))
+		return;
+	uint8_t* stream = (uint8_t*)malloc(BENCH_STREAM_SIZE);
+	// read_packets_with_deinterleave writes whole interleave groups
+	uint8_t* copy = (uint8_t*)malloc(BENCH_STREAM_SIZE + PACKET_SIZE * 128);
+	if (!stream || !copy) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return;
+	}
+	xoshiro_state_t rng;
+	xoshiro_seed(&rng, CHANNEL_SEED, 0);
+	xoshiro_fill_uint(&rng, (uint32_t*)stream, BENCH_STREAM_SIZE / sizeof(uint32_t));
+
+	uint64_t StartingTime, MiddleTime, EndingTime;
+	fwprintf(bench_file, L"Stripe\tWrite, MB/s\tRead, MB/s\tRound trip\n");
+	for (int c = -1; c < JPWL_CODES; c++) {
+		size_t stripe = c < 0 ? 1 : jpwl_codes[c], packets = 0;
+		StartingTime = bench_now_ns();
+		for (int t = 0; t < iterations; t++)
+			packets = write_packets_with_interleave(stream, BENCH_STREAM_SIZE, stripe);
+		MiddleTime = bench_now_ns();
+		for (int t = 0; t < iterations; t++)
+			(void)read_packets_with_deinterleave(copy, packets, stripe);
+		EndingTime = bench_now_ns();
+		double mbytes = (double)iterations * BENCH_STREAM_SIZE / 1048576.0 * 1e9;
+		double write_speed = mbytes / max(MiddleTime - StartingTime, 1);
+		double read_speed = mbytes / max(EndingTime - MiddleTime, 1);
+		int round_trip = packets && !memcmp(stream, copy, BENCH_STREAM_SIZE);
+		fwprintf(bench_file, L"%zu\t%.0f\t%.0f\t%s\n", stripe, write_speed, read_speed,
+			round_trip ? L"ok" : L"FAILED");
+		wprintf(L"Stripe %zu: write %.0f MB/s, read %.0f MB/s%s\n", stripe, write_speed, read_speed,
+			round_trip ? L"" : L", round trip FAILED");
+	}
+
+	free(copy);
+	free(stream);
+	fclose(bench_file);
+}
+
+/* Stages of benchmark_pipeline, in the order a frame passes them */
+#define PIPE_STAGES 6
+static char const* const pipe_names[PIPE_STAGES] = {
+	"j2k_encode", "jpwl_encode", "channel", "jpwl_decode", "j2k_decode", "psnr" };
+
+/* Runs the whole chain of test_full_cycle warmup + repetitions times without console input and
+ * times every stage separately. Per stage the median and p99 of the repetitions, in ns, and the
+ * speed at the median, in MB of stage input per second, go to out_name.json and out_name.csv.
+ * The channel is iid with loss_percent packet loss; the error generator is seeded identically on
+ * every call, so two runs of one build see the same frames. Returns 0 or a negative error code.
+ * Like the rest of Experiment it is built only by the MSVC project (OpenJPEG, _wfopen_s, Windows
+ * paths); of the benchmark code only bench_timer.c compiles outside Windows */
+int benchmark_pipeline(wchar_t const* bmp_name, float compression, int protection, int loss_percent,
+	int warmup, int repetitions, wchar_t const* out_name) {
+	uint8_t* bmp = NULL;
+	size_t bmp_size = 0;
+	wchar_t name[MAX_PATH];
+	if (repetitions < 1 || warmup < 0)
+		return -2;
+	swprintf(name, MAX_PATH, L"%s.bmp", bmp_name);
+	errno_t err = read_BMP_from_file(name, &bmp, &bmp_size);
+	if (!bmp || err) {
+		wprintf(L"Something went wrong while reading bmp: code %d\n", err);
+		return -1;
+	}
+
+	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
+	uint16_t* tile_packets = (uint16_t*)malloc(TILES_X * TILES_Y * sizeof(uint16_t));
+	opj_memory_stream in_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	opj_memory_stream out_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	uint8_t* jpwl_buf = (uint8_t*)malloc(BUFFER_SIZE >> 1);
+	uint64_t* samples = (uint64_t*)malloc(PIPE_STAGES * repetitions * sizeof(uint64_t));
+	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
+	channel_model_t channel = { 0 };
+	int res = 0;
+	if (!pack_sens || !tile_packets || !in_stream.pData || !out_stream.pData || !jpwl_buf || !samples
+		|| !enc_bResults) {
+		wprintf(L"Memory allocation error, aborting\n");
+		res = -3;
+		goto free_buffers;
+	}
+
+	opj_cparameters_t pipe_parameters;
+	opj_set_default_encoder_parameters(&pipe_parameters);
+	pipe_parameters.decod_format = BMP_DFMT;
+	pipe_parameters.tcp_numlayers = 1;
+	pipe_parameters.tcp_rates[0] = compression;
+	pipe_parameters.cp_disto_alloc = 1;
+	pipe_parameters.irreversible = 1;
+	pipe_parameters.tile_size_on = 1;
+	if (protection == 1)	// UEP needs packet boundaries
+		pipe_parameters.csty |= 0x02;
+
+	if (jpwl_init())
+	{
+		wprintf(L"JPWL init failed\n");
+		res = -4;
+		goto free_buffers;
+	}
+	jpwl_enc_params enc_params;
+	jpwl_enc_set_default_params(&enc_params);
+	enc_params.wcoder_data = protection;
+	enc_params.wcoder_mh = 1;
+	enc_params.wcoder_th = 1;
+	jpwl_enc_init(&enc_params);
+	jpwl_dec_init();
+	jpwl_dec_bResults dec_bResults;
+	quality_factors qf;
+	channel_init_iid(&channel, CHANNEL_SEED, loss_percent * .01f, 0);
+
+	// Stage input sizes of the last repetition, all repetitions code the same frame
+	size_t stage_bytes[PIPE_STAGES];
+	uint64_t begin[PIPE_STAGES], end[PIPE_STAGES];
+	float psnr = 0;
+	int restored = 0;
+	for (int r = -warmup; r < repetitions; r++) {
+		in_stream.offset = 0;
+		begin[0] = bench_now_ns();
+		err = encode_BMP_to_J2K(bmp, &in_stream, &pipe_parameters, TILES_X, TILES_Y);
+		end[0] = bench_now_ns();
+		if (err) {
+			wprintf(L"Something went wrong while encoding: code %d\n", err);
+			res = -5;
+			goto done;
+		}
+
+		begin[1] = bench_now_ns();
+		sens_create(in_stream.pData, tile_packets, pack_sens);
+		jpwl_enc_bParams enc_bParams = {
+			.stream_len = in_stream.offset,
+			.tile_packets = tile_packets,
+			.pack_sens = pack_sens
+		};
+		if (jpwl_enc_run(in_stream.pData, jpwl_buf, &enc_bParams, enc_bResults)) {
+			res = -6;
+			goto done;
+		}
+		end[1] = bench_now_ns();
+		size_t const length = enc_bResults->wcoder_out_len;
+
+		// Main header is restored after the channel - we assume that it will be intact
+		memcpy(out_stream.pData, jpwl_buf, enc_bResults->wcoder_mh_len);
+		begin[2] = bench_now_ns();
+		if (loss_percent > 0)
+			(void)channel_buffer_errors(&channel, jpwl_buf, length, protection);
+		end[2] = bench_now_ns();
+		memcpy(jpwl_buf, out_stream.pData, enc_bResults->wcoder_mh_len);
+
+		jpwl_dec_bParams dec_bParams = {
+			.inp_buffer = jpwl_buf,
+			.inp_length = length,
+			.out_buffer = in_stream.pData,
+			.use_red = 1
+		};
+		memcpy(tile_positions, enc_bResults->tile_position, sizeof(tile_positions));
+		begin[3] = bench_now_ns();
+		if (jpwl_dec_run(&dec_bParams, &dec_bResults, tile_positions)) {
+			res = -7;
+			goto done;
+		}
+		end[3] = bench_now_ns();
+
+		size_t j2k_length = dec_bResults.out_length;
+		(void)skip_RED_ranges(in_stream.pData, &j2k_length, tile_positions, TILES_X * TILES_Y);
+		for (int i = 0; i < TILES_X * TILES_Y; i++) {
+			if (!tile_positions[i]) continue;
+			memcpy(in_stream.pData + tile_positions[i], enc_bResults->tile_headers[i],
+				sizeof(enc_bResults->tile_headers[0]));
+		}
+		in_stream.offset = 0;
+		out_stream.offset = 0;
+		begin[4] = bench_now_ns();
+		err = decode_J2K_to_BMP(&in_stream, &out_stream, enc_bResults->tile_position);
+		end[4] = bench_now_ns();
+		if (err) {
+			wprintf(L"Something went wrong while decoding: code %d\n", err);
+			res = -8;
+			goto done;
+		}
+
+		begin[5] = bench_now_ns();
+		err = calculate_qf(bmp, out_stream.pData, &qf);
+		end[5] = bench_now_ns();
+		if (err) {
+			wprintf(L"Something went wrong while comparing images: code %d\n", err);
+			res = -9;
+			goto done;
+		}
+
+		stage_bytes[0] = bmp_size;
+		stage_bytes[1] = enc_bParams.stream_len;
+		stage_bytes[2] = length;
+		stage_bytes[3] = length;
+		stage_bytes[4] = dec_bResults.out_length;
+		stage_bytes[5] = bmp_size;
+		psnr = qf.PSNR;
+		restored = dec_bResults.tile_all_rest_cnt;
+		if (r >= 0)
+			for (int s = 0; s < PIPE_STAGES; s++)
+				samples[s * repetitions + r] = end[s] - begin[s];
+		wprintf(L"\r%s %d/%d  ", r < 0 ? L"Warmup" : L"Repetition", r < 0 ? r + warmup + 1 : r + 1,
+			r < 0 ? warmup : repetitions);
+	}
+	wprintf(L"\n");
+
+	bench_stats_t stats[PIPE_STAGES];
+	for (int s = 0; s < PIPE_STAGES; s++) {
+		bench_summarize(samples + s * repetitions, repetitions, stage_bytes[s], stats + s);
+		wprintf(L"%-12S median %10llu ns, p99 %10llu ns, %8.1f MB/s\n", pipe_names[s],
+			stats[s].median, stats[s].p99, stats[s].mbps);
+	}
+
+	// Plain ASCII without BOM, to be read by regression scripts
+	FILE* json, * csv;
+	swprintf(name, MAX_PATH, L"%s.json", out_name);
+	err = _wfopen_s(&json, name, L"wt");
+	swprintf(name, MAX_PATH, L"%s.csv", out_name);
+	if (err || _wfopen_s(&csv, name, L"wt")) {
+		if (!err)
+			fclose(json);
+		wprintf(L"Cannot write %s\n", name);
+		res = -10;
+		goto done;
+	}
+	wchar_t const* image = wcsrchr(bmp_name, L'\\');
+	fprintf(json, "{\n  \"image\": \"%S\",\n  \"compression\": %.2f,\n  \"code\": %d,\n  \"loss_percent\": %d,\n"
+		"  \"tiles\": %d,\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"psnr_db\": %.3f,\n"
+		"  \"restored_tiles\": %d,\n  \"stages\": [\n", image ? image + 1 : bmp_name, compression, protection, loss_percent,
+		TILES_X * TILES_Y, warmup, repetitions, psnr, restored);
+	fprintf(csv, "stage,bytes,repetitions,min_ns,median_ns,p99_ns,mean_ns,mb_per_s\n");
+	for (int s = 0; s < PIPE_STAGES; s++) {
+		fprintf(json, "    { \"stage\": \"%s\", \"bytes\": %zu, \"min_ns\": %llu, \"median_ns\": %llu, "
+			"\"p99_ns\": %llu, \"mean_ns\": %llu, \"mb_per_s\": %.2f }%s\n", pipe_names[s], stage_bytes[s],
+			stats[s].min, stats[s].median, stats[s].p99, stats[s].mean, stats[s].mbps,
+			s < PIPE_STAGES - 1 ? "," : "");
+		fprintf(csv, "%s,%zu,%d,%llu,%llu,%llu,%llu,%.2f\n", pipe_names[s], stage_bytes[s], repetitions,
+			stats[s].min, stats[s].median, stats[s].p99, stats[s].mean, stats[s].mbps);
+	}
+	fprintf(json, "  ]\n}\n");
+	fclose(json);
+	fclose(csv);
+
+done:
+	channel_free(&channel);
+	jpwl_destroy();
+free_buffers:
+	free(enc_bResults);
+	free(samples);
+	free(jpwl_buf);
+	free(out_stream.pData);
+	free(in_stream.pData);
+	free(tile_packets);
+	free(pack_sens);
+	free(bmp);
+	return res;
+}
+
+/* Sends the JPWL stream of an image frames times as RTP over a loopback UDP socket pair.
+ * The iid channel of add_chaos decides which packets are not sent, neighbouring packets
+ * are swapped to arrive out of order, and the receiver reassembles every frame from
+ * sequence numbers. Lost packets found by the receiver (channel and socket drops) are
+ * written next to the channel drops and the recovered tiles to ..\Backup\rtp_loopback.tsv */
+void test_rtp_loopback(wchar_t const* bmp_name, float compression, int protection, int loss_percent, int frames) {
+	uint8_t* bmp = NULL;
+	size_t bmp_size = 0;
+	wchar_t name[64];
+	swprintf(name, 64, L"%s.bmp", bmp_name);
+	errno_t err = read_BMP_from_file(name, &bmp, &bmp_size);
+	if (!bmp || err) {
+		wprintf(L"Something went wrong while reading bmp: code %d\n", err);
+		return;
+	}
+
+	FILE* test_data;
+	if (_wfopen_s(&test_data, L"..\\Backup\\rtp_loopback.tsv", L"wt, ccs=UTF-8"))
+		return;
+	int const tiles = TILES_X * TILES_Y;
+	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
+	uint16_t* tile_packets = (uint16_t*)malloc(tiles * sizeof(uint16_t));
+	opj_memory_stream in_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	opj_memory_stream jpwl_stream = {
+		.dataSize = BUFFER_SIZE >> 1,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE >> 1)
+	};
+	// The receiver writes whole interleave groups
+	uint8_t* rx_buf = (uint8_t*)malloc((BUFFER_SIZE >> 1) + PACKET_SIZE * 128);
+	rtp_packet_t* tx_packets = (rtp_packet_t*)malloc(BUFFER_SIZE / PACKET_SIZE / 2 * sizeof(rtp_packet_t));
+	rtp_packet_t* rx_packets = (rtp_packet_t*)malloc(RTP_BATCH * 4 * sizeof(rtp_packet_t));
+	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
+	rtp_stream_t* tx = rtp_stream_create(RTP_SSRC, RTP_FIRST_SEQUENCE, RTP_PAYLOAD_TYPE);
+	rtp_stream_t* rx = rtp_stream_create(RTP_SSRC, RTP_FIRST_SEQUENCE, RTP_PAYLOAD_TYPE);
+	if (!pack_sens || !tile_packets || !in_stream.pData || !jpwl_stream.pData || !rx_buf || !tx_packets
+		|| !rx_packets || !enc_bResults || !tx || !rx) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return;
+	}
+	rtp_socket_t tx_sock, rx_sock;
+	err = rtp_socket_pair(&tx_sock, &rx_sock);
+	if (err) {
+		wprintf(L"Loopback sockets failed: code %d\n", err);
+		return;
+	}
+
+	opj_cparameters_t rtp_parameters;
+	opj_set_default_encoder_parameters(&rtp_parameters);
+	rtp_parameters.decod_format = BMP_DFMT;
+	rtp_parameters.tcp_numlayers = 1;
+	rtp_parameters.tcp_rates[0] = compression;
+	rtp_parameters.cp_disto_alloc = 1;
+	rtp_parameters.irreversible = 1;
+	rtp_parameters.tile_size_on = 1;
+
+	if (jpwl_init())
+	{
+		wprintf(L"JPWL init failed\n");
+		return;
+	}
+	jpwl_enc_params enc_params;
+	jpwl_enc_set_default_params(&enc_params);
+	enc_params.wcoder_data = protection;
+	enc_params.wcoder_mh = 1;
+	enc_params.wcoder_th = 1;
+	jpwl_enc_init(&enc_params);
+	jpwl_dec_bResults dec_bResults;
+
+	err = encode_BMP_to_J2K(bmp, &in_stream, &rtp_parameters, TILES_X, TILES_Y);
+	if (err) {
+		wprintf(L"Something went wrong while encoding to J2K code %d\n", err);
+		return;
+	}
+	sens_create(in_stream.pData, tile_packets, pack_sens);
+	jpwl_enc_bParams enc_bParams = {
+		.stream_len = in_stream.offset,
+		.tile_packets = tile_packets,
+		.pack_sens = pack_sens
+	};
+	if (jpwl_enc_run(in_stream.pData, jpwl_stream.pData, &enc_bParams, enc_bResults)) {
+		wprintf(L"Something went wrong while encoding to jpwl %d\n", protection);
+		return;
+	}
+	size_t const length = enc_bResults->wcoder_out_len;
+	memcpy(tile_positions, enc_bResults->tile_position, sizeof(tile_positions));
+
+	channel_model_t channel;
+	channel_init_iid(&channel, CHANNEL_SEED, loss_percent * .01f, 0);
+	fwprintf(test_data, L"Frame\tPackets\tChannel drops\tLost packets\tReordered\tRecovered tiles\n");
+	for (int f = 0; f < frames; f++) {
+		size_t count = rtp_packetize(tx, jpwl_stream.pData, length, protection, f * RTP_FRAME_TICKS);
+		if (!count || rtp_frame_begin(rx, length, protection) != count) {
+			wprintf(L"Memory allocation error, aborting\n");
+			return;
+		}
+		// Packets dropped by the channel are not sent, every other pair is swapped with probability 1/4
+		size_t sent = 0;
+		for (size_t i = 0; i < count; i++)
+			if (xoshiro_float(&channel.rng) >= channel.state[0].loss)
+				tx_packets[sent++] = tx->sim->packets[i];
+		for (size_t i = 0; i + 1 < sent; i += 2)
+			if (xoshiro_float(&channel.rng) < .25f) {
+				rtp_packet_t swap = tx_packets[i];
+				tx_packets[i] = tx_packets[i + 1];
+				tx_packets[i + 1] = swap;
+			}
+
+		int received;
+		for (size_t i = 0; i < sent; i += RTP_BATCH) {
+			if (rtp_send(tx_sock, tx_packets + i, sent - i < RTP_BATCH ? sent - i : RTP_BATCH) < 0)
+				wprintf(L"Send failed\n");
+			received = rtp_recv(rx_sock, rx_packets, RTP_BATCH * 4, 0);
+			if (received > 0)
+				rtp_depacketize(rx, rx_packets, received);
+		}
+		while (rx->received < sent && (received = rtp_recv(rx_sock, rx_packets, RTP_BATCH * 4, RTP_TIMEOUT_MS)) > 0)
+			rtp_depacketize(rx, rx_packets, received);
+		size_t lost = rtp_frame_end(rx, rx_buf);
+
+		// Restore main header - we assume that it will be intact
+		memcpy(rx_buf, jpwl_stream.pData, enc_bResults->wcoder_mh_len);
+		jpwl_dec_bParams dec_bParams = {
+			.inp_buffer = rx_buf,
+			.inp_length = length,
+			.out_buffer = in_stream.pData
+		};
+		int recovered = -1;
+		if (!jpwl_dec_run(&dec_bParams, &dec_bResults, tile_positions))
+			recovered = dec_bResults.tile_all_rest_cnt;
+		fwprintf(test_data, L"%d\t%zu\t%zu\t%zu\t%zu\t%d\n", f, count, count - sent, lost, rx->reordered, recovered);
+		wprintf(L"\rFrame %d: %zu packets, %zu dropped, %zu lost, %zu reordered, %d/%d tiles  ",
+			f, count, count - sent, lost, rx->reordered, recovered, tiles);
+	}
+	wprintf(L"\n");
+
+	rtp_socket_close(tx_sock);
+	rtp_socket_close(rx_sock);
+	rtp_stream_destroy(tx);
+	rtp_stream_destroy(rx);
+	jpwl_destroy();
+	free(enc_bResults);
+	free(rx_packets);
+	free(tx_packets);
+	free(rx_buf);
+	free(jpwl_stream.pData);
+	free(in_stream.pData);
+	free(tile_packets);
+	free(pack_sens);
+	free(bmp);
+	fclose(test_data);
+}
+
+// Kills the SOT of one tile per frame, decodes with RED and checks every reported position
+int test_red_positions(wchar_t const* bmp_name, float compression, int protection) {
+	uint8_t* bmp = NULL;
+	size_t bmp_size = 0;
+	wchar_t name[64];
+	swprintf(name, 64, L"%s.bmp", bmp_name);
+	errno_t err = read_BMP_from_file(name, &bmp, &bmp_size);
+	if (!bmp || err) {
+		wprintf(L"Something went wrong while reading bmp: code %d\n", err);
+		return -1;
+	}
+
+	int const tiles = TILES_X * TILES_Y;
+	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
+	uint16_t* tile_packets = (uint16_t*)malloc(tiles * sizeof(uint16_t));
+	opj_memory_stream in_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	uint8_t* jpwl_buf = (uint8_t*)malloc(BUFFER_SIZE >> 1);
+	uint8_t* rx_buf = (uint8_t*)malloc(BUFFER_SIZE >> 1);
+	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
+	if (!pack_sens || !tile_packets || !in_stream.pData || !jpwl_buf || !rx_buf || !enc_bResults) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return -1;
+	}
+
+	opj_cparameters_t red_parameters;
+	opj_set_default_encoder_parameters(&red_parameters);
+	red_parameters.decod_format = BMP_DFMT;
+	red_parameters.tcp_numlayers = 1;
+	red_parameters.tcp_rates[0] = compression;
+	red_parameters.cp_disto_alloc = 1;
+	red_parameters.irreversible = 1;
+	red_parameters.tile_size_on = 1;
+
+	if (jpwl_init())
+	{
+		wprintf(L"JPWL init failed\n");
+		return -1;
+	}
+	jpwl_enc_params enc_params;
+	jpwl_enc_set_default_params(&enc_params);
+	enc_params.wcoder_data = protection;
+	enc_params.wcoder_mh = 1;
+	enc_params.wcoder_th = 1;
+	jpwl_enc_init(&enc_params);
+	jpwl_dec_bResults dec_bResults;
+
+	err = encode_BMP_to_J2K(bmp, &in_stream, &red_parameters, TILES_X, TILES_Y);
+	if (err) {
+		wprintf(L"Something went wrong while encoding to J2K code %d\n", err);
+		return -1;
+	}
+	sens_create(in_stream.pData, tile_packets, pack_sens);
+	jpwl_enc_bParams enc_bParams = {
+		.stream_len = in_stream.offset,
+		.tile_packets = tile_packets,
+		.pack_sens = pack_sens
+	};
+	if (jpwl_enc_run(in_stream.pData, jpwl_buf, &enc_bParams, enc_bResults)) {
+		wprintf(L"Something went wrong while encoding to jpwl %d\n", protection);
+		return -1;
+	}
+	size_t const length = enc_bResults->wcoder_out_len;
+
+	int failed = 0;
+	for (int k = 0; k < tiles; k++) {
+		memcpy(rx_buf, jpwl_buf, length);
+		// The SOT of tile k and the EPB behind it are lost, so the decoder resyncs past it
+		size_t sot;
+		for (sot = enc_bResults->wcoder_mh_len; sot + 12 < length; sot++)
+			if (rx_buf[sot] == 0xff && rx_buf[sot + 1] == 0x90
+				&& (rx_buf[sot + 4] << 8 | rx_buf[sot + 5]) == k)
+				break;
+		for (size_t i = sot; i < sot + 100 && i < length; i++)
+			rx_buf[i] ^= 0x5a;
+
+		jpwl_dec_bParams dec_bParams = {
+			.inp_buffer = rx_buf,
+			.inp_length = length,
+			.out_buffer = in_stream.pData,
+			.use_red = 1
+		};
+		memcpy(tile_positions, enc_bResults->tile_position, sizeof(tile_positions));
+		if (jpwl_dec_run(&dec_bParams, &dec_bResults, tile_positions)) {
+			wprintf(L"Tile %d: decoder failed\n", k);
+			failed++;
+			continue;
+		}
+		// Every position must point at the SOT whose Isot equals its index
+		int found = 0, wrong = 0;
+		for (int i = 0; i < tiles; i++) {
+			size_t pos = tile_positions[i];
+			if (!pos) continue;
+			found++;
+			uint8_t const* p = in_stream.pData + pos;
+			if (pos + 6 > dec_bResults.out_length || p[0] != 0xff || p[1] != 0x90 || (p[4] << 8 | p[5]) != i)
+				wrong++;
+		}
+		if (wrong || found != dec_bResults.tile_all_rest_cnt) {
+			wprintf(L"Tile %d: %d wrong positions, %d of %d restored tiles found\n",
+				k, wrong, found, dec_bResults.tile_all_rest_cnt);
+			failed++;
+		}
+	}
+	wprintf(L"RED positions: %d of %d frames failed\n", failed, tiles);
+
+	jpwl_destroy();
+	free(enc_bResults);
+	free(rx_buf);
+	free(jpwl_buf);
+	free(in_stream.pData);
+	free(tile_packets);
+	free(pack_sens);
+	free(bmp);
+	return failed;
+}
+
+// Streams one frame tile by tile from the encoder to the decoder. The main header is pushed as
+// jpwl_enc_stream_begin returns it (EPC DL = 0), jpwl_enc_stream_end's patched copy is never sent
+int test_stream_round_trip(wchar_t const* bmp_name, float compression, int protection) {
+	uint8_t* bmp = NULL;
+	size_t bmp_size = 0;
+	wchar_t name[64];
+	swprintf(name, 64, L"%s.bmp", bmp_name);
+	errno_t err = read_BMP_from_file(name, &bmp, &bmp_size);
+	if (!bmp || err) {
+		wprintf(L"Something went wrong while reading bmp: code %d\n", err);
+		return -1;
+	}
+
+	int const tiles = TILES_X * TILES_Y;
+	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
+	uint16_t* tile_packets = (uint16_t*)malloc(tiles * sizeof(uint16_t));
+	opj_memory_stream in_stream = {
+		.dataSize = BUFFER_SIZE,
+		.offset = 0,
+		.pData = (uint8_t*)malloc(BUFFER_SIZE)
+	};
+	uint8_t* jpwl_buf = (uint8_t*)malloc(BUFFER_SIZE >> 1);
+	uint8_t* rx_buf = (uint8_t*)malloc(BUFFER_SIZE >> 1);
+	uint8_t* out_buf = (uint8_t*)malloc(BUFFER_SIZE >> 1);
+	if (!pack_sens || !tile_packets || !in_stream.pData || !jpwl_buf || !rx_buf || !out_buf) {
+		wprintf(L"Memory allocation error, aborting\n");
+		return -1;
+	}
+
+	opj_cparameters_t stream_parameters;
+	opj_set_default_encoder_parameters(&stream_parameters);
+	stream_parameters.decod_format = BMP_DFMT;
+	stream_parameters.tcp_numlayers = 1;
+	stream_parameters.tcp_rates[0] = compression;
+	stream_parameters.cp_disto_alloc = 1;
+	stream_parameters.irreversible = 1;
+	stream_parameters.tile_size_on = 1;
+
+	if (jpwl_init())
+	{
+		wprintf(L"JPWL init failed\n");
+		return -1;
+	}
+	jpwl_enc_params enc_params;
+	jpwl_enc_set_default_params(&enc_params);
+	enc_params.wcoder_data = protection;
+	enc_params.wcoder_mh = 1;
+	enc_params.wcoder_th = 1;
+	jpwl_enc_init(&enc_params);
+	jpwl_dec_bResults dec_bResults;
+
+	err = encode_BMP_to_J2K(bmp, &in_stream, &stream_parameters, TILES_X, TILES_Y);
+	if (err) {
+		wprintf(L"Something went wrong while encoding to J2K code %d\n", err);
+		return -1;
+	}
+	sens_create(in_stream.pData, tile_packets, pack_sens);
+
+	// Main header ends at the first SOT
+	uint8_t* tile = in_stream.pData;
+	while (tile + 1 < in_stream.pData + in_stream.offset && !(tile[0] == 0xff && tile[1] == 0x90))
+		tile++;
+	size_t length = 0, piece;
+	memset(tile_positions, 0, sizeof(tile_positions));
+	jpwl_dec_stream_begin(rx_buf, BUFFER_SIZE >> 1, out_buf, tile_positions, NULL, NULL);
+	err = jpwl_enc_stream_begin(in_stream.pData, tile - in_stream.pData, jpwl_buf, &piece);
+	if (!err)
+		err = jpwl_dec_stream_push(jpwl_buf, piece);	// sent before any tile is encoded
+	length += piece;
+	uint8_t* sens = pack_sens;
+	for (int t = 0; t < tiles && !err; t++) {
+		size_t psot = (size_t)tile[6] << 24 | tile[7] << 16 | tile[8] << 8 | tile[9];
+		err = jpwl_enc_stream_tile(tile, psot, tile_packets[t], sens, jpwl_buf + length, &piece);
+		if (!err)
+			err = jpwl_dec_stream_push(jpwl_buf + length, piece);
+		length += piece;
+		sens += tile_packets[t];
+		tile += psot;
+	}
+	if (!err)
+		err = jpwl_enc_stream_end(jpwl_buf, jpwl_buf + length, &piece);
+	if (!err)
+		err = jpwl_dec_stream_push(jpwl_buf + length, piece);
+	length += piece;
+	if (err) {
+		wprintf(L"Streaming failed: code %d\n", err);
+		jpwl_dec_stream_end(&dec_bResults);
+		return -1;
+	}
+	err = jpwl_dec_stream_end(&dec_bResults);
+
+	int identical = !err && dec_bResults.out_length == in_stream.offset
+		&& !memcmp(out_buf, in_stream.pData, in_stream.offset);
+	wprintf(L"Stream round trip: %zu bytes of JPWL, decoder code %d, %d of %d tiles restored, output %s\n",
+		length, err, dec_bResults.tile_all_rest_cnt, tiles, identical ? L"identical" : L"DIFFERS");
+
+	jpwl_destroy();
+	free(out_buf);
+	free(rx_buf);
+	free(jpwl_buf);
+	free(in_stream.pData);
+	free(tile_packets);
+	free(pack_sens);
+	free(bmp);
+	return identical ? 0 : -1;
+}
+
+void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int min_tiles_percent, error_functions func,
+	adaptive_mode mode, int tile_codes) {
 	uint8_t* bmp = NULL;
 	size_t bmp_size = 0;
 	wchar_t name[64];
@@ -410,11 +1543,12 @@ void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int
 	}
 
 	FILE* test_data;
-	swprintf(name, 64, L"..\\Backup\\adaptive_%dt_%df.tsv", min_tiles_percent, func);
+	swprintf(name, 64, L"..\\Backup\\adaptive_%dt_%df%s%s.tsv", min_tiles_percent, func,
+		mode == ADAPTIVE_MPC ? L"_mpc" : L"", tile_codes ? L"_tiles" : L"");
 	if (_wfopen_s(&test_data, name, L"wt, ccs=UTF-8"))
 		return;
 	uint8_t* pack_sens = (uint8_t*)malloc(MAX_EPBSIZE);
-	uint16_t* tile_packets = (uint16_t*)malloc(MAX_TILES);
+	uint16_t* tile_packets = (uint16_t*)malloc(TILES_X * TILES_Y * sizeof(uint16_t));
 	opj_memory_stream in_stream = {
 		.dataSize = BUFFER_SIZE,
 		.offset = 0,
@@ -431,8 +1565,11 @@ void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int
 		.pData = (uint8_t*)malloc(BUFFER_SIZE >> 1)
 	};
 	jpwl_enc_bResults* enc_bResults = malloc(sizeof(jpwl_enc_bResults));
+	adaptive_ctrl_t* adaptive = adaptive_ctrl_create(WINDOW_SIZE, mode);
+	if (adaptive)	// thresholds from calibrate_err_matrix, if it was run
+		(void)adaptive_ctrl_load_matrix(adaptive, L"..\\Backup\\err_matrix.tsv", TILES_X * TILES_Y);
 	if (!pack_sens || !tile_packets || !test_data || !jpwl_stream.pData 
-		|| !in_stream.pData || !out_stream.pData || !enc_bResults)
+		|| !in_stream.pData || !out_stream.pData || !enc_bResults || !adaptive)
 	{
 		wprintf(L"Memory allocation error, aborting\n");
 		return;
@@ -467,13 +1604,13 @@ void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int
 	}
 	sens_create(in_stream.pData, tile_packets, pack_sens);
 	jpwl_enc_bParams enc_bParams = {
-		.stream_len = (uint32_t)in_stream.offset,
+		.stream_len = in_stream.offset,
 		.tile_packets = tile_packets,
 		.pack_sens = pack_sens
 	};
 
-	chaos_init();
-	fwprintf(test_data, L"Iteration\tRS code\tBuffer errors\tRecovered tiles\n");
+	chaos_seed(CHAOS_SEED);
+	fwprintf(test_data, L"Iteration\tRS code\tBuffer errors\tRecovered tiles\tJPWL length\n");
 
 	float err_prob = 0;
 	for (int i = 0; i < ADAPTIVE_ITERATIONS; i++) {
@@ -487,8 +1624,6 @@ void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int
 			continue;
 		}
 
-		size_t packets = write_packets_with_interleave(
-			jpwl_stream.pData, enc_bResults->wcoder_out_len, enc_params.wcoder_data);
 		memcpy(out_stream.pData, jpwl_stream.pData, enc_bResults->wcoder_mh_len);
 
 		switch (func)
@@ -514,15 +1649,17 @@ void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int
 		default:
 			break;
 		}
-		int errors = create_packet_errors((int)packets, err_prob, 1);
+		int errors = transmit_with_interleave(jpwl_stream.pData, enc_bResults->wcoder_out_len,
+			enc_params.wcoder_data, err_prob);
 		memcpy(jpwl_stream.pData, out_stream.pData, enc_bResults->wcoder_mh_len);
-		(void)read_packets_with_deinterleave(jpwl_stream.pData, packets, enc_params.wcoder_data);
 
 		jpwl_dec_bParams dec_bParams = {
 			.inp_buffer = jpwl_stream.pData,
 			.inp_length = enc_bResults->wcoder_out_len,
 			.out_buffer = out_stream.pData
 		};
+		// Without RED the decoder only zeroes the positions of tiles it did not restore
+		memcpy(tile_positions, enc_bResults->tile_position, sizeof(tile_positions));
 		if (jpwl_dec_run(&dec_bParams, &dec_bResults, tile_positions)) {
 			wprintf(L"Something went wrong while decoding from jpwl %d\n", enc_params.wcoder_data);
 			continue;
@@ -530,15 +1667,22 @@ void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int
 		float buffer_errors = (float)errors / enc_bResults->wcoder_out_len;
 		float recovered_tiles = (float)dec_bResults.tile_all_rest_cnt / (TILES_X * TILES_Y);
 
-		fwprintf(test_data, L"%d\t%d\t%.1f\t%d\n", i, enc_params.wcoder_data,
-			buffer_errors * 100.0f, (int)(recovered_tiles * 100.0f));
-		select_params_adaptive(buffer_errors, recovered_tiles, min_tiles_percent * .01f, &enc_params);
+		fwprintf(test_data, L"%d\t%d\t%.1f\t%d\t%zu\n", i, enc_params.wcoder_data,
+			buffer_errors * 100.0f, (int)(recovered_tiles * 100.0f), enc_bResults->wcoder_out_len);
+		adaptive_ctrl_rs_stats(adaptive, &dec_bResults);
+		select_params_adaptive(adaptive, buffer_errors, recovered_tiles, min_tiles_percent * .01f, &enc_params);
+		if (tile_codes) {	// stronger codes for the tiles that failed recently
+			(void)adaptive_ctrl_tile_stats(adaptive, tile_positions, TILES_X * TILES_Y);
+			select_tile_codes_adaptive(adaptive, &enc_params);
+		}
 
 		if (!(i & 15)) {
 			wprintf(L"\rTest iteration %d completed", i);
 		}
 	};
 
+	print_mem_stats();
+	adaptive_ctrl_destroy(adaptive);
 	jpwl_destroy();
 	free(pack_sens);
 	free(jpwl_stream.pData);
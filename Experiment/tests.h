@@ -1,9 +1,26 @@
 #pragma once
 #include <stdint.h>
 #include "experiment.h"
+#include "../jpwl/adaptive.h"
 
 void test_full_cycle(wchar_t const* bmp_name, float compression, int protection, int err_probability);
 
 void test_error_recovery(wchar_t const* bmp_name, float compression, int iterations);
 
-void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int min_tiles_percent, error_functions func);
+void test_adaptive_algorithm(wchar_t const* bmp_name, int max_error_percent, int min_tiles_percent, error_functions func,
+	adaptive_mode mode, int tile_codes);
+
+void calibrate_err_matrix(wchar_t const* bmp_name, float compression, int iterations, int threads);
+
+void benchmark_channels(wchar_t const* bmp_name, float compression, int iterations, int threads);
+
+void benchmark_interleave(int iterations);
+
+void test_rtp_loopback(wchar_t const* bmp_name, float compression, int protection, int loss_percent, int frames);
+
+int test_red_positions(wchar_t const* bmp_name, float compression, int protection);
+
+int test_stream_round_trip(wchar_t const* bmp_name, float compression, int protection);
+
+int benchmark_pipeline(wchar_t const* bmp_name, float compression, int protection, int loss_percent,
+	int warmup, int repetitions, wchar_t const* out_name);
@@ -4,11 +4,307 @@
 #include <stdint.h>
 #include "math.h"
 #include <time.h>
+#include <emmintrin.h>
 #include "add_chaos.h"
 #include "chaos_params.h"
 #include "mt19937.h"
 
-rtp_packet_t packets[MAX_PACKETS];
+#define TRANSPOSE_BLOCK 16	// сторона блока транспонирования при чередовании: пакетов и байт
+#define CHAOS_DRAWS 256		// случайных чисел, получаемых от генератора за один вызов
+
+static chaos_sim_t chaos_default;	// симулятор функций без явного симулятора (write_packets_with_interleave и др.)
+static xoshiro_state_t chaos_rng;	// генератор потерь create_packet_errors и transmit_with_interleave
+
+/**
+ * \brief Транспонирование блока 16x16 байт
+ * \details Каждый шаг из пар строк k и k + 8 собирает строки 2k и 2k + 1 чередованием байт, что циклически
+ * сдвигает 8-битный индекс элемента (строка, столбец) на 1 бит. После четырех шагов строка и столбец меняются местами
+ * \param x  Строки блока, заменяются столбцами
+ */
+static void transpose_16x16(__m128i* x)
+{
+	__m128i t[TRANSPOSE_BLOCK], *src = x, *dst = t, *swap;
+	int k, step;
+
+	for (step = 0; step < 4; step++) {		// четное число шагов - результат снова в x
+		for (k = 0; k < TRANSPOSE_BLOCK / 2; k++) {
+			dst[2 * k] = _mm_unpacklo_epi8(src[k], src[k + TRANSPOSE_BLOCK / 2]);
+			dst[2 * k + 1] = _mm_unpackhi_epi8(src[k], src[k + TRANSPOSE_BLOCK / 2]);
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+}
+
+/**
+ * \brief Раскладка полной группы чередования по пакетам
+ * \details Группа - матрица PACKET_SIZE x stripe байт, пакет j - ее столбец j. Матрица транспонируется блоками
+ * 16x16, так что за проход по блокам столбцов записываются подряд 16 пакетов, а не по байту в stripe пакетов
+ * \param p  Пакеты группы
+ * \param buf  Данные группы, PACKET_SIZE * stripe байт
+ * \param stripe  Глубина чередования в пакетах
+ */
+static void interleave_group(rtp_packet_t* p, uint8_t const* buf, size_t stripe)
+{
+	__m128i x[TRANSPOSE_BLOCK];
+	size_t i, j, k;
+
+	if (stripe == 1) {
+		memcpy(p->payload, buf, PACKET_SIZE);
+		return;
+	}
+	for (j = 0; j + TRANSPOSE_BLOCK <= stripe; j += TRANSPOSE_BLOCK)
+		for (i = 0; i < PACKET_SIZE; i += TRANSPOSE_BLOCK) {
+			for (k = 0; k < TRANSPOSE_BLOCK; k++)
+				x[k] = _mm_loadu_si128((__m128i const*)(buf + (i + k) * stripe + j));
+			transpose_16x16(x);
+			for (k = 0; k < TRANSPOSE_BLOCK; k++)
+				_mm_storeu_si128((__m128i*)(p[j + k].payload + i), x[k]);
+		}
+	for (i = 0; i < PACKET_SIZE; i++)		// последние stripe % 16 пакетов
+		for (k = j; k < stripe; k++)
+			p[k].payload[i] = buf[i * stripe + k];
+}
+
+/**
+ * \brief Сборка полной группы чередования из пакетов, обратное interleave_group
+ * \param out_buf  Буфер для данных группы, PACKET_SIZE * stripe байт
+ * \param p  Пакеты группы
+ * \param stripe  Глубина чередования в пакетах
+ */
+static void deinterleave_group(uint8_t* out_buf, rtp_packet_t const* p, size_t stripe)
+{
+	__m128i x[TRANSPOSE_BLOCK];
+	size_t i, j, k;
+
+	if (stripe == 1) {
+		memcpy(out_buf, p->payload, PACKET_SIZE);
+		return;
+	}
+	for (j = 0; j + TRANSPOSE_BLOCK <= stripe; j += TRANSPOSE_BLOCK)
+		for (i = 0; i < PACKET_SIZE; i += TRANSPOSE_BLOCK) {
+			for (k = 0; k < TRANSPOSE_BLOCK; k++)
+				x[k] = _mm_loadu_si128((__m128i const*)(p[j + k].payload + i));
+			transpose_16x16(x);
+			for (k = 0; k < TRANSPOSE_BLOCK; k++)
+				_mm_storeu_si128((__m128i*)(out_buf + (i + k) * stripe + j), x[k]);
+		}
+	for (i = 0; i < PACKET_SIZE; i++)
+		for (k = j; k < stripe; k++)
+			out_buf[i * stripe + k] = p[k].payload[i];
+}
+
+/**
+ * \brief Выделение места под пакеты кадра
+ * \param sim  Симулятор
+ * \param count  Количество пакетов
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
+ */
+static int chaos_sim_reserve(chaos_sim_t* sim, size_t count)
+{
+	rtp_packet_t* grown;
+
+	if (count <= sim->capacity)
+		return 0;
+	grown = (rtp_packet_t*)realloc(sim->packets, count * sizeof(rtp_packet_t));
+	if (!grown)
+		return -1;
+	sim->packets = grown;
+	sim->capacity = count;
+	return 0;
+}
+
+/**
+ * \brief Раскладка буфера по пакетам симулятора
+ * \details Буфер делится на группы по stripe пакетов с побайтовым чередованием, последняя группа
+ * дополняется нулями до целой
+ * \param sim  Симулятор
+ * \param buf  Передаваемые данные
+ * \param length  Длина данных в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество пакетов или 0 при ошибке выделения памяти
+ */
+static size_t chaos_sim_interleave(chaos_sim_t* sim, uint8_t const* buf, size_t length, size_t stripe)
+{
+	size_t group, i, j, group_len = PACKET_SIZE * stripe;
+	size_t count = (length + group_len - 1) / group_len * stripe;
+	rtp_packet_t* p;
+
+	if (chaos_sim_reserve(sim, count))
+		return 0;
+	for (p = sim->packets, group = 0; group < length; group += group_len, p += stripe) {
+		for (j = 0; j < stripe; j++)
+			p[j].header.sequence_number = sim->sequence++;
+		if (length - group >= group_len) {
+			interleave_group(p, buf, stripe);
+			buf += group_len;
+		}
+		else {
+			for (j = 0; j < stripe; j++)
+				memset(p[j].payload, 0, PACKET_SIZE);
+			for (i = 0; group + i * stripe < length; i++)
+				for (j = 0; j < stripe && group + i * stripe + j < length; j++)
+					p[j].payload[i] = *buf++;
+		}
+	}
+	sim->count = count;
+	sim->length = length;
+	sim->stripe = stripe;
+	return count;
+}
+
+/**
+ * \brief Сборка данных из пакетов симулятора
+ * \param sim  Симулятор
+ * \param out_buf  Буфер для данных
+ * \param length  Количество собираемых байт
+ */
+static void chaos_sim_deinterleave(chaos_sim_t* sim, uint8_t* out_buf, size_t length)
+{
+	size_t group, i, j, stripe = sim->stripe, group_len = PACKET_SIZE * stripe;
+	rtp_packet_t* p;
+
+	for (p = sim->packets, group = 0; group < length; group += group_len, p += stripe) {
+		if (length - group >= group_len) {
+			deinterleave_group(out_buf, p, stripe);
+			out_buf += group_len;
+			continue;
+		}
+		for (i = 0; i < PACKET_SIZE && group + i * stripe < length; i++)
+			for (j = 0; j < stripe && group + i * stripe + j < length; j++)
+				*out_buf++ = p[j].payload[i];
+	}
+}
+
+/**
+ * \brief Описание пакетов кадра выборками из буфера
+ * \details Пакет j группы g состоит из байт buf[g * stripe * PACKET_SIZE + j + i * stripe], то есть чередование
+ * задается только смещением и шагом выборки, а сами данные не копируются
+ * \param sim  Симулятор
+ * \param buf  Кадр
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество пакетов или 0 при ошибке выделения памяти
+ */
+static size_t chaos_sim_views(chaos_sim_t* sim, uint8_t* buf, size_t length, size_t stripe)
+{
+	size_t group, j, rest, group_len = PACKET_SIZE * stripe;
+	size_t count = (length + group_len - 1) / group_len * stripe;
+	chaos_packet_view_t* v;
+
+	if (count > sim->view_capacity) {
+		v = (chaos_packet_view_t*)realloc(sim->views, count * sizeof(chaos_packet_view_t));
+		if (!v)
+			return 0;
+		sim->views = v;
+		sim->view_capacity = count;
+	}
+	for (v = sim->views, group = 0; group < length; group += group_len) {
+		rest = length - group;
+		for (j = 0; j < stripe; j++, v++) {
+			v->offset = group + j;
+			v->stride = (uint16_t)stripe;
+			if (rest >= group_len)
+				v->bytes = PACKET_SIZE;
+			else
+				v->bytes = (uint16_t)(j < rest ? (rest - j + stripe - 1) / stripe : 0);
+			v->sequence_number = sim->sequence++;
+		}
+	}
+	sim->buffer = buf;
+	sim->count = count;
+	sim->length = length;
+	sim->stripe = stripe;
+	return count;
+}
+
+CHAOS_EXPORT
+chaos_sim_t* chaos_sim_create(channel_model_t const* channel)
+{
+	chaos_sim_t* sim = (chaos_sim_t*)calloc(1, sizeof(chaos_sim_t));
+
+	if (sim && channel)
+		sim->channel = *channel;
+	return sim;
+}
+
+CHAOS_EXPORT
+void chaos_sim_destroy(chaos_sim_t* sim)
+{
+	if (sim) {
+		free(sim->packets);
+		free(sim->views);
+	}
+	free(sim);
+}
+
+CHAOS_EXPORT
+size_t chaos_sim_write(chaos_sim_t* sim, uint8_t const* buf, size_t length, size_t stripe)
+{
+	return chaos_sim_interleave(sim, buf, length, stripe);
+}
+
+CHAOS_EXPORT
+size_t chaos_sim_expect(chaos_sim_t* sim, size_t length, size_t stripe)
+{
+	size_t group_len = PACKET_SIZE * stripe, count = (length + group_len - 1) / group_len * stripe;
+
+	if (!count || chaos_sim_reserve(sim, count))
+		return 0;
+	memset(sim->packets, 0xff, count * sizeof(rtp_packet_t));
+	sim->count = count;
+	sim->length = length;
+	sim->stripe = stripe;
+	return count;
+}
+
+CHAOS_EXPORT
+int chaos_sim_errors(chaos_sim_t* sim)
+{
+	return channel_packet_errors(&sim->channel, sim->packets, (int)sim->count);
+}
+
+CHAOS_EXPORT
+size_t chaos_sim_read(chaos_sim_t* sim, uint8_t* out_buf)
+{
+	chaos_sim_deinterleave(sim, out_buf, sim->length);
+	return sim->length;
+}
+
+CHAOS_EXPORT
+int chaos_sim_transmit(chaos_sim_t* sim, uint8_t* buf, size_t length, size_t stripe)
+{
+	if (!chaos_sim_views(sim, buf, length, stripe))
+		return -1;
+	return chaos_sim_map_errors(sim);
+}
+
+CHAOS_EXPORT
+size_t chaos_sim_map(chaos_sim_t* sim, uint8_t* buf, size_t length, size_t stripe)
+{
+	return chaos_sim_views(sim, buf, length, stripe);
+}
+
+CHAOS_EXPORT
+int chaos_sim_map_errors(chaos_sim_t* sim)
+{
+	return channel_view_errors(&sim->channel, sim->buffer, sim->views, sim->count);
+}
+
+CHAOS_EXPORT
+void chaos_sim_gather(chaos_sim_t const* sim, size_t index, rtp_packet_t* packet)
+{
+	chaos_packet_view_t const* v = sim->views + index;
+	uint8_t const* src = sim->buffer + v->offset;
+	size_t i;
+
+	memset(&packet->header, 0, sizeof(rtp_header_t));
+	packet->header.sequence_number = v->sequence_number;
+	for (i = 0; i < v->bytes; i++)
+		packet->payload[i] = src[i * v->stride];
+	memset(packet->payload + v->bytes, 0, PACKET_SIZE - v->bytes);
+}
 
 /**
  * \brief Создание битовой маски для зашумления данных в реальном масштабе времени.
@@ -17,10 +313,22 @@ rtp_packet_t packets[MAX_PACKETS];
  * Используется на стороне передатчика.
  * \param params  ссылка на структуру с параметрами зашумления.
  */
-__declspec(dllexport)
+CHAOS_EXPORT
 void chaos_init()
 {
-	initialize_mersenne((uint32_t)time(NULL));
+	chaos_seed((uint32_t)time(NULL));
+}
+
+/**
+ * \brief Инициализация генераторов библиотеки заданным значением для воспроизводимых испытаний
+ * \details Задает генератор потерь create_packet_errors и transmit_with_interleave и генератор get_rand_float
+ * \param seed  Начальное значение генераторов
+ */
+CHAOS_EXPORT
+void chaos_seed(uint32_t seed)
+{
+	initialize_mersenne(seed);
+	xoshiro_seed(&chaos_rng, seed, 0);
 }
 
 /**
@@ -29,15 +337,18 @@ void chaos_init()
  * \param length - packets count
  * \return errors count
  */
-__declspec(dllexport)
+CHAOS_EXPORT
 int create_packet_errors(int length, float probability, int burst_length)
 {
 	int i, total_err = 0;
+	float draw[CHAOS_DRAWS];
 
 	if (burst_length == 1) {
 		for (i = 0; i < length; i++) {
-			if (probability > get_rand_float()) {
-				memset(&packets[i], 0xff, sizeof(rtp_packet_t));
+			if (!(i % CHAOS_DRAWS))
+				xoshiro_fill_float(&chaos_rng, draw, length - i < CHAOS_DRAWS ? length - i : CHAOS_DRAWS);
+			if (probability > draw[i % CHAOS_DRAWS]) {
+				memset(&chaos_default.packets[i], 0xff, sizeof(rtp_packet_t));
 				total_err += PACKET_SIZE;
 			}
 		}
@@ -48,48 +359,99 @@ int create_packet_errors(int length, float probability, int burst_length)
 		int burst_step = length / bursts;
 		for (i = 0; i < bursts; i++) {
 			int burst_start = (i + 1) * burst_step - (burst_step >> 1);
-			burst_start += (int)(burst_step * (get_rand_float() - .5f));
-			int burst_size = (int)(burst_length * (get_rand_float() + .5f));
+			burst_start += (int)(burst_step * (xoshiro_float(&chaos_rng) - .5f));
+			int burst_size = (int)(burst_length * (xoshiro_float(&chaos_rng) + .5f));
 			if (burst_start + burst_size > length)
 				burst_size = length - burst_start;
-			memset(&packets[burst_start], 0xff, sizeof(rtp_packet_t) * burst_size);
+			memset(&chaos_default.packets[burst_start], 0xff, sizeof(rtp_packet_t) * burst_size);
 			total_err += burst_size * PACKET_SIZE;
 		}
 	}
 	return total_err;
 }
 
-__declspec(dllexport)
+/**
+ * \brief Зашумление буфера потерями пакетов без промежуточного массива packets
+ * \details Равносильно write_packets_with_interleave, create_packet_errors с burst_length = 1
+ * и read_packets_with_deinterleave: буфер делится на группы по stripe пакетов с побайтовым
+ * чередованием, байты потерянного пакета заменяются на 0xff. Состояние генератора задается
+ * вызывающей стороной, поэтому функцию можно вызывать из нескольких потоков одновременно.
+ * \param rng  Состояние генератора случайных чисел
+ * \param buf  Зашумляемый буфер
+ * \param length  Длина буфера в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \param probability  Вероятность потери пакета
+ * \return errors count
+ */
+CHAOS_EXPORT
+int create_buffer_errors(mt19937_state_t* rng, uint8_t* buf, size_t length, size_t stripe, float probability)
+{
+	size_t group, j, k, group_len = PACKET_SIZE * stripe;
+	int total_err = 0;
+
+	for (group = 0; group < length; group += group_len)
+		for (j = 0; j < stripe; j++)
+			if (probability > mt19937_float(rng)) {
+				for (k = group + j; k < group + group_len && k < length; k += stripe)
+					buf[k] = 0xff;
+				total_err += PACKET_SIZE;
+			}
+	return total_err;
+}
+
+/**
+ * \brief Зашумление кадра потерями пакетов без копирования в пакеты
+ * \details Равносильно write_packets_with_interleave, create_packet_errors с burst_length = 1
+ * и read_packets_with_deinterleave с тем же генератором, но пакеты задаются выборками из buf
+ * (см. chaos_sim_map), поэтому копируются только байты потерянных пакетов, а длина кадра
+ * не округляется до целых групп
+ * \param buf  Зашумляемый кадр
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \param probability  Вероятность потери пакета
+ * \return errors count, -1 при ошибке выделения памяти
+ */
+CHAOS_EXPORT
+int transmit_with_interleave(uint8_t* buf, size_t length, size_t stripe, float probability)
+{
+	chaos_packet_view_t const* v;
+	size_t i, k, count;
+	int total_err = 0;
+	float draw[CHAOS_DRAWS];
+
+	chaos_default.sequence = 0;
+	if (!chaos_sim_views(&chaos_default, buf, length, stripe))
+		return -1;
+	for (count = chaos_default.count, v = chaos_default.views, i = 0; i < count; i++, v++) {
+		if (!(i % CHAOS_DRAWS))
+			xoshiro_fill_float(&chaos_rng, draw, count - i < CHAOS_DRAWS ? count - i : CHAOS_DRAWS);
+		if (probability > draw[i % CHAOS_DRAWS]) {
+			for (k = 0; k < v->bytes; k++)
+				buf[v->offset + k * v->stride] = 0xff;
+			total_err += v->bytes;
+		}
+	}
+	return total_err;
+}
+
+CHAOS_EXPORT
 size_t read_packets_with_deinterleave(uint8_t* out_buf, size_t count, size_t stripe) {
 	size_t processed = 0;
+
+	if (chaos_sim_reserve(&chaos_default, (count + stripe - 1) / stripe * stripe))
+		return 0;
 	while (1)
 	{
-		for (size_t i = 0; i < PACKET_SIZE; i++) {
-			for (size_t j = 0; j < stripe; j++) {
-				*out_buf++ = packets[processed + j].payload[i];
-			}
-		}
+		deinterleave_group(out_buf, chaos_default.packets + processed, stripe);
+		out_buf += PACKET_SIZE * stripe;
 		processed += stripe;
 		if (processed >= count)
 			return processed * PACKET_SIZE;
 	}
 }
 
-__declspec(dllexport)
+CHAOS_EXPORT
 size_t write_packets_with_interleave(uint8_t* inp_buf, size_t buf_length, size_t stripe) {
-	uint8_t* inp_end = inp_buf + buf_length;
-	size_t processed = 0;
-	for (size_t i = 0; i < MAX_PACKETS; i++)
-		packets[i].header.sequence_number = (uint16_t)i;
-	while (1)
-	{
-		for (size_t i = 0; i < PACKET_SIZE; i++) {
-			for (size_t j = 0; j < stripe; j++) {
-				packets[processed + j].payload[i] = *inp_buf++;
-				if (inp_buf == inp_end)
-					return processed + stripe;
-			}
-		}
-		processed += stripe;
-	}
+	chaos_default.sequence = 0;
+	return chaos_sim_interleave(&chaos_default, inp_buf, buf_length, stripe);
 }
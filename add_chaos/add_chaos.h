@@ -1,30 +1,214 @@
 ﻿#pragma once 
 #include <stdint.h>
+#include "mt19937.h"
+#include "channel.h"
+
+/**
+ * \brief Симулятор канала передачи кадров
+ * \details Владеет буфером пакетов (растет до размера наибольшего переданного кадра) и моделью канала
+ * с собственным генератором, поэтому несколько симуляторов можно использовать в разных потоках одновременно
+ */
+typedef struct {
+	rtp_packet_t* packets;	///< Пакеты текущего кадра
+	size_t capacity;		///< Емкость packets в пакетах
+	size_t count;			///< Количество пакетов текущего кадра (целые группы чередования)
+	size_t length;			///< Длина текущего кадра в байтах
+	size_t stripe;			///< Глубина чередования текущего кадра в пакетах
+	uint16_t sequence;		///< Номер следующего пакета (sequence_number заголовка RTP)
+	chaos_packet_view_t* views;	///< Пакеты текущего кадра как выборки из buffer (см. chaos_sim_map)
+	size_t view_capacity;	///< Емкость views в пакетах
+	uint8_t* buffer;		///< Кадр, на который ссылаются views
+	channel_model_t channel;	///< Модель канала
+} chaos_sim_t;
 
 #ifndef __cplusplus
-__declspec(dllimport)
+CHAOS_API
 #else
-extern "C" __declspec(dllimport) 
+extern "C" CHAOS_API 
 #endif
 void chaos_init();
 
 #ifndef __cplusplus
-__declspec(dllimport)
+CHAOS_API
 #else
-extern "C" __declspec(dllimport)
+extern "C" CHAOS_API
+#endif
+void chaos_seed(uint32_t seed);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
 #endif
 int create_packet_errors(int length, float probability, int burst_length);
 
 #ifndef __cplusplus
-__declspec(dllimport)
+CHAOS_API
 #else
-extern "C" __declspec(dllimport)
+extern "C" CHAOS_API
 #endif
 size_t read_packets_with_deinterleave(uint8_t* out_buf, size_t count, size_t stripe);
 
 #ifndef __cplusplus
-__declspec(dllimport)
+CHAOS_API
 #else
-extern "C" __declspec(dllimport)
+extern "C" CHAOS_API
 #endif
 size_t write_packets_with_interleave(uint8_t* inp_buf, size_t length, size_t stripe);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int create_buffer_errors(mt19937_state_t* rng, uint8_t* buf, size_t length, size_t stripe, float probability);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int transmit_with_interleave(uint8_t* buf, size_t length, size_t stripe, float probability);
+
+/**
+ * \brief Создание симулятора канала
+ * \param channel  Модель канала, копируется в симулятор; запись потерь (trace) не копируется
+ * и должна существовать, пока используется симулятор. NULL - канал без ошибок
+ * \return Симулятор или NULL при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+chaos_sim_t* chaos_sim_create(channel_model_t const* channel);
+
+/**
+ * \brief Уничтожение симулятора канала
+ * \param sim  Симулятор или NULL
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void chaos_sim_destroy(chaos_sim_t* sim);
+
+/**
+ * \brief Разбиение кадра на пакеты с побайтовым чередованием групп по stripe пакетов
+ * \param sim  Симулятор
+ * \param buf  Данные кадра
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество пакетов или 0 при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t chaos_sim_write(chaos_sim_t* sim, uint8_t const* buf, size_t length, size_t stripe);
+
+/**
+ * \brief Подготовка симулятора к приему кадра
+ * \details Пакеты кадра заполняются 0xff, как потерянные, и заменяются принятыми; chaos_sim_read затем
+ * собирает кадр так же, как после chaos_sim_write
+ * \param sim  Симулятор
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество пакетов кадра или 0 при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t chaos_sim_expect(chaos_sim_t* sim, size_t length, size_t stripe);
+
+/**
+ * \brief Передача пакетов кадра через модель канала симулятора
+ * \param sim  Симулятор
+ * \return Количество искаженных байт
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int chaos_sim_errors(chaos_sim_t* sim);
+
+/**
+ * \brief Сборка кадра из пакетов
+ * \param sim  Симулятор
+ * \param out_buf  Буфер для кадра (не меньше длины, переданной chaos_sim_write)
+ * \return Длина кадра в байтах
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t chaos_sim_read(chaos_sim_t* sim, uint8_t* out_buf);
+
+/**
+ * \brief Передача кадра через симулятор на месте
+ * \details Равносильно chaos_sim_write, chaos_sim_errors и chaos_sim_read, но выполняется через chaos_sim_map
+ * и chaos_sim_map_errors без копирования кадра в пакеты: время пропорционально количеству пакетов и ошибок.
+ * В отличие от chaos_sim_errors потерянный пакет считается за число его байт в кадре
+ * \param sim  Симулятор
+ * \param buf  Кадр, заменяется принятым
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество искаженных байт или -1 при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int chaos_sim_transmit(chaos_sim_t* sim, uint8_t* buf, size_t length, size_t stripe);
+
+/**
+ * \brief Разбиение кадра на пакеты без копирования
+ * \details Пакеты описываются выборками из buf (см. chaos_packet_view_t) с тем же чередованием,
+ * что и в chaos_sim_write. Буфер должен существовать, пока используются пакеты симулятора
+ * \param sim  Симулятор
+ * \param buf  Кадр
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество пакетов или 0 при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t chaos_sim_map(chaos_sim_t* sim, uint8_t* buf, size_t length, size_t stripe);
+
+/**
+ * \brief Передача пакетов, заданных chaos_sim_map, через модель канала симулятора
+ * \details Ошибки вносятся прямо в кадр: байты потерянного пакета заменяются на 0xff,
+ * в остальных инвертируются биты. Результат совпадает с channel_buffer_errors
+ * \param sim  Симулятор
+ * \return Количество искаженных байт
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int chaos_sim_map_errors(chaos_sim_t* sim);
+
+/**
+ * \brief Сборка пакета RTP, заданного chaos_sim_map, для отправки
+ * \details Байты пакета за концом кадра заполняются нулями
+ * \param sim  Симулятор
+ * \param index  Номер пакета
+ * \param packet  Пакет
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void chaos_sim_gather(chaos_sim_t const* sim, size_t index, rtp_packet_t* packet);
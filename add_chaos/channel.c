@@ -0,0 +1,239 @@
+﻿#include "stdlib.h"
+#include "stdio.h"
+#include <memory.h>
+#include <stdint.h>
+#include "math.h"
+#include "channel.h"
+
+CHAOS_EXPORT
+void channel_reset(channel_model_t* ch, uint32_t seed, uint32_t stream)
+{
+	ch->seed = seed;
+	ch->stream = stream;
+	xoshiro_seed(&ch->rng, seed, stream);
+	ch->current = 0;
+	ch->trace_pos = 0;
+}
+
+CHAOS_EXPORT
+void channel_init_iid(channel_model_t* ch, uint32_t seed, float loss, float ber)
+{
+	channel_state_t state = { loss, ber };
+	float stay = 1.0f;
+
+	(void)channel_init_markov(ch, seed, 1, &state, &stay);
+}
+
+CHAOS_EXPORT
+void channel_init_gilbert_elliott(channel_model_t* ch, uint32_t seed, float p_gb, float p_bg,
+	channel_state_t good, channel_state_t bad)
+{
+	channel_state_t state[2] = { good, bad };
+	float transition[4] = { 1.0f - p_gb, p_gb, p_bg, 1.0f - p_bg };
+
+	(void)channel_init_markov(ch, seed, 2, state, transition);
+}
+
+CHAOS_EXPORT
+int channel_init_markov(channel_model_t* ch, uint32_t seed, int states, channel_state_t const* state,
+	float const* transition)
+{
+	int i, j;
+	float sum;
+
+	memset(ch, 0, sizeof(channel_model_t));
+	if (states < 1 || states > CHANNEL_MAX_STATES)
+		return -1;
+	for (i = 0; i < states; i++) {
+		for (sum = 0, j = 0; j < states; j++)
+			sum += ch->transition[i][j] = transition[i * states + j];
+		if (fabsf(sum - 1.0f) > 1e-4f)
+			return -1;
+	}
+	memcpy(ch->state, state, states * sizeof(channel_state_t));
+	ch->states = states;
+	channel_reset(ch, seed, 0);
+	return 0;
+}
+
+CHAOS_EXPORT
+int channel_load_trace(channel_model_t* ch, wchar_t const* filename)
+{
+	FILE* in;
+	uint8_t* trace = NULL;
+	size_t len = 0, cap = 0;
+	int c, line_start = 1, comment = 0;
+
+#ifdef _WIN32
+	if (_wfopen_s(&in, filename, L"rt") || !in)
+		return -1;
+#else
+	char name[4096];
+
+	if (wcstombs(name, filename, sizeof(name)) >= sizeof(name) || !(in = fopen(name, "rt")))
+		return -1;
+#endif
+	while ((c = fgetc(in)) != EOF) {
+		if (line_start)
+			comment = c == '#';
+		line_start = c == '\n';
+		if (comment || (c != '0' && c != '1'))
+			continue;
+		if (len == cap) {
+			uint8_t* grown = (uint8_t*)realloc(trace, cap ? cap * 2 : 4096);
+			if (!grown) {
+				free(trace);
+				fclose(in);
+				return -3;
+			}
+			trace = grown;
+			cap = cap ? cap * 2 : 4096;
+		}
+		trace[len++] = (uint8_t)(c - '0');
+	}
+	fclose(in);
+	if (!len) {
+		free(trace);
+		return -2;
+	}
+	free(ch->trace);
+	ch->trace = trace;
+	ch->trace_len = len;
+	ch->trace_pos = 0;
+	return 0;
+}
+
+CHAOS_EXPORT
+void channel_free(channel_model_t* ch)
+{
+	free(ch->trace);
+	ch->trace = NULL;
+	ch->trace_len = 0;
+}
+
+/**
+ * \brief Переход модели канала к следующему пакету
+ * \param ch  Модель канала
+ * \param ber  Адрес переменной, в которую заносится вероятность ошибки бита пакета
+ * \return 1 - пакет потерян, 0 - принят
+ */
+static int channel_step(channel_model_t* ch, float* ber)
+{
+	channel_state_t const* s;
+	float const* row;
+	float u, acc;
+	int lost, next;
+
+	if (ch->trace) {		// воспроизведение записи
+		lost = ch->trace[ch->trace_pos];
+		if (++ch->trace_pos == ch->trace_len)
+			ch->trace_pos = 0;
+		*ber = 0;
+		return lost;
+	}
+	s = ch->state + ch->current;
+	lost = s->loss > xoshiro_float(&ch->rng);
+	*ber = s->ber;
+	if (ch->states > 1) {	// переход после пакета
+		row = ch->transition[ch->current];
+		u = xoshiro_float(&ch->rng);
+		for (next = 0, acc = row[0]; next < ch->states - 1 && u >= acc; acc += row[++next]);
+		ch->current = next;
+	}
+	return lost;
+}
+
+/**
+ * \brief Инвертирование битов пакета с заданной вероятностью
+ * \details Расстояние до следующего ошибочного бита выбирается по геометрическому распределению,
+ * поэтому число обращений к генератору пропорционально числу ошибок, а не длине пакета
+ * \param rng  Генератор
+ * \param data  Первый байт пакета
+ * \param stride  Расстояние между соседними байтами пакета в буфере
+ * \param bytes  Длина пакета в байтах
+ * \param ber  Вероятность ошибки бита
+ * \return Количество искаженных байт
+ */
+static int channel_flip_bits(xoshiro_state_t* rng, uint8_t* data, size_t stride, size_t bytes, float ber)
+{
+	double scale, skip;
+	size_t pos = 0, bits = bytes * 8, last = (size_t)-1;
+	int corrupted = 0;
+
+	if (ber <= 0)
+		return 0;
+	scale = ber < 1 ? 1.0 / log(1.0 - ber) : 0;
+	for (;;) {
+		skip = log((xoshiro_uint(rng) + 1.0) * 2.3283064365386963e-10) * scale;	// неискаженных бит до ошибки
+		if (skip >= (double)(bits - pos))
+			break;
+		pos += (size_t)skip;
+		data[(pos >> 3) * stride] ^= (uint8_t)(1 << (pos & 7));
+		if (pos >> 3 != last) {
+			last = pos >> 3;
+			corrupted++;
+		}
+		if (++pos == bits)
+			break;
+	}
+	return corrupted;
+}
+
+CHAOS_EXPORT
+int channel_packet_errors(channel_model_t* ch, rtp_packet_t* packets, int count)
+{
+	int i, total_err = 0;
+	float ber;
+
+	for (i = 0; i < count; i++) {
+		if (channel_step(ch, &ber)) {
+			memset(&packets[i], 0xff, sizeof(rtp_packet_t));
+			total_err += PACKET_SIZE;
+		}
+		else
+			total_err += channel_flip_bits(&ch->rng, packets[i].payload, 1, PACKET_SIZE, ber);
+	}
+	return total_err;
+}
+
+CHAOS_EXPORT
+int channel_view_errors(channel_model_t* ch, uint8_t* buf, chaos_packet_view_t const* views, size_t count)
+{
+	size_t i, k;
+	int total_err = 0;
+	float ber;
+
+	for (i = 0; i < count; i++, views++) {
+		if (channel_step(ch, &ber)) {
+			for (k = 0; k < views->bytes; k++)
+				buf[views->offset + k * views->stride] = 0xff;
+			total_err += views->bytes;
+		}
+		else if (views->bytes)
+			total_err += channel_flip_bits(&ch->rng, buf + views->offset, views->stride, views->bytes, ber);
+	}
+	return total_err;
+}
+
+CHAOS_EXPORT
+int channel_buffer_errors(channel_model_t* ch, uint8_t* buf, size_t length, size_t stripe)
+{
+	size_t group, group_end, j, k, bytes, group_len = PACKET_SIZE * stripe;
+	int total_err = 0;
+	float ber;
+
+	for (group = 0; group < length; group += group_len) {
+		group_end = group + group_len < length ? group + group_len : length;
+		for (j = 0; j < stripe; j++) {
+			bytes = group + j < group_end ? (group_end - group - j + stripe - 1) / stripe : 0;
+			if (channel_step(ch, &ber)) {
+				for (k = group + j; k < group_end; k += stripe)
+					buf[k] = 0xff;
+				total_err += (int)bytes;
+			}
+			else if (bytes)
+				total_err += channel_flip_bits(&ch->rng, buf + group + j, stripe, bytes, ber);
+		}
+	}
+	return total_err;
+}
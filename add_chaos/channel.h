@@ -0,0 +1,177 @@
+﻿#pragma once
+#include <stdint.h>
+#include <wchar.h>
+#include "chaos_params.h"
+#include "xoshiro128.h"
+
+#define CHANNEL_MAX_STATES 4	// состояний у марковской модели канала
+
+/**
+ * \brief Состояние модели канала
+ */
+typedef struct {
+	float loss;		///< Вероятность потери пакета (пакет заполняется 0xff)
+	float ber;		///< Вероятность ошибки бита в непотерянном пакете
+} channel_state_t;
+
+/**
+ * \brief Модель канала передачи пакетов
+ * \details Марковская цепь: перед каждым пакетом канал находится в одном из states состояний,
+ * после пакета переходит в состояние j с вероятностью transition[i][j]. Одно состояние - канал
+ * без памяти, два - модель Гилберта-Эллиотта. Если задан trace, потери пакетов воспроизводятся
+ * по записи (циклически), а цепь не используется. Генератор случайных чисел принадлежит модели,
+ * поэтому при одинаковых seed и stream последовательность ошибок повторяется.
+ */
+typedef struct {
+	int states;		///< Количество состояний
+	int current;	///< Текущее состояние
+	channel_state_t state[CHANNEL_MAX_STATES];
+	float transition[CHANNEL_MAX_STATES][CHANNEL_MAX_STATES];	///< Вероятности переходов, сумма строки - 1
+	uint8_t* trace;		///< Запись потерь: 0 - пакет принят, 1 - потерян, или NULL
+	size_t trace_len;	///< Количество пакетов в записи
+	size_t trace_pos;	///< Позиция воспроизведения записи
+	uint32_t seed;		///< Начальное значение генератора (см. channel_reset)
+	uint32_t stream;	///< Номер подпоследовательности генератора (см. channel_reset)
+	xoshiro_state_t rng;
+} channel_model_t;
+
+/**
+ * \brief Канал без памяти: независимые потери пакетов и ошибки битов
+ * \param ch  Модель канала
+ * \param seed  Начальное значение генератора
+ * \param loss  Вероятность потери пакета
+ * \param ber  Вероятность ошибки бита в непотерянном пакете
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void channel_init_iid(channel_model_t* ch, uint32_t seed, float loss, float ber);
+
+/**
+ * \brief Модель Гилберта-Эллиотта с хорошим и плохим состояниями
+ * \param ch  Модель канала
+ * \param seed  Начальное значение генератора
+ * \param p_gb  Вероятность перехода из хорошего состояния в плохое после пакета
+ * \param p_bg  Вероятность перехода из плохого состояния в хорошее после пакета
+ * \param good  Потери и ошибки в хорошем состоянии
+ * \param bad  Потери и ошибки в плохом состоянии
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void channel_init_gilbert_elliott(channel_model_t* ch, uint32_t seed, float p_gb, float p_bg,
+	channel_state_t good, channel_state_t bad);
+
+/**
+ * \brief Марковская модель канала с заданной матрицей переходов
+ * \param ch  Модель канала
+ * \param seed  Начальное значение генератора
+ * \param states  Количество состояний (1 - CHANNEL_MAX_STATES)
+ * \param state  Потери и ошибки в каждом состоянии
+ * \param transition  Матрица переходов states x states по строкам
+ * \return 0 - все нормально, -1 - недопустимое количество состояний или строка матрицы не дает в сумме 1
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int channel_init_markov(channel_model_t* ch, uint32_t seed, int states, channel_state_t const* state,
+	float const* transition);
+
+/**
+ * \brief Загрузка записи потерь пакетов для воспроизведения
+ * \details Файл содержит символы '0' (пакет принят) и '1' (пакет потерян), остальные символы
+ * пропускаются, строки, начинающиеся с '#', - комментарии
+ * \param ch  Модель канала
+ * \param filename  Имя файла записи
+ * \return 0 - все нормально, -1 - файл не открывается, -2 - в файле нет пакетов, -3 - ошибка выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int channel_load_trace(channel_model_t* ch, wchar_t const* filename);
+
+/**
+ * \brief Возврат модели в начальное состояние
+ * \details Генератор инициализируется заново, канал переходит в состояние 0, запись воспроизводится с начала.
+ * Подпоследовательности одного seed не пересекаются (см. xoshiro_seed), поэтому модели, работающие
+ * одновременно, лучше различать номером stream, а не seed. Функции channel_init_* выбирают stream 0
+ * \param ch  Модель канала
+ * \param seed  Начальное значение генератора
+ * \param stream  Номер подпоследовательности генератора
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void channel_reset(channel_model_t* ch, uint32_t seed, uint32_t stream);
+
+/**
+ * \brief Освобождение записи потерь модели
+ * \param ch  Модель канала
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void channel_free(channel_model_t* ch);
+
+/**
+ * \brief Передача массива пакетов через канал
+ * \details Потерянные пакеты заполняются 0xff, как в create_packet_errors, в остальных инвертируются биты полезной нагрузки
+ * \param ch  Модель канала
+ * \param packets  Пакеты
+ * \param count  Количество пакетов
+ * \return Количество искаженных байт
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int channel_packet_errors(channel_model_t* ch, rtp_packet_t* packets, int count);
+
+/**
+ * \brief Передача буфера через канал без промежуточного массива пакетов
+ * \details Буфер делится на пакеты так же, как в create_buffer_errors (группы по stripe пакетов с побайтовым
+ * чередованием). При модели без памяти без ошибок битов потери распределены так же, как в create_buffer_errors.
+ * Потерянный пакет считается за число его байт в буфере, а не за PACKET_SIZE, поэтому для коротких кадров
+ * доля искаженных байт не завышается.
+ * \param ch  Модель канала
+ * \param buf  Зашумляемый буфер
+ * \param length  Длина буфера в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество искаженных байт
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int channel_buffer_errors(channel_model_t* ch, uint8_t* buf, size_t length, size_t stripe);
+
+/**
+ * \brief Передача через канал пакетов, заданных выборками из буфера
+ * \details Ошибки вносятся прямо в буфер, потерянный пакет считается за views->bytes искаженных байт,
+ * пакеты-заполнители последней группы (bytes = 0) в счет не входят
+ * \param ch  Модель канала
+ * \param buf  Буфер, из которого выбраны пакеты
+ * \param views  Пакеты
+ * \param count  Количество пакетов
+ * \return Количество искаженных байт
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int channel_view_errors(channel_model_t* ch, uint8_t* buf, chaos_packet_view_t const* views, size_t count);
@@ -1,5 +1,14 @@
 ﻿#pragma once 
 #include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#define CHAOS_API __declspec(dllimport)		// объявление функции библиотеки add_chaos
+#define CHAOS_EXPORT __declspec(dllexport)	// определение функции библиотеки add_chaos
+#else
+#define CHAOS_API
+#define CHAOS_EXPORT
+#endif
 
 #define PACKET_SIZE 256
 #define MAX_BUFFER_SIZE (1ULL << 24) // 16Mb
@@ -17,3 +26,12 @@ typedef struct {
 	rtp_header_t header;
 	uint8_t payload[PACKET_SIZE];
 } rtp_packet_t;
+
+// Packet as a view of the frame buffer, without a copy of the payload:
+// packet byte i is buf[offset + i * stride], the interleave is the choice of offset and stride
+typedef struct {
+	size_t offset;
+	uint16_t stride;
+	uint16_t bytes;		// frame bytes in the packet, less than PACKET_SIZE in the last group
+	uint16_t sequence_number;
+} chaos_packet_view_t;
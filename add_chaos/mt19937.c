@@ -39,10 +39,35 @@
 
 #include "mt19937.h"
 
+mt19937_state_t mt19937_state;
+
 void initialize_mersenne(unsigned long seed)
+{
+    mt19937_seed(&mt19937_state, seed);
+}
+
+unsigned long get_rand_uint()
+{
+    return mt19937_uint(&mt19937_state);
+}
+
+CHAOS_EXPORT
+float get_rand_float()
+{
+    return mt19937_uint(&mt19937_state) * 2.3283064e-10f;
+}
+
+double get_rand_double()
+{
+    return mt19937_uint(&mt19937_state) * 2.3283064370807974e-10;
+}
+
+/* Generators with caller-owned state: one state per thread or per  */
+/* simulated channel gives independent, reproducible streams.       */
+CHAOS_EXPORT
+void mt19937_seed(mt19937_state_t* m, unsigned long seed)
 {
     int i;
-    mt19937_state_t* m = &mt19937_state;
     for (i = 0; i < __N__; i++)
     {
         m->mt[i] = seed & 0xffff0000;
@@ -53,11 +78,10 @@ void initialize_mersenne(unsigned long seed)
     m->mti = __N__;
 }
 
-unsigned long get_rand_uint()
+unsigned long mt19937_uint(mt19937_state_t* m)
 {
     unsigned long y;
     unsigned long mag01[2] =  {0, MATRIX_A };
-    mt19937_state_t* m = &mt19937_state;
 
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
@@ -91,17 +115,10 @@ unsigned long get_rand_uint()
     return y;
 }
 
-__declspec(dllexport)
-float get_rand_float()
-{
-    mt19937_state_t* m = &mt19937_state;
-    return get_rand_uint(m) * 2.3283064e-10f;
-}
-
-double get_rand_double()
+CHAOS_EXPORT
+float mt19937_float(mt19937_state_t* m)
 {
-    mt19937_state_t* m = &mt19937_state;
-    return get_rand_uint(m) * 2.3283064370807974e-10;
+    return mt19937_uint(m) * 2.3283064e-10f;
 }
 
 #endif
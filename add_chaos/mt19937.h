@@ -38,6 +38,8 @@
 #ifndef MT_19937_H
 #define MT_19937_H
 
+#include "chaos_params.h"
+
 /* Period parameters */
 #define __N__ 624
 #define __M__ 397
@@ -59,19 +61,35 @@ typedef struct mt19937_stateStruct
 	int mti;
 } mt19937_state_t;
 
-mt19937_state_t mt19937_state;
+extern mt19937_state_t mt19937_state;	/* state of the global generator */
 
 void initialize_mersenne(unsigned long seed);
 
 unsigned long get_rand_uint();
 
 #ifndef __cplusplus
-__declspec(dllimport)
+CHAOS_API
 #else
-extern "C" __declspec(dllimport)
+extern "C" CHAOS_API
 #endif
 float get_rand_float();
 
 double get_rand_double();
 
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void mt19937_seed(mt19937_state_t* m, unsigned long seed);
+
+unsigned long mt19937_uint(mt19937_state_t* m);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+float mt19937_float(mt19937_state_t* m);
+
 #endif
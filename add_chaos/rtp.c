@@ -0,0 +1,304 @@
+﻿#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		// sendmmsg, recvmmsg
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include "stdlib.h"
+#include <memory.h>
+#include <stdint.h>
+#include "rtp.h"
+
+#ifdef _WIN32
+#define rtp_poll WSAPoll
+#define rtp_close closesocket
+typedef int socklen_t;
+#else
+#define rtp_poll poll
+#define rtp_close close
+#endif
+
+#define RTP_MAX_FRAME_PACKETS 65536	// номер пакета в кадре должен помещаться в 16 бит
+
+CHAOS_EXPORT
+rtp_stream_t* rtp_stream_create(uint32_t ssrc, uint16_t sequence, uint8_t payload_type)
+{
+	rtp_stream_t* stream = (rtp_stream_t*)calloc(1, sizeof(rtp_stream_t));
+
+	if (!stream)
+		return NULL;
+	stream->sim = chaos_sim_create(NULL);
+	if (!stream->sim) {
+		free(stream);
+		return NULL;
+	}
+	stream->ssrc = ssrc;
+	stream->sequence = sequence;
+	stream->payload_type = payload_type & 0x7f;
+	return stream;
+}
+
+CHAOS_EXPORT
+void rtp_stream_destroy(rtp_stream_t* stream)
+{
+	if (!stream)
+		return;
+	chaos_sim_destroy(stream->sim);
+	free(stream->erasures);
+	free(stream);
+}
+
+CHAOS_EXPORT
+size_t rtp_packetize(rtp_stream_t* stream, uint8_t const* buf, size_t length, size_t stripe, uint32_t timestamp)
+{
+	rtp_header_t* h;
+	size_t i, count;
+
+	stream->sim->sequence = stream->sequence;
+	count = chaos_sim_write(stream->sim, buf, length, stripe);
+	for (i = 0; i < count; i++) {
+		h = &stream->sim->packets[i].header;
+		h->bit_fields1 = RTP_VERSION << 6;		// без дополнения, расширения и CSRC
+		h->bit_fields2 = (i == count - 1 ? 0x80 : 0) | stream->payload_type;
+		h->sequence_number = htons(h->sequence_number);
+		h->timestamp = htonl(timestamp);
+		h->ssrc = htonl(stream->ssrc);
+	}
+	stream->sequence += (uint16_t)count;
+	return count;
+}
+
+CHAOS_EXPORT
+size_t rtp_frame_begin(rtp_stream_t* stream, size_t length, size_t stripe)
+{
+	size_t count = chaos_sim_expect(stream->sim, length, stripe);
+	uint8_t* grown;
+
+	if (count > RTP_MAX_FRAME_PACKETS)
+		return 0;
+	if (count > stream->erasure_capacity) {
+		grown = (uint8_t*)realloc(stream->erasures, count);
+		if (!grown)
+			return 0;
+		stream->erasures = grown;
+		stream->erasure_capacity = count;
+	}
+	memset(stream->erasures, 1, count);
+	stream->received = stream->duplicates = stream->reordered = stream->rejected = stream->next = 0;
+	return count;
+}
+
+CHAOS_EXPORT
+size_t rtp_depacketize(rtp_stream_t* stream, rtp_packet_t const* packets, size_t count)
+{
+	rtp_packet_t* slot;
+	size_t i, index, placed = 0;
+
+	for (i = 0; i < count; i++, packets++) {
+		if (packets->header.bit_fields1 >> 6 != RTP_VERSION || ntohl(packets->header.ssrc) != stream->ssrc
+			|| (packets->header.bit_fields2 & 0x7f) != stream->payload_type) {
+			stream->rejected++;
+			continue;
+		}
+		index = (uint16_t)(ntohs(packets->header.sequence_number) - stream->sequence);	// по модулю 2^16
+		if (index >= stream->sim->count) {
+			stream->rejected++;
+			continue;
+		}
+		if (!stream->erasures[index]) {
+			stream->duplicates++;
+			continue;
+		}
+		if (index < stream->next)
+			stream->reordered++;
+		else
+			stream->next = index + 1;
+		slot = stream->sim->packets + index;
+		memcpy(slot->payload, packets->payload, PACKET_SIZE);
+		slot->header.sequence_number = (uint16_t)(stream->sequence + index);
+		stream->erasures[index] = 0;
+		stream->received++;
+		placed++;
+	}
+	return placed;
+}
+
+CHAOS_EXPORT
+size_t rtp_frame_end(rtp_stream_t* stream, uint8_t* out_buf)
+{
+	size_t count = stream->sim->count;
+
+	chaos_sim_read(stream->sim, out_buf);
+	stream->sequence += (uint16_t)count;
+	return count - stream->received;
+}
+
+CHAOS_EXPORT
+int rtp_socket_pair(rtp_socket_t* tx, rtp_socket_t* rx)
+{
+	rtp_socket_t s[2] = { RTP_INVALID_SOCKET, RTP_INVALID_SOCKET };
+	struct sockaddr_in addr[2];
+	socklen_t len;
+	int i, size = RTP_SOCKET_BUFFER, failed = 0;
+#ifdef _WIN32
+	WSADATA wsa;
+#endif
+
+	for (i = 0; i < 2 && !failed; i++) {
+#ifdef _WIN32
+		if (WSAStartup(MAKEWORD(2, 2), &wsa)) {		// по одному на сокет, см. rtp_socket_close
+			failed = -1;
+			break;
+		}
+#endif
+		s[i] = (rtp_socket_t)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (s[i] == RTP_INVALID_SOCKET) {
+#ifdef _WIN32
+			WSACleanup();
+#endif
+			failed = -2;
+			break;
+		}
+		memset(addr + i, 0, sizeof(struct sockaddr_in));
+		addr[i].sin_family = AF_INET;
+		addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		len = sizeof(struct sockaddr_in);
+		// Буферы меньше запрошенного не ошибка: потери из-за переполнения видны по номерам пакетов
+		setsockopt(s[i], SOL_SOCKET, SO_RCVBUF, (char const*)&size, sizeof(size));
+		setsockopt(s[i], SOL_SOCKET, SO_SNDBUF, (char const*)&size, sizeof(size));
+		if (bind(s[i], (struct sockaddr*)(addr + i), sizeof(struct sockaddr_in))
+			|| getsockname(s[i], (struct sockaddr*)(addr + i), &len))
+			failed = -2;
+	}
+	if (!failed && (connect(s[0], (struct sockaddr*)(addr + 1), sizeof(struct sockaddr_in))
+		|| connect(s[1], (struct sockaddr*)addr, sizeof(struct sockaddr_in))))
+		failed = -2;
+	if (failed) {
+		for (i = 0; i < 2; i++)
+			if (s[i] != RTP_INVALID_SOCKET)
+				rtp_socket_close(s[i]);
+		return failed;
+	}
+	*tx = s[0];
+	*rx = s[1];
+	return 0;
+}
+
+CHAOS_EXPORT
+void rtp_socket_close(rtp_socket_t sock)
+{
+	rtp_close(sock);
+#ifdef _WIN32
+	WSACleanup();		// парный WSAStartup этого сокета в rtp_socket_pair
+#endif
+}
+
+CHAOS_EXPORT
+int rtp_send(rtp_socket_t sock, rtp_packet_t const* packets, size_t count)
+{
+	size_t sent = 0;
+#ifdef _WIN32
+	for (; sent < count; sent++)
+		if (send(sock, (char const*)(packets + sent), sizeof(rtp_packet_t), 0) == SOCKET_ERROR)
+			return -1;
+#else
+	struct mmsghdr msgs[RTP_BATCH];
+	struct iovec iov[RTP_BATCH];
+	size_t i, n;
+	int r;
+
+	while (sent < count) {
+		n = count - sent < RTP_BATCH ? count - sent : RTP_BATCH;
+		memset(msgs, 0, n * sizeof(struct mmsghdr));
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = (void*)(packets + sent + i);
+			iov[i].iov_len = sizeof(rtp_packet_t);
+			msgs[i].msg_hdr.msg_iov = iov + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		r = sendmmsg((int)sock, msgs, (unsigned int)n, 0);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		sent += r;
+	}
+#endif
+	return (int)sent;
+}
+
+CHAOS_EXPORT
+int rtp_recv(rtp_socket_t sock, rtp_packet_t* packets, size_t capacity, int timeout_ms)
+{
+	struct pollfd fd;
+	size_t received = 0;
+	int r;
+#ifdef _WIN32
+	fd.fd = sock;
+	fd.events = POLLRDNORM;
+	while (received < capacity) {
+		r = rtp_poll(&fd, 1, received ? 0 : timeout_ms);
+		if (r <= 0)
+			return r < 0 ? -1 : (int)received;
+		r = recv(sock, (char*)(packets + received), sizeof(rtp_packet_t), 0);
+		if (r == SOCKET_ERROR) {
+			if (WSAGetLastError() == WSAEMSGSIZE) {		// длиннее пакета - отбрасываем
+				packets[received].header.bit_fields1 = 0;
+				received++;
+				continue;
+			}
+			return -1;
+		}
+		if (r != sizeof(rtp_packet_t))
+			packets[received].header.bit_fields1 = 0;
+		received++;
+	}
+#else
+	struct mmsghdr msgs[RTP_BATCH];
+	struct iovec iov[RTP_BATCH];
+	size_t i, n;
+
+	fd.fd = (int)sock;
+	fd.events = POLLIN;
+	do
+		r = rtp_poll(&fd, 1, timeout_ms);
+	while (r < 0 && errno == EINTR);
+	if (r <= 0)
+		return r < 0 ? -1 : 0;
+	while (received < capacity) {
+		n = capacity - received < RTP_BATCH ? capacity - received : RTP_BATCH;
+		memset(msgs, 0, n * sizeof(struct mmsghdr));
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = packets + received + i;
+			iov[i].iov_len = sizeof(rtp_packet_t);
+			msgs[i].msg_hdr.msg_iov = iov + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		r = recvmmsg((int)sock, msgs, (unsigned int)n, MSG_DONTWAIT, NULL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		for (i = 0; i < (size_t)r; i++)
+			if (msgs[i].msg_len != sizeof(rtp_packet_t) || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+				packets[received + i].header.bit_fields1 = 0;
+		received += r;
+		if ((size_t)r < n)
+			break;
+	}
+#endif
+	return (int)received;
+}
@@ -0,0 +1,178 @@
+﻿#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "add_chaos.h"
+
+#define RTP_VERSION 2
+#define RTP_PAYLOAD_TYPE 96		// динамический тип нагрузки (RFC 3551)
+#define RTP_BATCH 64			// пакетов за один вызов sendmmsg/recvmmsg
+#define RTP_SOCKET_BUFFER (1 << 22)	// запрашиваемый размер буферов сокета, байт
+
+typedef uintptr_t rtp_socket_t;	// SOCKET в Windows, дескриптор в Linux
+#define RTP_INVALID_SOCKET ((rtp_socket_t)-1)
+
+/**
+ * \brief Поток RTP одного источника (SSRC) на стороне передатчика или приемника
+ * \details Кадр JPWL передается пакетами chaos_sim_write: группы по stripe пакетов с побайтовым чередованием.
+ * Номера пакетов идут подряд через все кадры, поэтому приемник по номеру находит место пакета в кадре,
+ * а пропуски номеров дают карту стираний. Длина кадра и глубина чередования передаются вне потока,
+ * как длина буфера декодеру JPWL
+ */
+typedef struct {
+	chaos_sim_t* sim;		///< Пакеты текущего кадра
+	uint8_t* erasures;		///< Карта стираний кадра приемника: 1 - пакет не принят
+	size_t erasure_capacity;	///< Емкость erasures в пакетах
+	uint32_t ssrc;			///< Идентификатор источника
+	uint16_t sequence;		///< Номер первого пакета следующего кадра (у приемника - принимаемого)
+	uint8_t payload_type;	///< Тип нагрузки
+	size_t received;		///< Принято пакетов текущего кадра
+	size_t duplicates;		///< Отброшено повторных пакетов
+	size_t reordered;		///< Принято пакетов позже пакетов с большими номерами
+	size_t rejected;		///< Отброшено пакетов чужого источника, другой версии или вне кадра
+	size_t next;			///< Номер в кадре, следующий за наибольшим принятым
+} rtp_stream_t;
+
+/**
+ * \brief Создание потока RTP
+ * \param ssrc  Идентификатор источника
+ * \param sequence  Номер первого пакета (у приемника - согласованный с передатчиком)
+ * \param payload_type  Тип нагрузки
+ * \return Поток или NULL при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+rtp_stream_t* rtp_stream_create(uint32_t ssrc, uint16_t sequence, uint8_t payload_type);
+
+/**
+ * \brief Уничтожение потока RTP
+ * \param stream  Поток или NULL
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void rtp_stream_destroy(rtp_stream_t* stream);
+
+/**
+ * \brief Разбиение кадра на пакеты RTP
+ * \details Заголовки заполняются по RFC 3550 в сетевом порядке байт, у последнего пакета кадра установлен маркер.
+ * Пакеты находятся в stream->sim->packets до следующего вызова
+ * \param stream  Поток передатчика
+ * \param buf  Кадр
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \param timestamp  Метка времени кадра
+ * \return Количество пакетов или 0 при ошибке выделения памяти
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t rtp_packetize(rtp_stream_t* stream, uint8_t const* buf, size_t length, size_t stripe, uint32_t timestamp);
+
+/**
+ * \brief Начало приема кадра
+ * \param stream  Поток приемника
+ * \param length  Длина кадра в байтах
+ * \param stripe  Глубина чередования в пакетах
+ * \return Количество пакетов кадра, 0 - ошибка выделения памяти или кадр длиннее 65536 пакетов
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t rtp_frame_begin(rtp_stream_t* stream, size_t length, size_t stripe);
+
+/**
+ * \brief Размещение принятых пакетов в кадре
+ * \details Пакеты могут приходить в любом порядке: место пакета определяется разностью его номера и номера
+ * первого пакета кадра. Пакеты другой версии, другого источника или типа и пакеты вне кадра отбрасываются
+ * \param stream  Поток приемника
+ * \param packets  Принятые пакеты
+ * \param count  Количество пакетов
+ * \return Количество размещенных пакетов
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t rtp_depacketize(rtp_stream_t* stream, rtp_packet_t const* packets, size_t count);
+
+/**
+ * \brief Завершение приема кадра
+ * \details Байты непринятых пакетов заменяются на 0xff, как в create_packet_errors. Карта стираний
+ * остается в stream->erasures до следующего rtp_frame_begin, поток переходит к следующему кадру
+ * \param stream  Поток приемника
+ * \param out_buf  Буфер для кадра
+ * \return Количество непринятых пакетов
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+size_t rtp_frame_end(rtp_stream_t* stream, uint8_t* out_buf);
+
+/**
+ * \brief Создание пары соединенных друг с другом сокетов UDP на петлевом интерфейсе
+ * \param tx  Адрес переменной для сокета передатчика
+ * \param rx  Адрес переменной для сокета приемника
+ * \return 0 - все нормально, -1 - ошибка инициализации сокетов, -2 - ошибка создания или соединения сокетов
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int rtp_socket_pair(rtp_socket_t* tx, rtp_socket_t* rx);
+
+/**
+ * \brief Закрытие сокета
+ * \param sock  Сокет
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void rtp_socket_close(rtp_socket_t sock);
+
+/**
+ * \brief Отправка пакетов через соединенный сокет
+ * \details В Linux пакеты отправляются пачками по RTP_BATCH вызовом sendmmsg, в Windows - по одному
+ * \param sock  Сокет
+ * \param packets  Пакеты
+ * \param count  Количество пакетов
+ * \return Количество отправленных пакетов или -1 при ошибке сокета
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int rtp_send(rtp_socket_t sock, rtp_packet_t const* packets, size_t count);
+
+/**
+ * \brief Прием пакетов
+ * \details Ожидает первый пакет не дольше timeout_ms, затем забирает без ожидания все пакеты, уже
+ * находящиеся в буфере сокета (в Linux - пачками по RTP_BATCH вызовом recvmmsg). Датаграммы другой длины
+ * помечаются нулевой версией и отбрасываются rtp_depacketize
+ * \param sock  Сокет
+ * \param packets  Буфер для пакетов
+ * \param capacity  Емкость буфера в пакетах
+ * \param timeout_ms  Время ожидания первого пакета, мс
+ * \return Количество принятых пакетов или -1 при ошибке сокета
+ */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+int rtp_recv(rtp_socket_t sock, rtp_packet_t* packets, size_t capacity, int timeout_ms);
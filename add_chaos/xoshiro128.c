@@ -0,0 +1,155 @@
+#include <emmintrin.h>
+#include "xoshiro128.h"
+
+#define XOSHIRO_FLOAT_SCALE (1.0f / 16777216)	/* 2^-24 */
+
+static uint32_t const xoshiro_jump_poly[4] = { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+static uint32_t const xoshiro_long_jump_poly[4] = { 0xb523952e, 0x0b6f099f, 0xccf5a0ef, 0x1c580662 };
+
+static uint64_t splitmix64(uint64_t* x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static void lane_next(xoshiro_state_t* x, int l)
+{
+	uint32_t t = x->s[1][l] << 9;
+
+	x->s[2][l] ^= x->s[0][l];
+	x->s[3][l] ^= x->s[1][l];
+	x->s[1][l] ^= x->s[2][l];
+	x->s[0][l] ^= x->s[3][l];
+	x->s[2][l] ^= t;
+	x->s[3][l] = (x->s[3][l] << 11) | (x->s[3][l] >> 21);
+}
+
+/* Advances lane l by the number of steps that poly encodes */
+static void lane_jump(xoshiro_state_t* x, int l, uint32_t const* poly)
+{
+	uint32_t acc[4] = { 0, 0, 0, 0 };
+	int i, b, k;
+
+	for (i = 0; i < 4; i++)
+		for (b = 0; b < 32; b++) {
+			if (poly[i] & (1u << b))
+				for (k = 0; k < 4; k++)
+					acc[k] ^= x->s[k][l];
+			lane_next(x, l);
+		}
+	for (k = 0; k < 4; k++)
+		x->s[k][l] = acc[k];
+}
+
+/* One step of all lanes, returns their outputs */
+static __m128i xoshiro_step(__m128i* s)
+{
+	__m128i sum = _mm_add_epi32(s[0], s[3]);
+	__m128i result = _mm_add_epi32(_mm_or_si128(_mm_slli_epi32(sum, 7), _mm_srli_epi32(sum, 25)), s[0]);
+	__m128i t = _mm_slli_epi32(s[1], 9);
+
+	s[2] = _mm_xor_si128(s[2], s[0]);
+	s[3] = _mm_xor_si128(s[3], s[1]);
+	s[1] = _mm_xor_si128(s[1], s[2]);
+	s[0] = _mm_xor_si128(s[0], s[3]);
+	s[2] = _mm_xor_si128(s[2], t);
+	s[3] = _mm_or_si128(_mm_slli_epi32(s[3], 11), _mm_srli_epi32(s[3], 21));
+	return result;
+}
+
+CHAOS_EXPORT
+void xoshiro_seed(xoshiro_state_t* x, uint64_t seed, uint32_t stream)
+{
+	uint64_t a = splitmix64(&seed), b = splitmix64(&seed);
+	int k, l;
+
+	x->s[0][0] = (uint32_t)a;
+	x->s[1][0] = (uint32_t)(a >> 32);
+	x->s[2][0] = (uint32_t)b;
+	x->s[3][0] = (uint32_t)(b >> 32) | 1;	/* never the all-zero state */
+	for (l = 1; l < XOSHIRO_LANES; l++) {
+		for (k = 0; k < 4; k++)
+			x->s[k][l] = x->s[k][l - 1];
+		lane_jump(x, l, xoshiro_jump_poly);
+	}
+	while (stream--)
+		xoshiro_long_jump(x);
+	x->pos = XOSHIRO_BUFFER;
+}
+
+CHAOS_EXPORT
+void xoshiro_long_jump(xoshiro_state_t* x)
+{
+	int l;
+
+	for (l = 0; l < XOSHIRO_LANES; l++)
+		lane_jump(x, l, xoshiro_long_jump_poly);
+	x->pos = XOSHIRO_BUFFER;
+}
+
+CHAOS_EXPORT
+void xoshiro_fill_uint(xoshiro_state_t* x, uint32_t* out, size_t count)
+{
+	__m128i s[4];
+	int k;
+
+	for (; count && x->pos < XOSHIRO_BUFFER; count--)
+		*out++ = x->out[x->pos++];
+	if (!count)
+		return;
+	for (k = 0; k < 4; k++)
+		s[k] = _mm_loadu_si128((__m128i const*)x->s[k]);
+	for (; count >= XOSHIRO_LANES; count -= XOSHIRO_LANES, out += XOSHIRO_LANES)
+		_mm_storeu_si128((__m128i*)out, xoshiro_step(s));
+	if (count) {		/* the rest comes from a refilled buffer */
+		for (k = 0; k < XOSHIRO_BUFFER; k += XOSHIRO_LANES)
+			_mm_storeu_si128((__m128i*)(x->out + k), xoshiro_step(s));
+		for (x->pos = 0; count; count--)
+			*out++ = x->out[x->pos++];
+	}
+	for (k = 0; k < 4; k++)
+		_mm_storeu_si128((__m128i*)x->s[k], s[k]);
+}
+
+CHAOS_EXPORT
+void xoshiro_fill_float(xoshiro_state_t* x, float* out, size_t count)
+{
+	__m128 const scale = _mm_set1_ps(XOSHIRO_FLOAT_SCALE);
+	__m128i s[4];
+	int k;
+
+	for (; count && x->pos < XOSHIRO_BUFFER; count--)
+		*out++ = xoshiro_float(x);
+	if (count < XOSHIRO_LANES) {
+		for (; count; count--)
+			*out++ = xoshiro_float(x);
+		return;
+	}
+	for (k = 0; k < 4; k++)
+		s[k] = _mm_loadu_si128((__m128i const*)x->s[k]);
+	for (; count >= XOSHIRO_LANES; count -= XOSHIRO_LANES, out += XOSHIRO_LANES)
+		_mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(xoshiro_step(s), 8)), scale));
+	for (k = 0; k < 4; k++)
+		_mm_storeu_si128((__m128i*)x->s[k], s[k]);
+	for (; count; count--)		/* refills the buffer */
+		*out++ = xoshiro_float(x);
+}
+
+CHAOS_EXPORT
+uint32_t xoshiro_uint(xoshiro_state_t* x)
+{
+	uint32_t u;
+
+	if (x->pos < XOSHIRO_BUFFER)
+		return x->out[x->pos++];
+	xoshiro_fill_uint(x, &u, 1);
+	return u;
+}
+
+CHAOS_EXPORT
+float xoshiro_float(xoshiro_state_t* x)
+{
+	return (xoshiro_uint(x) >> 8) * XOSHIRO_FLOAT_SCALE;
+}
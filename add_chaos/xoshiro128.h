@@ -0,0 +1,71 @@
+#pragma once
+/* xoshiro128++ 1.0 by David Blackman and Sebastiano Vigna (2019), */
+/* public domain, see https://prng.di.unimi.it/                    */
+/* Four generators run side by side in the lanes of an SSE2        */
+/* register: lane l starts 2^64 steps after lane l - 1, so the     */
+/* lanes never overlap. The output sequence is lane 0, 1, 2, 3 of  */
+/* step 1, then of step 2 and so on, the same for bulk and scalar  */
+/* draws.                                                          */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chaos_params.h"
+
+#define XOSHIRO_LANES 4
+#define XOSHIRO_BUFFER 16	/* outputs buffered for scalar draws */
+
+typedef struct xoshiro_stateStruct
+{
+	uint32_t s[4][XOSHIRO_LANES];	/* word k of lane l is s[k][l] */
+	uint32_t out[XOSHIRO_BUFFER];
+	int pos;						/* next unused output in out */
+} xoshiro_state_t;
+
+/* Seeds the lanes from seed with splitmix64 and jumps stream       */
+/* times by 2^96 steps. Streams of one seed do not overlap for      */
+/* 2^96 steps, so threads or simulated channels can draw from       */
+/* substreams of a common seed. Takes about stream microseconds.    */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void xoshiro_seed(xoshiro_state_t* x, uint64_t seed, uint32_t stream);
+
+/* Moves to the next substream: 2^96 steps ahead in every lane,     */
+/* discarding buffered outputs.                                     */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void xoshiro_long_jump(xoshiro_state_t* x);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void xoshiro_fill_uint(xoshiro_state_t* x, uint32_t* out, size_t count);
+
+/* Uniform floats in [0, 1) with 24 random bits */
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+void xoshiro_fill_float(xoshiro_state_t* x, float* out, size_t count);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+uint32_t xoshiro_uint(xoshiro_state_t* x);
+
+#ifndef __cplusplus
+CHAOS_API
+#else
+extern "C" CHAOS_API
+#endif
+float xoshiro_float(xoshiro_state_t* x);
@@ -1,14 +1,200 @@
 #include "adaptive.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <memory.h>
+#include <math.h>
 #include <Windows.h>
 #include <WinBase.h>
 
 __declspec(dllexport)
-void select_params_adaptive(float buffer_errors, float recovered_tiles, float min_tiles_percent, jpwl_enc_params* params) {
-	static float prev_rec_errors[WINDOW_SIZE] = { 0, 0, 0, 0 };
-	static float prev_rec_tiles[WINDOW_SIZE] = { 0, 0, 0, 0 };
-	static int prev_idx = 0, window_cnt = 0;
+adaptive_ctrl_t* adaptive_ctrl_create(int window, adaptive_mode mode) {
+	if (window <= 0)
+		window = WINDOW_SIZE;
+	adaptive_ctrl_t* ctrl = (adaptive_ctrl_t*)calloc(1, sizeof(adaptive_ctrl_t) + 2 * window * sizeof(float));
+	if (!ctrl)
+		return NULL;
+	InitializeSRWLock(&ctrl->lock);
+	ctrl->mode = mode;
+	ctrl->window = window;
+	ctrl->rec_errors = (float*)(ctrl + 1);
+	ctrl->rec_tiles = ctrl->rec_errors + window;
+	memcpy(ctrl->matrix, err_matrix, sizeof(ctrl->matrix));
+	return ctrl;
+}
+
+// Parses "tiles thr0 ... thrN" into row, returns 0 on success
+static int parse_matrix_row(char* line, err_thresholds* row) {
+	char* end;
+	row->tiles = strtof(line, &end);
+	if (end == line)
+		return -1;
+	for (int i = 0; i < JPWL_CODES; i++) {
+		line = end;
+		row->thresholds[i] = strtof(line, &end);
+		if (end == line)
+			return -1;
+	}
+	return 0;
+}
+
+__declspec(dllexport)
+errno_t adaptive_ctrl_load_matrix(adaptive_ctrl_t* ctrl, wchar_t const* filename, int tiles) {
+	FILE* in;
+	char line[512];
+	err_thresholds section[ERR_MATRIX_ROWS], best[ERR_MATRIX_ROWS];
+	int section_tiles = 0, best_tiles = -1, rows = ERR_MATRIX_ROWS;
+
+	if (_wfopen_s(&in, filename, L"rt") || !in)
+		return -1;
+	while (fgets(line, sizeof(line), in)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf_s(line, "tiles %d", &section_tiles) == 1) {
+			rows = 0;
+			continue;
+		}
+		if (rows >= ERR_MATRIX_ROWS || parse_matrix_row(line, section + rows))
+			continue;
+		if (++rows < ERR_MATRIX_ROWS)
+			continue;
+		// Section complete - keep it if its tile count is the nearest so far
+		if (best_tiles < 0 || (tiles > 0 && abs(section_tiles - tiles) < abs(best_tiles - tiles))) {
+			memcpy(best, section, sizeof(best));
+			best_tiles = section_tiles;
+		}
+	}
+	fclose(in);
+	if (best_tiles < 0)
+		return -2;
+	AcquireSRWLockExclusive(&ctrl->lock);
+	memcpy(ctrl->matrix, best, sizeof(ctrl->matrix));
+	ReleaseSRWLockExclusive(&ctrl->lock);
+	return 0;
+}
+
+__declspec(dllexport)
+void adaptive_ctrl_destroy(adaptive_ctrl_t* ctrl) {
+	if (ctrl)
+		free(ctrl->tile_codes);
+	free(ctrl);
+}
+
+__declspec(dllexport)
+errno_t adaptive_ctrl_tile_stats(adaptive_ctrl_t* ctrl, size_t const* tile_positions, int tiles) {
+	errno_t res = 0;
+
+	if (tiles <= 0)
+		return -1;
+	AcquireSRWLockExclusive(&ctrl->lock);
+	if (ctrl->tiles != tiles) {
+		// codes, boosts and counters share one allocation
+		unsigned char* state = (unsigned char*)calloc(tiles, 2 * sizeof(unsigned char) + sizeof(unsigned short));
+		if (!state)
+			res = -1;
+		else {
+			free(ctrl->tile_codes);
+			ctrl->tiles = tiles;
+			ctrl->tile_codes = state;
+			ctrl->tile_boost = state + tiles;
+			ctrl->tile_quiet = (unsigned short*)(state + 2 * tiles);
+		}
+	}
+	for (int i = 0; !res && i < tiles; i++) {
+		if (!tile_positions[i]) {
+			if (ctrl->tile_boost[i] < JPWL_CODES - 1)
+				ctrl->tile_boost[i]++;
+			ctrl->tile_quiet[i] = 0;
+		}
+		else if (++ctrl->tile_quiet[i] >= 2 * ctrl->window) {
+			if (ctrl->tile_boost[i])
+				ctrl->tile_boost[i]--;
+			ctrl->tile_quiet[i] = 0;
+		}
+	}
+	ReleaseSRWLockExclusive(&ctrl->lock);
+	return res;
+}
+
+__declspec(dllexport)
+void adaptive_ctrl_rs_stats(adaptive_ctrl_t* ctrl, jpwl_dec_bResults const* results) {
+	double keep = 1.0 - 2.0 / (ctrl->window + 1);	// EWMA with the same mean age as the window
+
+	AcquireSRWLockExclusive(&ctrl->lock);
+	ctrl->rs_codewords = ctrl->rs_codewords * keep + results->rs.codewords;
+	ctrl->rs_failed = ctrl->rs_failed * keep + results->rs.failed;
+	ctrl->rs_symbols = ctrl->rs_symbols * keep + results->rs.symbols;
+	ctrl->rs_corrected = ctrl->rs_corrected * keep + results->rs.corrected;
+	ctrl->rs_tiles = ctrl->rs_tiles * keep + results->tile_count;
+	ReleaseSRWLockExclusive(&ctrl->lock);
+}
+
+// Probability that an RS(n,32) codeword holds more symbol errors than it corrects
+static double rs_fail_prob(int n, double p) {
+	int t = (n - 32) >> 1;
+	double lp = log(p), lq = log1p(-p), lf = lgamma(n + 1.0), sum = 0;
+	for (int i = t + 1; i <= n; i++)
+		sum += exp(lf - lgamma(i + 1.0) - lgamma(n - i + 1.0) + i * lp + (n - i) * lq);
+	return min(sum, 1.0);
+}
+
+// Log-likelihood of symbol error rate p: corrected codewords give binomial counts,
+// uncorrectable ones only tell that code n was exceeded
+static double mpc_log_likelihood(adaptive_ctrl_t const* ctrl, int n, double p) {
+	double l = ctrl->rs_corrected * log(p) + (ctrl->rs_symbols - ctrl->rs_corrected) * log1p(-p);
+	if (ctrl->rs_failed > 0)
+		l += ctrl->rs_failed * log(max(rs_fail_prob(n, p), 1e-300));
+	return l;
+}
+
+// Maximum likelihood symbol error rate, golden section search over log p
+static double mpc_estimate_ser(adaptive_ctrl_t const* ctrl, int n) {
+	if (ctrl->rs_failed <= 0 && ctrl->rs_symbols > 0)
+		return max(ctrl->rs_corrected / ctrl->rs_symbols, MPC_MIN_SER);
+	double const g = .6180339887498949;
+	double a = log(MPC_MIN_SER), b = log(.5);
+	double x1 = b - g * (b - a), x2 = a + g * (b - a);
+	double f1 = mpc_log_likelihood(ctrl, n, exp(x1)), f2 = mpc_log_likelihood(ctrl, n, exp(x2));
+	for (int i = 0; i < 60; i++) {
+		if (f1 < f2) {
+			a = x1;
+			x1 = x2;
+			f1 = f2;
+			x2 = a + g * (b - a);
+			f2 = mpc_log_likelihood(ctrl, n, exp(x2));
+		}
+		else {
+			b = x2;
+			x2 = x1;
+			f2 = f1;
+			x1 = b - g * (b - a);
+			f1 = mpc_log_likelihood(ctrl, n, exp(x1));
+		}
+	}
+	return exp((a + b) * .5);
+}
+
+// Cheapest code whose predicted ratio of fully recovered tiles meets the target:
+// a tile survives when none of its data codewords fails
+static void select_code_mpc(adaptive_ctrl_t* ctrl, float min_tiles_percent, jpwl_enc_params* params) {
+	int n = max(params->wcoder_data, jpwl_codes[0]);	// code of the observed frames
+	double p = mpc_estimate_ser(ctrl, n);
+	// Margin of one standard error (and one symbol) against optimism on few samples
+	double samples = ctrl->rs_symbols + ctrl->rs_failed * n;
+	p = min(p + sqrt(p * (1.0 - p) / samples) + 1.0 / samples, .5);
+	double per_tile = ctrl->rs_codewords / ctrl->rs_tiles;
+	int selected_code_idx = JPWL_CODES - 1;
+	for (int i = 0; i < JPWL_CODES; i++) {
+		if (exp(per_tile * log1p(-rs_fail_prob(jpwl_codes[i], p))) >= min_tiles_percent) {
+			selected_code_idx = i;
+			break;
+		}
+	}
+	params->wcoder_data = jpwl_codes[selected_code_idx];
+}
+
+__declspec(dllexport)
+void select_params_adaptive(adaptive_ctrl_t* ctrl, float buffer_errors, float recovered_tiles, float min_tiles_percent, jpwl_enc_params* params) {
+	AcquireSRWLockExclusive(&ctrl->lock);
 
 	int jpwl_idx = 0;
 	for (int i = 0; i < JPWL_CODES; i++) {
@@ -17,37 +203,39 @@ void select_params_adaptive(float buffer_errors, float recovered_tiles, float mi
 			break;
 		}
 	}
-	prev_rec_errors[prev_idx] = buffer_errors;
-	prev_rec_tiles[prev_idx] = recovered_tiles;
-	prev_idx++;
-	if (prev_idx >= WINDOW_SIZE) {
-		prev_idx = 0;
+	// Replace the oldest entry and keep the running sums in step with the ring
+	ctrl->sum_errors += (double)buffer_errors - ctrl->rec_errors[ctrl->idx];
+	ctrl->sum_tiles += (double)recovered_tiles - ctrl->rec_tiles[ctrl->idx];
+	ctrl->rec_errors[ctrl->idx] = buffer_errors;
+	ctrl->rec_tiles[ctrl->idx] = recovered_tiles;
+	ctrl->idx++;
+	if (ctrl->idx >= ctrl->window) {
+		ctrl->idx = 0;
 	}
 
-	if (window_cnt >= WINDOW_SIZE) {
-		float avg_errors = 0, avg_tiles = 0;
-		for (int i = 0; i < WINDOW_SIZE; i++) {
-			avg_errors += prev_rec_errors[i];
-			avg_tiles += prev_rec_tiles[i];
-		}
-		avg_errors /= WINDOW_SIZE;
-		avg_tiles /= WINDOW_SIZE;
+	if (ctrl->mode == ADAPTIVE_MPC) {
+		if (ctrl->rs_codewords > 0 && ctrl->rs_tiles > 0)	// no statistics yet - keep the code
+			select_code_mpc(ctrl, min_tiles_percent, params);
+	}
+	else if (ctrl->window_cnt >= ctrl->window) {
+		float avg_errors = (float)(ctrl->sum_errors / ctrl->window);
+		float avg_tiles = (float)(ctrl->sum_tiles / ctrl->window);
 
 		int matrix_idx = ERR_MATRIX_ROWS - 1;
 		for (int i = 0; i < ERR_MATRIX_ROWS; i++) {
-			if (err_matrix[i].tiles <= min_tiles_percent) {
+			if (ctrl->matrix[i].tiles <= min_tiles_percent) {
 				matrix_idx = i;
 				break;
 			}
 		}
 		float err_thresholds[JPWL_CODES];
 		memcpy_s(err_thresholds, JPWL_CODES * sizeof(err_thresholds[0]),
-			err_matrix[matrix_idx].thresholds, JPWL_CODES * sizeof(err_matrix[matrix_idx].thresholds[0]));
-		if (matrix_idx > 0 && min_tiles_percent > err_matrix[ERR_MATRIX_ROWS - 1].tiles) {
-			float linear_approx_k = (min_tiles_percent - err_matrix[matrix_idx].tiles) /
-				(err_matrix[matrix_idx - 1].tiles - err_matrix[matrix_idx].tiles);
+			ctrl->matrix[matrix_idx].thresholds, JPWL_CODES * sizeof(ctrl->matrix[matrix_idx].thresholds[0]));
+		if (matrix_idx > 0 && min_tiles_percent > ctrl->matrix[ERR_MATRIX_ROWS - 1].tiles) {
+			float linear_approx_k = (min_tiles_percent - ctrl->matrix[matrix_idx].tiles) /
+				(ctrl->matrix[matrix_idx - 1].tiles - ctrl->matrix[matrix_idx].tiles);
 			for (int i = 0; i < JPWL_CODES; i++) {
-				err_thresholds[i] += (err_matrix[matrix_idx - 1].thresholds[i] - err_thresholds[i]) * linear_approx_k;
+				err_thresholds[i] += (ctrl->matrix[matrix_idx - 1].thresholds[i] - err_thresholds[i]) * linear_approx_k;
 			}
 		}
 		// This RS code selection based on detected errors in stream
@@ -66,74 +254,41 @@ void select_params_adaptive(float buffer_errors, float recovered_tiles, float mi
 			int step = max((int)((min_tiles_percent - avg_tiles) * JPWL_CODES), 1);
 			selected_code_idx = min(jpwl_idx + step, JPWL_CODES - 1);
 			selected_code_idx = max(guessed_code_idx, selected_code_idx);
-			window_cnt = WINDOW_SIZE >> 1;
+			ctrl->window_cnt = ctrl->window >> 1;
 		}
 		else if (avg_tiles > max_tiles_percent) {
 			selected_code_idx = (jpwl_idx + guessed_code_idx) >> 1;
-			window_cnt = WINDOW_SIZE >> 1;
+			ctrl->window_cnt = ctrl->window >> 1;
 		}
 
 		params->wcoder_data = jpwl_codes[selected_code_idx];
 	}
 	else {
-		window_cnt++;
+		ctrl->window_cnt++;
 	}
+	ReleaseSRWLockExclusive(&ctrl->lock);
 }
 
-//void init_err_matrix(wchar_t const* filename) {
-//	FILE* in;
-//	if (_wfopen_s(&in, filename, L"rt, ccs=UTF-8"))
-//		return;
-//	FILE* out;
-//	if (_wfopen_s(&out, L"..\\Backup\\init_err_matrix.tsv", L"wt, ccs=UTF-8"))
-//		return;
-//	if (!in || !out)
-//		return;
-//	int rs_prev_idx = 0;
-//	float err_prev = 0, tiles_prev = 1.0f, min_tiles_prev = 1.0f;
-//	for (int e = 0; e < ERR_MATRIX_ROWS; e++) {
-//		while (getwc(in) != L'\n');
-//		fwprintf(out, L"%.2f\n", err_matrix[e].tiles);
-//		char idx_rdy = 0;
-//		do {
-//			int rs, rs_idx = 0;
-//			float err, tiles, _;
-//			fwscanf_s(in, L"%d\t%f\t%f\t%f\n", &rs, &err, &tiles, &_);
-//			tiles *= .01f;
-//			for (int i = 0; i < JPWL_CODES; i++) {
-//				if (jpwl_codes[i] == rs) {
-//					rs_idx = i;
-//					break;
-//				}
-//			}
-//			if (rs_prev_idx != rs_idx) {
-//				rs_prev_idx = rs_idx;
-//				tiles_prev = 1.0f;
-//				err_prev = err > 1.0f ? err - 1.0f : 0;
-//				idx_rdy = 0;
-//			}
-//			if (idx_rdy) continue;
-//			if (tiles == err_matrix[e].tiles) {
-//				err_matrix[e].thresholds[rs_idx] = err * .01f;
-//				fwprintf(out, L"%.1f\t", err);
-//				idx_rdy = 1;
-//			}
-//			else if (tiles_prev > err_matrix[e].tiles && err_matrix[e].tiles > tiles) {
-//				float deltaT = tiles_prev - tiles;
-//				float deltaE = err - err_prev;
-//				float k = (tiles_prev - err_matrix[e].tiles) / deltaT;
-//				err = err_prev + deltaE * k;
-//				err_matrix[e].thresholds[rs_idx] = err * .01f;
-//				fwprintf(out, L"%.1f\t", err);
-//				idx_rdy = 1;
-//			}
-//
-//			tiles_prev = tiles;
-//			err_prev = err;
-//		} while (!feof(in));
-//		fwprintf(out, L"\n");
-//		rewind(in);
-//	}
-//	fclose(in);
-//	fclose(out);
-//}
+__declspec(dllexport)
+void select_tile_codes_adaptive(adaptive_ctrl_t* ctrl, jpwl_enc_params* params) {
+	int jpwl_idx = -1;
+	for (int i = 0; i < JPWL_CODES; i++) {
+		if (jpwl_codes[i] == params->wcoder_data) {
+			jpwl_idx = i;
+			break;
+		}
+	}
+
+	AcquireSRWLockExclusive(&ctrl->lock);
+	if (jpwl_idx < 0 || !ctrl->tiles) {
+		params->tile_codes = NULL;
+		params->tile_codes_cnt = 0;
+	}
+	else {
+		for (int i = 0; i < ctrl->tiles; i++)
+			ctrl->tile_codes[i] = (unsigned char)jpwl_codes[min(jpwl_idx + ctrl->tile_boost[i], JPWL_CODES - 1)];
+		params->tile_codes = ctrl->tile_codes;
+		params->tile_codes_cnt = (unsigned short)ctrl->tiles;
+	}
+	ReleaseSRWLockExclusive(&ctrl->lock);
+}
@@ -1,18 +1,25 @@
 #pragma once
+#include <Windows.h>
 #include "jpwl_types.h"
 
-#define WINDOW_SIZE 4
+#define WINDOW_SIZE 4		// Default averaging window, frames
 #define ERR_MATRIX_ROWS 6
+#define MPC_MIN_SER 1e-7	// Lowest symbol error rate considered by the MPC estimator
+
+typedef enum {
+	ADAPTIVE_WINDOW,	// Thresholds of err_matrix against windowed buffer errors and recovered tiles
+	ADAPTIVE_MPC		// Cheapest code meeting the target by the RS failure model, see adaptive_ctrl_rs_stats
+} adaptive_mode;
 
 typedef struct {
 	float tiles;
 	float thresholds[JPWL_CODES];
 } err_thresholds;
 
-uint8_t const jpwl_codes[JPWL_CODES] =
+static uint8_t const jpwl_codes[JPWL_CODES] =
 { 37, 38, 40, 43, 45, 48, 51, 53, 56, 64, 75, 80, 85, 96, 112, 128 };
 
-err_thresholds const err_matrix[6] = {
+static err_thresholds const err_matrix[ERR_MATRIX_ROWS] = {	// Default, see adaptive_ctrl_load_matrix
 	{.tiles = .98f,
 	.thresholds = { .002f, .01f, .015f, .024f, .031f, .053f, .055f,
 		.064f, .081f, .125f, .13f, .161f, .161f, .191f, .191f, .179f }
@@ -39,5 +46,106 @@ err_thresholds const err_matrix[6] = {
 	}
 };
 
+/**
+ * Adaptive code selection state of one stream.
+ * Create one controller per stream with adaptive_ctrl_create. Calls for different
+ * controllers are independent; calls for the same controller are serialized by its lock.
+ */
+typedef struct {
+	SRWLOCK lock;
+	adaptive_mode mode;
+	int window;			// Averaging window, frames
+	int idx;			// Next slot in the history ring
+	int window_cnt;		// Frames since start or since the last code change
+	double sum_errors;	// Running sums over the history ring
+	double sum_tiles;
+	err_thresholds matrix[ERR_MATRIX_ROWS];	// Error thresholds in use, err_matrix by default
+	double rs_codewords;	// MPC: decoded data codewords, exponentially weighted over the window
+	double rs_failed;	// MPC: uncorrectable codewords
+	double rs_symbols;	// MPC: symbols of corrected codewords
+	double rs_corrected;	// MPC: corrected symbols
+	double rs_tiles;	// MPC: tiles of the frames
+	float* rec_errors;	// Error ratio history, window entries
+	float* rec_tiles;	// Recovered tiles history, window entries
+	int tiles;			// Tiles of the per-tile state, 0 - no tile statistics yet
+	unsigned char* tile_codes;	// Per-tile codes for jpwl_enc_params.tile_codes
+	unsigned char* tile_boost;	// Code steps above the frame code per tile
+	unsigned short* tile_quiet;	// Frames since the last failure or step down per tile
+} adaptive_ctrl_t;
+
+/**
+ * brief  Create the adaptive controller of a stream
+ * param  window Averaging window in frames, 0 - WINDOW_SIZE
+ * param  mode Code selection method
+ * return Controller or NULL when out of memory
+ */
+__declspec(dllimport)
+adaptive_ctrl_t* adaptive_ctrl_create(int window, adaptive_mode mode);
+
+/**
+ * brief  Feed the RS codeword statistics of a decoded frame (ADAPTIVE_MPC)
+ * details Call before select_params_adaptive for the same frame. Statistics are weighted
+ *		exponentially so that the estimate follows the channel within about a window of frames.
+ * param  ctrl Controller of the stream
+ * param  results Decoder results of the frame
+ */
+__declspec(dllimport)
+void adaptive_ctrl_rs_stats(adaptive_ctrl_t* ctrl, jpwl_dec_bResults const* results);
+
+/**
+ * brief  Feed the per-tile recovery of a decoded frame
+ * details A tile that was not recovered gets its code one step above the frame code;
+ *		the step is taken back after 2 * window frames without failures of the tile.
+ *		The state is reset when the number of tiles changes.
+ * param  ctrl Controller of the stream
+ * param  tile_positions Tile positions after jpwl_dec_run, 0 - tile was not recovered. Without use_red
+ *		the decoder only zeroes failed tiles, so the table must be pre-filled with the encoder
+ *		positions (jpwl_enc_bResults.tile_position)
+ * param  tiles Tiles per frame
+ * return 0 - ok, -1 - out of memory
+ */
+__declspec(dllimport)
+errno_t adaptive_ctrl_tile_stats(adaptive_ctrl_t* ctrl, size_t const* tile_positions, int tiles);
+
+/**
+ * brief  Load error thresholds produced by the calibration tool
+ * details The file holds sections "tiles N" of ERR_MATRIX_ROWS rows each; a row is
+ *		the recovered tiles ratio followed by JPWL_CODES thresholds, tab separated.
+ *		Lines starting with '#' are comments. The section with the nearest tile count is used.
+ * param  ctrl Controller of the stream
+ * param  filename Matrix file
+ * param  tiles Tiles per frame of the stream, 0 - first section
+ * return 0 - loaded, -1 - file cannot be opened, -2 - no complete section
+ */
+__declspec(dllimport)
+errno_t adaptive_ctrl_load_matrix(adaptive_ctrl_t* ctrl, wchar_t const* filename, int tiles);
+
+/**
+ * brief  Destroy the adaptive controller of a stream
+ * param  ctrl Controller created by adaptive_ctrl_create or NULL
+ */
+__declspec(dllimport)
+void adaptive_ctrl_destroy(adaptive_ctrl_t* ctrl);
+
+/**
+ * brief  Feed the results of one frame and select the RS code for the next ones
+ * param  ctrl Controller of the stream
+ * param  buffer_errors Error ratio of the frame
+ * param  recovered_tiles Ratio of fully recovered tiles of the frame
+ * param  min_tiles_percent Required ratio of recovered tiles
+ * param  params Encoder parameters of the stream, wcoder_data is updated
+ */
+__declspec(dllimport)
+void select_params_adaptive(adaptive_ctrl_t* ctrl, float buffer_errors, float recovered_tiles, float min_tiles_percent, jpwl_enc_params* params);
+
+/**
+ * brief  Select per-tile codes around the frame code chosen by select_params_adaptive
+ * details Tiles that failed recently are protected stronger, the rest use wcoder_data. Since the
+ *		weak tiles no longer pull down the recovered tiles ratio, the frame code settles lower and
+ *		the parity of the whole frame decreases. tile_codes points to the controller and is valid
+ *		until the next call. Without tile statistics or for non-RS wcoder_data the per-tile codes are disabled.
+ * param  ctrl Controller of the stream
+ * param  params Encoder parameters of the stream, tile_codes and tile_codes_cnt are updated
+ */
 __declspec(dllimport)
-void select_params_adaptive(float buffer_errors, float recovered_tiles, float min_tiles_percent, jpwl_enc_params* params);
+void select_tile_codes_adaptive(adaptive_ctrl_t* ctrl, jpwl_enc_params* params);
@@ -0,0 +1,104 @@
+﻿#include <memory.h>
+#include <stdlib.h>
+#include "jpwl_alloc.h"
+
+#define TABLE_MIN_CAPACITY 16	///< Минимальная ёмкость таблицы в элементах
+#define ARENA_ALIGN 16			///< Выравнивание блоков, выделяемых из арены
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void* w_arena_alloc(w_arena* arena, size_t size)
+{
+	w_arena_chunk* chunk;
+	uint8_t* p;
+
+	size = ARENA_ROUND(size);
+	if (arena->offset + size <= arena->size) {	// помещается в основной блок
+		p = arena->base + arena->offset;
+		arena->offset += size;
+		arena->used += size;
+		return p;
+	}
+	// основной блок исчерпан - берем дополнительный блок из кучи до конца кадра
+	chunk = (w_arena_chunk*)malloc(sizeof(w_arena_chunk) + size);
+	if (!chunk)
+		return NULL;				// неудавшийся запрос не учитывается в used
+	arena->used += size;
+	arena->heap_allocs++;
+	chunk->next = arena->overflow;
+	arena->overflow = chunk;
+	return chunk + 1;
+}
+
+void w_arena_reset(w_arena* arena)
+{
+	w_arena_chunk* chunk;
+	size_t new_size;
+
+	while (arena->overflow) {
+		chunk = arena->overflow;
+		arena->overflow = chunk->next;
+		free(chunk);
+	}
+	if (arena->used > arena->size) {	// кадр не поместился - увеличиваем основной блок с запасом 1/8
+		new_size = ARENA_ROUND(arena->used + (arena->used >> 3));
+		free(arena->base);
+		arena->base = (uint8_t*)malloc(new_size);
+		arena->size = arena->base ? new_size : 0;
+		arena->heap_allocs++;
+	}
+	arena->last_frame = arena->used;
+	if (arena->used > arena->high_water)
+		arena->high_water = arena->used;
+	arena->offset = 0;
+	arena->used = 0;
+}
+
+void w_arena_free(w_arena* arena)
+{
+	w_arena_reset(arena);
+	free(arena->base);
+	arena->base = NULL;
+	arena->size = 0;
+}
+
+void w_arena_stats(w_arena* arena, jpwl_mem_stats* stats)
+{
+	stats->arena_size = arena->size;
+	stats->high_water = arena->high_water;
+	stats->last_frame = arena->last_frame;
+	stats->heap_allocs = arena->heap_allocs;
+}
+
+errno_t w_table_reserve(w_arena* arena, void** items, size_t* capacity, size_t item_size, size_t count)
+{
+	size_t new_capacity;
+	uint8_t* p;
+
+	if (count <= *capacity)
+		return 0;
+	new_capacity = *capacity << 1;
+	if (new_capacity < count)
+		new_capacity = count;
+	if (new_capacity < TABLE_MIN_CAPACITY)
+		new_capacity = TABLE_MIN_CAPACITY;
+	if (arena) {
+		p = (uint8_t*)w_arena_alloc(arena, new_capacity * item_size);
+		if (p && *capacity)
+			memcpy(p, *items, *capacity * item_size);
+	}
+	else
+		p = (uint8_t*)realloc(*items, new_capacity * item_size);
+	if (!p)
+		return -1;
+	memset(p + *capacity * item_size, 0, (new_capacity - *capacity) * item_size);
+	*items = p;
+	*capacity = new_capacity;
+	return 0;
+}
+
+void w_table_free(void** items, size_t* capacity)
+{
+	free(*items);
+	*items = NULL;
+	*capacity = 0;
+}
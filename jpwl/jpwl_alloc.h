@@ -0,0 +1,91 @@
+﻿#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include "jpwl_types.h"
+
+/**
+ * \struct w_arena_chunk
+ * \brief Заголовок дополнительного блока арены, выделенного из кучи при переполнении
+ */
+typedef struct w_arena_chunk {
+	struct w_arena_chunk* next;	///< Следующий дополнительный блок
+	size_t reserved;			///< Выравнивание данных блока на 16 байт
+} w_arena_chunk;
+
+/**
+ * \struct w_arena
+ * \brief Арена для временных данных одного кадра
+ * \details Память выделяется сдвигом указателя внутри основного блока и целиком
+ * возвращается вызовом w_arena_reset в конце кадра. Если кадру не хватило основного
+ * блока, недостающее берется из кучи, а при сбросе основной блок увеличивается
+ * до объема этого кадра, так что следующие кадры того же размера обходятся без кучи.
+ */
+typedef struct {
+	uint8_t* base;			///< Основной блок
+	size_t size;			///< Размер основного блока
+	size_t offset;			///< Занято в основном блоке
+	size_t used;			///< Занято в текущем кадре, включая дополнительные блоки
+	size_t high_water;		///< Максимальный объем, занятый за один кадр
+	size_t last_frame;		///< Объем, занятый в последнем завершенном кадре
+	uint32_t heap_allocs;	///< Количество выделений памяти из кучи
+	w_arena_chunk* overflow;	///< Список дополнительных блоков текущего кадра
+} w_arena;
+
+/**
+ * \brief Выделение памяти из арены
+ * \param arena Адрес арены
+ * \param size Размер в байтах
+ * \return Адрес выделенной памяти (выравнивание 16 байт) или NULL при нехватке памяти
+ */
+void* w_arena_alloc(w_arena* arena, size_t size);
+
+/**
+ * \brief Сброс арены в конце кадра
+ * \details Освобождает дополнительные блоки и при необходимости увеличивает основной блок.
+ * Все указатели, полученные из арены, становятся недействительными.
+ * \param arena Адрес арены
+ */
+void w_arena_reset(w_arena* arena);
+
+/**
+ * \brief Освобождение всей памяти арены
+ * \param arena Адрес арены
+ */
+void w_arena_free(w_arena* arena);
+
+/**
+ * \brief Заполнение статистики использования памяти по данным арены
+ * \param arena Адрес арены
+ * \param stats Адрес структуры для статистики
+ */
+void w_arena_stats(w_arena* arena, jpwl_mem_stats* stats);
+
+/**
+ * \brief Резервирование места в динамической таблице
+ * \details Если ёмкости таблицы недостаточно для count элементов, память под таблицу
+ * перевыделяется с запасом (не менее чем вдвое), ранее записанные элементы сохраняются,
+ * добавленные элементы обнуляются.
+ * Если arena не NULL, память берется из арены и таблица живет до сброса арены,
+ * иначе таблица размещается в куче и сохраняется между кадрами.
+ * \param arena Арена кадра или NULL
+ * \param items Адрес указателя на первый элемент таблицы
+ * \param capacity Адрес переменной с ёмкостью таблицы в элементах
+ * \param item_size Размер одного элемента в байтах
+ * \param count Требуемое количество элементов
+ * \return 0 - место есть, -1 - ошибка выделения памяти
+ */
+errno_t w_table_reserve(w_arena* arena, void** items, size_t* capacity, size_t item_size, size_t count);
+
+/**
+ * \brief Освобождение памяти динамической таблицы, размещенной в куче
+ * \param items Адрес указателя на первый элемент таблицы
+ * \param capacity Адрес переменной с ёмкостью таблицы в элементах
+ */
+void w_table_free(void** items, size_t* capacity);
+
+/**
+ * \brief Освобождение таблиц декодера jpwl вызывающего потока (определена в jpwl_decoder.c)
+ * \details Вызывается из jpwl_destroy и по завершении пакетного кодирования, которые
+ * находятся в jpwl_encoder.c
+ */
+void dec_tables_free();
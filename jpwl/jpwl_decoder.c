@@ -1,9 +1,14 @@
-﻿#include <memory.h>
+﻿#include <Windows.h>
+#include <emmintrin.h>
+#include <intrin.h>
+#include <memory.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "math.h"
 #include "crc.h"
+#include "jpwl_alloc.h"
+#include "jpwl_pool.h"
 #include "jpwl_params.h"
 #include "jpwl_types.h"
 
@@ -14,28 +19,115 @@
 #include "..\rs_crc_lib\rs_crc_import.h"
 #endif // RS_OPTIMIZED
 
-unsigned char* in_buf;		///< Адрес входного буфера
-unsigned long in_len;		///< Количествово байт во входном буфере
-unsigned char* out_buf;		///< Адрес выходного буфера
-unsigned short tile_count;	///< Счетчик успешно скорректированных тайлов
-unsigned char rs_data[256];	///< Буфер для неполно заполненных корректируемых RS-кодами данных и для проверки контрольной суммы EPC (для случая внутрикадрового чередования длина буфера должна позволить поместить всю карту EPB)
-w_marker dec_markers[MAX_MARKERS]; ///< Массив маркеров jpwl и некорректируемых участков, обнаруженных при декодировании
-unsigned short markers_cnt;	///< Счетчик обнаруженных и записанных в dec_markers маркеров
-_bool_ esd_used;	///< ESD используется в кодовом потоке?
-_bool_ epb_used;	///< EPB используется в кодовом потоке?
-unsigned long dec_epc_dl;		///< Значение длины из EPC 
-unsigned short old_rs_mode;	///< RS-код, который был проинициализирован последним
-unsigned long mh_tile_len;		// Сумма длин основного заголовка и тайлов, копируемых в выходной буфер
-_bool_ has_bad_blocks;					///< Обнаружены ли невосстанавливаемые тайлы( _true_, _false_)
-_bool_ is_ammendment;				///< Используется ли Ammendment в кодовом потоке ( _true_, _false_)
-unsigned short tepb_count;			///< Количество записей в таблице EPB при использовании Ammendment
-unsigned char* tepb_adr;			///< Адрес таблицы EPB при использовании Ammendment
-unsigned long mh_len;				///< Длина основного заголовка во входном буфере 
-unsigned short tile_all_rest_cnt;	///< Количество полностью восстановленных тайлов кадра
-unsigned short tile_red_rest_cnt;	///< Количество частично восстановленных тайлов кадра, в которых присутствуют маркеры RED
-unsigned long bad_block_length;		 ///< Количество нераспознанных как тайл байт данных
-restore_stats stats;
-int* _tile_positions;
+#define DEC_SOT_REJECTED 0xFF	///< Оценка кандидата SOT, пре-данные которого не скорректировались
+#define DEC_MARKERS_FULL w_table_reserve(&dec_arena, (void**)&dec_markers, &dec_markers_cap, sizeof(w_marker), (size_t)markers_cnt + 1)
+
+W_TLS unsigned char* in_buf;		///< Адрес входного буфера
+W_TLS size_t in_len;		///< Количествово байт во входном буфере
+W_TLS unsigned char* out_buf;		///< Адрес выходного буфера
+extern W_TLS unsigned short tile_count;	///< Счетчик успешно скорректированных тайлов
+W_TLS unsigned char rs_data[256];	///< Буфер для неполно заполненных корректируемых RS-кодами данных и для проверки контрольной суммы EPC (для случая внутрикадрового чередования длина буфера должна позволить поместить всю карту EPB)
+W_TLS w_marker* dec_markers;		///< Таблица маркеров jpwl и некорректируемых участков, обнаруженных при декодировании
+W_TLS size_t dec_markers_cap;		///< Ёмкость таблицы dec_markers
+W_TLS w_arena dec_arena;			///< Арена для таблицы маркеров и промежуточных буферов текущего кадра
+W_TLS uint32_t markers_cnt;	///< Счетчик обнаруженных и записанных в dec_markers маркеров
+W_TLS _bool_ esd_used;	///< ESD используется в кодовом потоке?
+W_TLS _bool_ epb_used;	///< EPB используется в кодовом потоке?
+W_TLS unsigned long dec_epc_dl;		///< Значение длины из EPC 
+W_TLS unsigned short old_rs_mode;	///< RS-код, который был проинициализирован последним
+W_TLS size_t mh_tile_len;		// Сумма длин основного заголовка и тайлов, копируемых в выходной буфер
+W_TLS _bool_ has_bad_blocks;					///< Обнаружены ли невосстанавливаемые тайлы( _true_, _false_)
+W_TLS _bool_ is_ammendment;				///< Используется ли Ammendment в кодовом потоке ( _true_, _false_)
+W_TLS unsigned short tepb_count;			///< Количество записей в таблице EPB при использовании Ammendment
+W_TLS unsigned char* tepb_adr;			///< Адрес таблицы EPB при использовании Ammendment
+W_TLS size_t mh_len;				///< Длина основного заголовка во входном буфере 
+W_TLS unsigned short tile_all_rest_cnt;	///< Количество полностью восстановленных тайлов кадра
+W_TLS unsigned short tile_red_rest_cnt;	///< Количество частично восстановленных тайлов кадра, в которых присутствуют маркеры RED
+W_TLS size_t bad_block_length;		 ///< Количество нераспознанных как тайл байт данных
+W_TLS restore_stats stats;
+W_TLS size_t* _tile_positions;	///< Позиции тайлов в выходном потоке по номерам тайлов, 0 - тайл не восстановлен
+W_TLS size_t dec_out_len;			///< Количество байт, записанных в выходной буфер
+W_TLS size_t dec_copy_pos;		///< Позиция во входном буфере, до которой данные перенесены в выходной буфер
+W_TLS uint32_t dec_copy_mark;		///< Индекс первого маркера, еще не учтенного при копировании
+W_TLS int dec_copy_tno;			///< Индекс заголовка последнего учтенного при копировании маркера
+W_TLS sot_cand* dec_sot;			///< Кандидаты SOT для поиска тайлов, упорядоченные по правдоподобию
+W_TLS size_t dec_sot_cap;			///< Ёмкость таблицы dec_sot
+W_TLS size_t dec_sot_cnt;			///< Количество кандидатов SOT
+W_TLS _bool_ dec_sot_built;		///< Список кандидатов SOT построен в текущем кадре
+W_TLS uint32_t* dec_tile_pos;		///< Таблица позиций тайлов из EPC (INF_TILE_POS_ID) или NULL
+W_TLS uint16_t dec_tile_pos_cnt;	///< Количество записей в таблице позиций тайлов
+W_TLS size_t* dec_tile_out;		///< Позиции полностью восстановленных тайлов в выходном потоке (без EPC) по Isot, 0 - тайл не восстановлен
+W_TLS uint32_t dec_tiles_total;	///< Количество тайлов кадра по сегменту SIZ (размер таблицы позиций тайлов)
+W_TLS _bool_ dec_use_red;			///< Отмечать некорректируемые участки тайлов сегментами RED
+W_TLS _bool_ dec_red_used;		///< В выходной поток вставлены сегменты RED (и EPC, сообщающий о них)
+W_TLS red_interval* dec_red;		///< Интервалы с остаточными ошибками (позиции во входном буфере)
+W_TLS size_t dec_red_cap;			///< Ёмкость таблицы dec_red
+W_TLS size_t dec_red_cnt;			///< Количество записей в dec_red
+W_TLS size_t dec_epc_out;			///< Позиция EPC в выходном буфере
+W_TLS _bool_ dec_budget_on;		///< Задан бюджет декодирования: коррекция данных тайлов откладывается
+W_TLS uint64_t dec_deadline;		///< Момент исчерпания бюджета времени (в единицах QueryPerformanceCounter), 0 - не задан
+W_TLS uint32_t dec_work_budget;	///< Бюджет работы: количество декодируемых RS-кодовых слов и проверок CRC, 0 - не задан
+W_TLS uint32_t dec_work;			///< Количество декодированных RS-кодовых слов и проверок CRC в текущем кадре
+W_TLS tile_rec* dec_tiles;		///< Тайлы с отложенной коррекцией данных, в порядке следования в потоке
+W_TLS size_t dec_tiles_cap;		///< Ёмкость таблицы dec_tiles
+W_TLS size_t dec_tiles_cnt;		///< Количество записей в dec_tiles
+W_TLS uint16_t dec_skip_cnt;		///< Количество тайлов, отброшенных по исчерпании бюджета
+W_TLS size_t dec_skip_length;		///< Количество байт, отброшенных по исчерпании бюджета
+W_TLS rs_frame_stats dec_rs_stats;		///< Статистика кодовых слов RS защиты данных текущего кадра
+W_TLS uint8_t* dec_sens;			///< Значения чувствительности из ESD тайлов подряд (для jpwl_dec_bResults, сохраняется между кадрами)
+W_TLS size_t dec_sens_cap;			///< Ёмкость таблицы dec_sens
+W_TLS size_t dec_sens_cnt;			///< Количество значений в dec_sens
+W_TLS uint16_t* dec_sens_tiles;		///< Количество значений чувствительности по тайлам
+W_TLS size_t dec_sens_tiles_cap;	///< Ёмкость таблицы dec_sens_tiles
+W_TLS uint16_t dec_sens_tiles_cnt;	///< Количество тайлов, занесенных в dec_sens_tiles
+
+#define DEC_TILE_WAIT 0		///< Данные тайла еще не корректировались
+#define DEC_TILE_FULL 1		///< Тайл полностью восстановлен
+#define DEC_TILE_PART 2		///< Тайл восстановлен частично
+
+#define DEC_STREAM_MH 1		///< Потоковый декодер ждет основной заголовок
+#define DEC_STREAM_FIRST 2	///< Потоковый декодер ждет начало первого тайла
+#define DEC_STREAM_TILE 3	///< Потоковый декодер ждет очередной тайл
+#define DEC_STREAM_TAIL 4	///< Тайлы разобраны, ожидается конец кадра
+#define DEC_STREAM_WHOLE 5	///< Кадр будет обработан целиком при завершении
+#define DEC_STREAM_DONE 6	///< Кадр обработан
+
+W_TLS uint8_t ds_state;			///< Состояние потокового декодера (0 - не запущен)
+W_TLS size_t ds_cap;				///< Размер буфера кадра потокового декодера
+W_TLS size_t ds_received;			///< Количество полученных байт кадра
+W_TLS size_t ds_out_start;		///< Начало еще не выданного участка выходного буфера
+W_TLS _bool_ ds_len_unknown;		///< Длина кадра в EPC не указана (DL = 0) и станет известна в jpwl_dec_stream_end
+W_TLS uint8_t* ds_tile;			///< Адрес очередного тайла, ожидающего коррекции
+W_TLS uint16_t ds_tile_num;		///< Порядковый номер тайла, к которому относится остаток кадра
+W_TLS jpwl_dec_tile_cb ds_tile_cb;	///< Функция приема скорректированных тайлов
+W_TLS void* ds_user;				///< Параметр функции приема тайлов
+
+/**
+ * \brief Запись некорректируемого участка данных в таблицу интервалов RED
+ * \details Смежные участки объединяются. При нехватке памяти участок присоединяется
+ * к последнему интервалу, чтобы поврежденные данные не оказались отмеченными как верные.
+ * \param p  Адрес первого байта участка во входном буфере
+ * \param len  Длина участка в байтах
+ */
+void dec_red_add(uint8_t* p, uint32_t len)
+{
+	uint32_t pos = (uint32_t)(p - in_buf);
+
+	if (!dec_use_red || !len)
+		return;
+	if (dec_red_cnt && dec_red[dec_red_cnt - 1].end + 1 == pos) {
+		dec_red[dec_red_cnt - 1].end += len;
+		return;
+	}
+	if (w_table_reserve(&dec_arena, (void**)&dec_red, &dec_red_cap, sizeof(red_interval), dec_red_cnt + 1)) {
+		if (dec_red_cnt)
+			dec_red[dec_red_cnt - 1].end = pos + len - 1;
+		return;
+	}
+	dec_red[dec_red_cnt].start = pos;
+	dec_red[dec_red_cnt].end = pos + len - 1;
+	dec_red[dec_red_cnt++].errors = 0xFFFF;
+}
 
 /**
  * \brief определение способа защиты пост-данных блока EPB
@@ -96,6 +188,7 @@ uint32_t postEPB_correct(uint8_t* epb_start, uint8_t* postdata_start, uint32_t p
 	uint16_t prot_mode, c16_calculated, c16_expected;
 	int n_p, k_p, l, i;
 	uint32_t data_len, c32_calculated, c32_expected, badparts_count = 0;
+	_bool_ data_rs;
 
 	
 	// тип EPB: 0 - первый в осн. заголовке, 1 - первый в заголовке тайла, 2 - не первый в заголовке 
@@ -111,18 +204,23 @@ uint32_t postEPB_correct(uint8_t* epb_start, uint8_t* postdata_start, uint32_t p
 		parity_start = epb_start + EPB_LN + 2 + 55;
 	else
 		parity_start = epb_start + EPB_LN + 2 + 27;
+	dec_work++;
 	if (prot_mode == 16) {			// crc16
 		c16_calculated = CRC16(postdata_start, data_len);
 		c16_expected = _byteswap_ushort(*(uint16_t*)parity_start);
-		if (c16_calculated != c16_expected)
+		if (c16_calculated != c16_expected) {
+			dec_red_add(postdata_start, data_len);
 			return 1;
+		}
 		return 0;
 	};
 	if (prot_mode == 32) {	// crc32
 		c32_calculated = CRC32(postdata_start, data_len);
 		c32_expected = _byteswap_ulong(*(uint32_t*)parity_start);
-		if (c32_calculated != c32_expected)
+		if (c32_calculated != c32_expected) {
+			dec_red_add(postdata_start, data_len);
 			return 1;
+		}
 		return 0;
 	};
 	if (prot_mode == 1) {
@@ -147,19 +245,31 @@ uint32_t postEPB_correct(uint8_t* epb_start, uint8_t* postdata_start, uint32_t p
 		old_rs_mode = n_p;
 	};
 #endif // RS_OPTIMIZED
+	dec_work += (data_len + k_p - 1) / k_p - 1;	// одно кодовое слово уже учтено
+	data_rs = epb_type == 2 && prot_mode >= 37;	// кодовые слова выбираемой защиты данных
 	for (i = 0, l = data_len; l >= k_p; i++, l -= k_p) {
 		int x = decode_RS(postdata_start, parity_start, n_p, k_p);
 		if (x < 0) {
 			badparts_count++;
+			dec_red_add(postdata_start, k_p);
 			for (int j = 0; j < k_p; j++) {
 				if (postdata_start[j] == 0xFF) {
 					postdata_start[j] = 0xFE;
 				}
 			}
 			stats.uncorrected_rs_bytes += n_p;
+			if (data_rs)
+				dec_rs_stats.failed++;
 		}
-		else
+		else {
 			stats.corrected_rs_bytes += x;
+			if (data_rs) {
+				dec_rs_stats.symbols += n_p;
+				dec_rs_stats.corrected += x;
+			}
+		}
+		if (data_rs)
+			dec_rs_stats.codewords++;
 		postdata_start += k_p;			// переходим к следующему блоку данных
 		parity_start += ((size_t)n_p - k_p);	// переходим к след. блоку RS-кодов
 	};
@@ -169,54 +279,330 @@ uint32_t postEPB_correct(uint8_t* epb_start, uint8_t* postdata_start, uint32_t p
 		int x = decode_RS(rs_data, parity_start, n_p, k_p);
 		if (x < 0) {
 			badparts_count++;
+			dec_red_add(postdata_start, l);
 			for (int j = 0; j < l; j++) {
 				if (postdata_start[j] == 0xFF) {
 					postdata_start[j] = 0xFE;
 				}
 			}
 			stats.uncorrected_rs_bytes += l;
+			if (data_rs)
+				dec_rs_stats.failed++;
 		}
 		else {
 			stats.corrected_rs_bytes += x;
+			if (data_rs) {
+				dec_rs_stats.symbols += l + n_p - k_p;	// дополняющие нули не передаются и не искажаются
+				dec_rs_stats.corrected += x;
+			}
 			memcpy(postdata_start, rs_data, l);	// если данные скорректировались, изменяем их во входном буфере
 		}
+		if (data_rs)
+			dec_rs_stats.codewords++;
 	}
 	return badparts_count;
 }
 
 /**
- * \brief Быстрый поиск очередного тайла в случае потери структуры кодового потока
- * \details   Начиная с указанного места и до конца буфера ищет маркер SOT, предполагая, что он не был изменен,
- * предполагая наличие EPB после сегмента SOT корректируем его пре-данные, если скорректировано еще раз
- * проверяем маркер SOT и возвращаем адрес его начала. Если нескорректировано или маркер SOT после
- * коррекции стал другим маркером, продолжаем поиск
- * \param tile  Адрес байта, с которого нужно начать поиск
- * \return Fдрес байта, с которого начинается найденный тайл, у которого корректируются пре-данные первого EPB, или NULL
+ * \brief Проверка предполагаемого начала тайла без порчи входного буфера
+ * \details Пре-данные первого EPB заголовка тайла (RS(80,25)) декодируются в копии.
+ * Входной буфер исправляется только если после коррекции на месте остался маркер SOT,
+ * поэтому отвергнутый кандидат не искажает данные соседнего тайла.
+ * \param v Предполагаемый адрес тайла во входном буфере (за ним должно быть не менее 80 байт)
+ * \return _true_ - пре-данные скорректированы и тайл начинается с маркера SOT
  */
-uint8_t* dec_tile_search(uint8_t* p)
+_bool_ dec_sot_check(uint8_t* v)
 {
-	uint8_t* v;
-	uint16_t SOT_be;
+	uint8_t cw[80];
 
-	SOT_be = ((uint16_t)SOT_LOW << 8) | 0xFF;
-	for (v = p; in_len - (v - in_buf) >= 81; v++) {	// ищем от заданного места до конца буфера минус 80 байт
-		// защита пре-данных первого EPB + 1 байт на пост-данные
-		if (*(uint16_t*)v == SOT_be) {  // найден SOT
+	memcpy(cw, v, sizeof(cw));
 #ifndef RS_OPTIMIZED
-			if (old_rs_mode != 80) {
-				init_rs(80, 25);
-				old_rs_mode = 80;
-			};
-			if (decode_RS(v, v + 25, 80, 25) >= 0)
+	if (old_rs_mode != 80) {	// последний код не RS(80,25)
+		init_rs(80, 25);
+		old_rs_mode = 80;
+	};
+	if (decode_RS(cw, cw + 25, 80, 25) < 0 || cw[0] != 0xff || cw[1] != SOT_LOW)
 #else
-			if (decode_RS(v, NULL, 80, 25) >= 0)
+	if (decode_RS(cw, NULL, 80, 25) < 0 || cw[0] != 0xff || cw[1] != SOT_LOW)
 #endif // !RS_OPTIMIZED
-			{
-				if (*(uint16_t*)v == SOT_be) // после коррекции SOT остался
-					return v;
-			}
-		};
+		return _false_;
+	memcpy(v, cw, sizeof(cw));
+	return _true_;
+}
+
+/**
+ * \brief Поиск позиции в списке кандидатов SOT, упорядоченном по позициям
+ * \param pos Позиция во входном буфере
+ * \return _true_ - в позиции pos есть кандидат
+ */
+_bool_ dec_sot_listed(uint32_t pos)
+{
+	size_t lo = 0, hi = dec_sot_cnt, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (dec_sot[mid].pos < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < dec_sot_cnt && dec_sot[lo].pos == pos;
+}
+
+/**
+ * \brief Оценка правдоподобия кандидата SOT по полям сегмента SOT
+ * \details Учитываются длина сегмента Lsot, маркер EPB сразу за SOT, длина тайла Psot,
+ * совпадение конца тайла с другим кандидатом или концом потока и близость Psot
+ * к средней длине уже разобранных тайлов
+ * \param pos Позиция кандидата во входном буфере
+ * \param spacing Средняя длина разобранных тайлов или 0
+ * \return Оценка, большее значение - более правдоподобный тайл
+ */
+uint8_t dec_sot_score(uint32_t pos, size_t spacing)
+{
+	uint8_t* v = in_buf + pos;
+	uint32_t psot;
+	uint8_t score = 0;
+
+	if (v[2] == 0 && v[3] == SOT_LN)		// Lsot
+		score += 4;
+	if (v[SOT_LN + 2] == 0xff && v[SOT_LN + 3] == EPB_LOW)	// первый EPB заголовка тайла
+		score += 2;
+	psot = _byteswap_ulong(*(uint32_t*)(v + 6));
+	if (psot == 0 || pos + (size_t)psot == in_len - 2)	// последний тайл кадра
+		score += 3;
+	else if (psot >= TILE_MINLENGTH && pos + (size_t)psot < in_len) {
+		score++;
+		if (dec_sot_listed(pos + psot))		// конец тайла совпадает с другим кандидатом
+			score += 2;
+		if (spacing && psot >= spacing / 2 && psot <= spacing * 2)
+			score++;
+	}
+	return score;
+}
+
+/**
+ * \brief Упорядочение кандидатов SOT: по убыванию оценки, при равенстве - по возрастанию позиции
+ */
+int dec_sot_compare(const void* a, const void* b)
+{
+	const sot_cand* x = (const sot_cand*)a, * y = (const sot_cand*)b;
+
+	if (x->score != y->score)
+		return y->score - x->score;
+	return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/**
+ * \brief Отказ от разбора остатка кадра по исчерпании бюджета
+ * \param p  Адрес очередного тайла во входном буфере
+ */
+void dec_tail_abandon(uint8_t* p)
+{
+	size_t rr = in_len - (size_t)(p - in_buf);	// кол-во байт до конца входного буфера
+
+	if (rr <= 2 || DEC_MARKERS_FULL)
+		return;
+	has_bad_blocks = _true_;
+	bad_block_length += rr - 2;
+	dec_skip_length += rr - 2;
+	dec_markers[markers_cnt].id = BAD_ID;	// остаток кадра без маркера EOC
+	dec_markers[markers_cnt].len = dec_markers[markers_cnt].m.bad.Lbad = (uint32_t)rr - 4;
+	dec_markers[markers_cnt].tile_num = tile_count++;
+	dec_markers[markers_cnt++].pos_in = (uint64_t)(p - in_buf);
+}
+
+/**
+ * \brief Проверка исчерпания бюджета декодирования кадра
+ * \return _true_ - бюджет времени или работы исчерпан
+ */
+_bool_ dec_budget_over()
+{
+	LARGE_INTEGER now;
+
+	if (dec_work_budget && dec_work >= dec_work_budget)
+		return _true_;
+	if (dec_deadline) {
+		QueryPerformanceCounter(&now);
+		if ((uint64_t)now.QuadPart >= dec_deadline)
+			return _true_;
+	}
+	return _false_;
+}
+
+/**
+ * \brief Начало отсчета бюджета декодирования кадра
+ * \param budget_us  Бюджет времени в микросекундах, 0 - без ограничения
+ * \param budget_work  Бюджет работы в RS-кодовых словах, 0 - без ограничения
+ */
+void dec_budget_start(uint32_t budget_us, uint32_t budget_work)
+{
+	LARGE_INTEGER now, freq;
+
+	dec_work = 0;
+	dec_work_budget = budget_work;
+	dec_deadline = 0;
+	if (budget_us) {
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		dec_deadline = (uint64_t)now.QuadPart + (uint64_t)freq.QuadPart * budget_us / 1000000;
+	}
+	dec_budget_on = budget_us || budget_work ? _true_ : _false_;
+}
+
+/**
+ * \brief Проверка необходимости прервать разбор кадра по бюджету
+ * \details Первый тайл кадра разбирается при любом бюджете, чтобы в dec_budget_run было что корректировать
+ * \return _true_ - бюджет задан и исчерпан, и хотя бы один тайл уже разобран
+ */
+_bool_ dec_budget_stop()
+{
+	return dec_budget_on && dec_tiles_cnt && dec_budget_over();
+}
+
+/**
+ * \brief Построение списка кандидатов SOT от заданного места до конца кадра
+ * \details Строится один раз за кадр при первом поиске тайла. Пары байт FF 90 ищутся
+ * командами SSE2 по 16 позиций за шаг, затем кандидаты оцениваются и упорядочиваются
+ * по правдоподобию, так что RS-декодирование выполняется в первую очередь
+ * для наиболее вероятных заголовков тайлов. При исчерпании бюджета построение прерывается
+ * (бюджет проверяется через каждые 64 КБ), поиск по неполному списку затем не ведется.
+ * \param p Адрес, с которого нужно начать поиск
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
+ */
+errno_t dec_sot_index(uint8_t* p)
+{
+	const __m128i ff = _mm_set1_epi8((char)0xff), sot = _mm_set1_epi8((char)SOT_LOW);
+	size_t i, last, spacing = 0;
+	unsigned long bit;
+	int mask;
+
+	dec_sot_built = _true_;
+	if (in_len < 81 || (size_t)(p - in_buf) > in_len - 81)
+		return 0;
+	last = in_len - 81;			// последняя позиция, после которой есть 80 байт пре-данных + 1 байт
+	for (i = (size_t)(p - in_buf); i <= last; i += 16) {
+		if (!((i - (size_t)(p - in_buf)) & 0xffff) && dec_budget_stop())
+			return 0;
+		if (i + 16 <= last) {
+			mask = _mm_movemask_epi8(_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(in_buf + i)), ff),
+				_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(in_buf + i + 1)), sot)));
+		}
+		else {					// конец буфера
+			for (mask = 0, bit = 0; i + bit <= last; bit++)
+				if (in_buf[i + bit] == 0xff && in_buf[i + bit + 1] == SOT_LOW)
+					mask |= 1 << bit;
+		}
+		while (mask) {
+			_BitScanForward(&bit, mask);
+			mask &= mask - 1;
+			if (w_table_reserve(&dec_arena, (void**)&dec_sot, &dec_sot_cap, sizeof(sot_cand), dec_sot_cnt + 1))
+				return -1;
+			dec_sot[dec_sot_cnt].pos = (uint32_t)(i + bit);
+			dec_sot[dec_sot_cnt++].score = 0;
+		}
+	}
+	if (tile_count)				// ожидаемая длина тайла по уже разобранной части кадра
+		spacing = ((size_t)(p - in_buf) - mh_len) / tile_count;
+	for (i = 0; i < dec_sot_cnt; i++)
+		dec_sot[i].score = dec_sot_score(dec_sot[i].pos, spacing);
+	qsort(dec_sot, dec_sot_cnt, sizeof(sot_cand), dec_sot_compare);
+	return 0;
+}
+
+/**
+ * \brief Поиск тайла
+ * \details Начиная с адреса p, выбирает из списка кандидатов SOT (см. dec_sot_index)
+ * наиболее правдоподобный, у которого корректируются пре-данные первого EPB.
+ * Отвергнутые кандидаты запоминаются и при следующих поисках в этом кадре не проверяются.
+ * Поиск прекращается при исчерпании бюджета декодирования (см. dec_budget_stop).
+ * \param p  Адрес байта, с которого нужно начать поиск
+ * \return Fдрес байта, с которого начинается найденный тайл, у которого корректируются пре-данные первого EPB, или NULL
+ */
+uint8_t* dec_tile_search(uint8_t* p)
+{
+	size_t i, from = (size_t)(p - in_buf);
+
+	if (!dec_sot_built && dec_sot_index(p))
+		return NULL;
+	for (i = 0; i < dec_sot_cnt; i++) {
+		if (dec_sot[i].pos < from || dec_sot[i].score == DEC_SOT_REJECTED)
+			continue;
+		if (dec_budget_stop())
+			return NULL;
+		if (dec_sot_check(in_buf + dec_sot[i].pos))
+			return in_buf + dec_sot[i].pos;
+		dec_sot[i].score = DEC_SOT_REJECTED;
+	}
+	return NULL;
+}
+
+/**
+ * \brief Загрузка таблицы позиций тайлов из информативного метода EPC
+ * \details Таблица копируется в арену кадра, так как при сжатии на месте основной
+ * заголовок во входном буфере затирается раньше, чем разобраны тайлы.
+ * Таблица защищена вместе с EPC кодами EPB основного заголовка.
+ * \param pid Адрес данных Pid метода: количество тайлов и смещения маркеров SOT
+ * \param lid Длина данных Pid в байтах
+ * \return 0 - все нормально, -1 - таблица неверна или нет памяти
+ */
+errno_t dec_tile_pos_load(uint8_t* pid, uint16_t lid)
+{
+	uint16_t i, cnt;
+
+	if (lid < 2)
+		return -1;
+	cnt = _byteswap_ushort(*(uint16_t*)pid);
+	if (lid != 2 + 4 * (uint32_t)cnt)
+		return -1;
+	dec_tile_pos = (uint32_t*)w_arena_alloc(&dec_arena, cnt * sizeof(uint32_t) + 1);
+	if (!dec_tile_pos)
+		return -1;
+	for (i = 0; i < cnt; i++) {
+		dec_tile_pos[i] = _byteswap_ulong(*(uint32_t*)(pid + 2 + 4 * i));
+		if (i && dec_tile_pos[i] <= dec_tile_pos[i - 1]) {	// позиции должны возрастать
+			dec_tile_pos = NULL;
+			return -1;
+		}
+	}
+	dec_tile_pos_cnt = cnt;
+	return 0;
+}
+
+/**
+ * \brief Поиск в таблице позиций тайлов
+ * \param pos Позиция во входном буфере
+ * \return Индекс первого тайла таблицы, начинающегося не ранее pos
+ */
+uint16_t dec_tile_pos_find(size_t pos)
+{
+	uint32_t lo = 0, hi = dec_tile_pos_cnt, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (dec_tile_pos[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return (uint16_t)lo;
+}
+
+/**
+ * \brief Переход к следующему тайлу по таблице позиций тайлов
+ * \details Используется вместо поиска (dec_tile_search), когда в EPC есть таблица позиций:
+ * проверяются только позиции тайлов из таблицы, следующие за нераспознанным тайлом
+ * \param v Адрес нераспознанного тайла во входном буфере
+ * \return Адрес следующего тайла, у которого корректируются пре-данные первого EPB, или NULL
+ */
+uint8_t* dec_tile_jump(uint8_t* v)
+{
+	uint32_t lo;
+
+	for (lo = dec_tile_pos_find((size_t)(v - in_buf) + 1); lo < dec_tile_pos_cnt && (size_t)dec_tile_pos[lo] + 81 <= in_len && !dec_budget_stop(); lo++)
+		if (dec_sot_check(in_buf + dec_tile_pos[lo]))
+			return in_buf + dec_tile_pos[lo];
 	return NULL;
 }
 
@@ -228,56 +614,58 @@ uint8_t* dec_tile_search(uint8_t* p)
 uint8_t* dec_tile_detect(uint8_t* v)
 {
 	uint8_t* t;
+	uint16_t i;
 
 	if (in_len - (v - in_buf) < TILE_MINLENGTH)	// С точки обнаружения тайла недостаточно места для тайла
 		return NULL;
 	t = v;						// адрес предполагаемого начала тайла
-#ifndef RS_OPTIMIZED
-	if (old_rs_mode != 80) {	// последний код не RS(80,25)
-		init_rs(80, 25);
-		old_rs_mode = 80;
-	}; 
-	// пре-данные первого EPB заголовка тайла не корректируются!
-	// or после коррекции на месте нет маркера SOT (невероятно, но все же..)
-	if (decode_RS(v, v + 25, 80, 25) < 0 || *v != 0xff || *(v + 1) != SOT_LOW)
-#else
-	if (decode_RS(v, NULL, 80, 25) < 0 || *v != 0xff || *(v + 1) != SOT_LOW)
-#endif // !RS_OPTIMIZED 
-	{
-		if (v + 80 - in_buf < in_len)
+	// пре-данные первого EPB заголовка тайла не корректируются
+	// или после коррекции на месте нет маркера SOT
+	if (!dec_sot_check(v)) {
+		v = dec_tile_pos ? dec_tile_jump(v) : dec_tile_search(v + 80);
+		if (v == NULL && dec_budget_stop()) {	// поиск прерван по бюджету
+			dec_tail_abandon(t);
 			return NULL;
-
-		v = dec_tile_search(v + 80);
-		if (v == NULL || markers_cnt >= MAX_MARKERS)
+		}
+		if (v == NULL || DEC_MARKERS_FULL)
 			return NULL;
 		// тайл найден, пропущенный фрагмент заносим в dec_markers как BAD_ID
 		has_bad_blocks = _true_;
 		dec_markers[markers_cnt].id = BAD_ID;
-		bad_block_length += (uint32_t)(v - t);
+		bad_block_length += (size_t)(v - t);
 		dec_markers[markers_cnt].m.bad.Lbad = dec_markers[markers_cnt].len = (uint32_t)(v - t) - 2;
 		dec_markers[markers_cnt].tile_num = tile_count++;
-		dec_markers[markers_cnt++].pos_in = (uint32_t)(t - in_buf);
+		dec_markers[markers_cnt++].pos_in = (uint64_t)(t - in_buf);
+		if (dec_tile_pos) {			// номера пропущенных тайлов известны по таблице позиций
+			for (i = dec_tile_pos_find((size_t)(t - in_buf)); i < dec_tile_pos_cnt && dec_tile_pos[i] < (size_t)(v - in_buf); i++);
+			if (tile_count < i)
+				tile_count = i;
+		}
 	}
 	return v;
 }
 
 /**
  * \brief Обратная перестановка входного кодового потока
- * \details  Используется в случае применения внутрикадрового чередования на стороне кодера jpwl
- * \return Нет возвращаемого значения
+ * \details  Используется в случае применения внутрикадрового чередования на стороне кодера jpwl.
+ * Буфер перестановки берется из арены кадра, выходной буфер не затрагивается.
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
  */
-void deinterleave_instream()
+errno_t deinterleave_instream()
 {
-	uint8_t* c;
+	uint8_t* c, * imatrix;
 	uint16_t Lepb;
 	uint32_t Nc, Nr, i, j, k, Len, off;
 	uint32_t wait_epb, sot_start, sot_start_old, PSot;
 
-	Len = dec_epc_dl - mh_len;		// Длина переставляемых данных: общая длина минус основной заголовок
+	Len = (uint32_t)(in_len - mh_len);	// Длина переставляемых данных: общая длина минус основной заголовок
 	Nc = (uint32_t)ceil(sqrt((double)Len));	// Количество столбцов
 	Nr = (uint32_t)ceil(((double)Len / Nc));			// Количество строк
+	imatrix = (uint8_t*)w_arena_alloc(&dec_arena, Len);
+	if (!imatrix)
+		return -1;
 	k = 0;
-	c = out_buf;
+	c = imatrix;
 	for (j = 0; j < Nc; j++) {
 		for (i = 0; i < Nr; i++) {
 			*c++ = in_buf[mh_len + i * Nc + j];
@@ -287,8 +675,7 @@ void deinterleave_instream()
 	}
 
 mcop:
-	memcpy(in_buf + mh_len, out_buf, Len);
-	in_len = dec_epc_dl;
+	memcpy(in_buf + mh_len, imatrix, Len);
 	// Восстановление маркеров EPB и SOT и фрагментов их сегментов на основе таблицы EPB
 	wait_epb = sot_start = 0;
 	for (i = 0; i < tepb_count; i++, tepb_adr += 10) {
@@ -312,23 +699,22 @@ mcop:
 	};
 	PSot = in_len - sot_start - 2;
 	*(uint32_t*)(in_buf + sot_start + 6) = _byteswap_ulong(PSot); // Восстанавливаем PSot для последнего SOT
+	return 0;
 }
 
 
 /**
  * \brief Коррекция основного заголовка
- * \details ищет первый тайл, в котором корректируются пре-данные первого EPB заголовка тайла,
- * передвигает указатель *header на первый  байт найденного тайла.
- * Указателю по адресу header присваивается адрес первого тайла, у которого удалось
- * скорректировать пре-данные первого EPB в заголовке тайла или NULL, if такого тайла
- * не обнаружено.
+ * \details Указателю по адресу header присваивается адрес байта, следующего за основным заголовком,
+ * т.е. предполагаемый адрес первого тайла. Обратная перестановка (Ammendment) и распознавание
+ * первого тайла выполняются вызывающей стороной.
+ * Код -7 позволяет потоковому декодеру повторить коррекцию после получения остальной части заголовка.
  * Коды завершения:
  * 1 - нет средств jpwl, коррекция потока не производится
  * 0 - заголовок скорректирован
  * -1 - заголовок не корректируется
  * -2 - кодовый поток неправильный
- * -3 - используются не поддерживаемые информативные методы
- * -4 - есть RED, которых не должно быть
+ * -3 - используются не поддерживаемые информативные методы или неверная таблица позиций тайлов
  * -5 - несоответствие информации о ESD в EPC и присутствием/отсутствием ESD
  * -7 - основной заголовок длиннее входного буфера
  * -8 - неверная контрольная сумма в EPC
@@ -340,13 +726,15 @@ errno_t dec_mh_correct(addr_char* header)
 {
 	uint8_t* p, * epb_start, * data_start, * epc_start, * esd_start, * v, Pepc, * inf_met;
 	uint8_t p_data[96];
-	uint16_t epb_len, epc_len, esd_len, Pcrc, id;
+	uint16_t epb_len, epc_len, esd_len, Pcrc, id, lid;
 	int rs_ret;
 	uint32_t siz_len, pre_l, prot_l, cur_len;
 	epb_ms* e;
 	epc_ms* ec;
 
 	p = in_buf;				// адрес основоного заголовка
+	if (w_table_reserve(&dec_arena, (void**)&dec_markers, &dec_markers_cap, sizeof(w_marker), 3))	// EPB, EPC и ESD основного заголовка
+		return -2;
 	esd_used = _false_;
 	epb_used = _false_;
 	is_ammendment = _false_;
@@ -453,8 +841,6 @@ errno_t dec_mh_correct(addr_char* header)
 	dec_markers[0].tile_num = -1;		// основной заголовок
 	dec_markers[0].pos_in = pre_l - EPB_LN - 2;	// позиция во входном буфере
 	dec_markers[0].len = epb_len;	// длина сегмента
-	if (markers_cnt >= MAX_MARKERS)
-		return -2;
 	markers_cnt++;
 
 	// вычисляем длину основного заголовка
@@ -469,12 +855,16 @@ errno_t dec_mh_correct(addr_char* header)
 	if (epc_len + 2UL >= mh_len - cur_len)	// неправдоподобная длина EPC
 		return -2;
 
-	memcpy(out_buf, epc_start, 4);
-	memcpy(out_buf + 4, epc_start + 6, epc_len - 4ULL);
-	Pcrc = CRC16(out_buf, epc_len);
+	v = (uint8_t*)w_arena_alloc(&dec_arena, epc_len);	// сегмент EPC без поля Pcrc для проверки CRC
+	if (!v)
+		return -2;
+	memcpy(v, epc_start, 4);
+	memcpy(v + 4, epc_start + 6, epc_len - 4ULL);
+	Pcrc = CRC16(v, epc_len);
 	if (Pcrc == _byteswap_ushort(*(uint16_t*)(epc_start + 4))) {
 		dec_epc_dl = _byteswap_ulong(*(uint32_t*)(epc_start + 6));
-		in_len = dec_epc_dl;			// длина кодового потока
+		if (dec_epc_dl)				// DL = 0 - длина неизвестна (потоковый кодер), используется длина принятых данных
+			in_len = dec_epc_dl;		// длина кодового потока
 		Pepc = *(epc_start + 10);
 		if (Pepc & 0x10)	// есть ESD
 			esd_used = _true_;
@@ -484,16 +874,25 @@ errno_t dec_mh_correct(addr_char* header)
 			epb_used = _true_;
 		else
 			epb_used = _false_;
-		if (Pepc & 0x20)	// есть RED
-			return -4;
-		if (Pepc & 0x80) {	// есть Ammendment
-			inf_met = epc_start + EPC_LN + 2;
-			id = _byteswap_ushort(*(uint16_t*)inf_met);
-			if (id != 0x0200)
-				return -3;
-			is_ammendment = _true_;
-			tepb_count = _byteswap_ushort(*(uint16_t*)(inf_met + 4));
-			tepb_adr = inf_met + 6;		// Адрес записи о первом EPB
+		// Pepc & 0x20: в потоке уже есть RED, их сегменты остаются в заголовках тайлов без изменений
+		if (Pepc & 0x80) {	// есть информативные методы
+			for (inf_met = epc_start + EPC_LN + 2; inf_met + 4 <= epc_start + epc_len + 2; inf_met += 4 + lid) {
+				id = _byteswap_ushort(*(uint16_t*)inf_met);
+				lid = _byteswap_ushort(*(uint16_t*)(inf_met + 2));
+				if (inf_met + 4 + lid > epc_start + epc_len + 2)	// Pid выходит за пределы EPC
+					return -3;
+				if (id == INF_AMMENDMENT_ID) {
+					is_ammendment = _true_;
+					tepb_count = _byteswap_ushort(*(uint16_t*)(inf_met + 4));
+					tepb_adr = inf_met + 6;		// Адрес записи о первом EPB
+				}
+				else if (id == INF_TILE_POS_ID) {
+					if (dec_tile_pos_load(inf_met + 4, lid))
+						return -3;
+				}
+				else
+					return -3;
+			}
 		}
 	}
 	else
@@ -504,12 +903,9 @@ errno_t dec_mh_correct(addr_char* header)
 	ec->epb_on = epb_used;
 	ec->DL = dec_epc_dl;
 	dec_markers[1].tile_num = -1;			// осн. заголовок
-	dec_markers[1].pos_in = (uint32_t)(epc_start - p);	// смещение отн. начала входного буфера
+	dec_markers[1].pos_in = (uint64_t)(epc_start - p);	// смещение отн. начала входного буфера
 	dec_markers[1].len = epc_len;		// длина сегмента без маркера
 	mh_tile_len -= dec_markers[1].len + 2;		// длинa основного занголовка - отнимаем длину EPC
-
-	if (markers_cnt >= MAX_MARKERS)
-		return -2;
 	markers_cnt++;
 	cur_len += epc_len + 2;	// длина разобранного участка
 
@@ -531,22 +927,11 @@ errno_t dec_mh_correct(addr_char* header)
 		dec_markers[2].id = ESD_MARKER;		// идентификатор
 		dec_markers[2].len = dec_markers[2].m.esd.Lesd = esd_len;	// длина сегмента
 		dec_markers[2].tile_num = -1;		// осн. заголовок
-		dec_markers[2].pos_in = (uint32_t)(esd_start - p);	// смещение начала ESD отн. начала входного буфера
+		dec_markers[2].pos_in = (uint64_t)(esd_start - p);	// смещение начала ESD отн. начала входного буфера
 		mh_tile_len -= dec_markers[2].len + 2;		// Вычисляем длину основного занголовка - отнимаем длину ESD
-		if (markers_cnt >= MAX_MARKERS)
-			return -2;
 		markers_cnt++;
 	};
-	// Если использован Ammendment, выполняем обратную перестановку
-	if (is_ammendment)
-		deinterleave_instream();
-
-	// поиск первого тайла
-	v = p + mh_len;			// адрес первого тайла после осн. заголовка
-	if (in_len <= v - in_buf)
-		return -1;
-	v = dec_tile_detect(v);
-	*header = v;	// адрес первого тайла или NULL при отсутствии
+	*header = p + mh_len;	// адрес первого тайла после осн. заголовка
 	return 0;
 }
 
@@ -566,7 +951,7 @@ errno_t tile_preEPB_correct(uint8_t* tile, uint32_t* data_offset)
 	*data_offset = SOT_LN + 2;		// длина сегмента SOT + маркер
 	v = tile + *data_offset;		// адрес первого EPB
 	while (1) { // цикл по блокам EPB в заголовке тайла
-		if (markers_cnt >= MAX_MARKERS)
+		if (DEC_MARKERS_FULL)
 			return -1;
 		// поскольку заголовок EPB уже скорректирован, создаем запись о нем в dec_markers
 		dec_markers[markers_cnt].id = EPB_MARKER;
@@ -574,7 +959,7 @@ errno_t tile_preEPB_correct(uint8_t* tile, uint32_t* data_offset)
 		epb_l = _byteswap_ushort(*(uint16_t*)(v + 2)); // длина сегмента EPB
 		*data_offset += epb_l + 2;				// длинa сегмента EPB + маркер
 		dec_markers[markers_cnt].len = e->Lepb = epb_l;
-		dec_markers[markers_cnt].pos_in = (uint32_t)(v - in_buf);	// смещение отн. начала входного буфера
+		dec_markers[markers_cnt].pos_in = (uint64_t)(v - in_buf);	// смещение отн. начала входного буфера
 		dec_markers[markers_cnt++].tile_num = tile_count;	// индекс тайла
 
 		e->index = (uint8_t)(i & 0x3f);				// индекс блока EPB в заголовке
@@ -616,20 +1001,214 @@ errno_t tile_preEPB_correct(uint8_t* tile, uint32_t* data_offset)
 	return 0;
 }
 
+/**
+ * \brief Создание сегмента RED для частично восстановленного тайла
+ * \details Сегмент занимает зарезервированную для него запись dec_markers и выводится
+ * сразу за сегментом SOT вместо удаляемых сегментов EPB и ESD. Он не должен быть длиннее их,
+ * чтобы выходной поток не опережал входной (при избытке интервалов последние из них объединяются).
+ * \param rec  Адрес записи о тайле
+ * \param red_first  Номер первого интервала тайла в dec_red
+ * \return Длина сегмента RED вместе с маркером, 0 - сегмент не создан
+ */
+uint32_t dec_red_create(tile_rec* rec, size_t red_first)
+{
+	size_t n, max_n;
+	uint32_t seg_len;
+	w_marker* m;
+
+	n = dec_red_cnt - red_first;
+	if (!n || !rec->red_slot || rec->tilemark_ln < RED_LN + 2 + REDINT_LN) {
+		dec_red_cnt = red_first;
+		return 0;
+	}
+	max_n = (rec->tilemark_ln - RED_LN - 2) / REDINT_LN;
+	if (n > max_n) {			// объединяем лишние интервалы с последним допустимым
+		dec_red[red_first + max_n - 1].end = dec_red[dec_red_cnt - 1].end;
+		n = max_n;
+		dec_red_cnt = red_first + n;
+	}
+	seg_len = RED_LN + 2 + (uint32_t)n * REDINT_LN;
+	m = &dec_markers[rec->red_slot];
+	m->id = RED_MARKER;
+	m->m.red.Pred = RED_PRED;
+	m->m.red.interv_start = (uint32_t)red_first;
+	m->m.red.interv_cnt = (uint16_t)n;
+	// смещение в выходном потоке: позиция во входном - начало тайла - удаляемые сегменты + сегмент RED
+	m->m.red.shift = rec->pos + rec->tilemark_ln - seg_len;
+	m->len = seg_len - 2;
+	dec_red_used = _true_;
+	return seg_len;
+}
+
+/**
+ * \brief Дополнение таблицы чувствительности нулевыми записями до заданного тайла
+ * \param tiles  Количество тайлов, которое должно быть в dec_sens_tiles
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
+ */
+errno_t dec_sens_pad(uint16_t tiles)
+{
+	if (w_table_reserve(NULL, (void**)&dec_sens_tiles, &dec_sens_tiles_cap, sizeof(uint16_t), tiles))
+		return -1;
+	for (; dec_sens_tiles_cnt < tiles; dec_sens_tiles_cnt++)
+		dec_sens_tiles[dec_sens_tiles_cnt] = 0;
+	return 0;
+}
+
+/**
+ * \brief Наибольшая чувствительность, указанная в сегментах ESD тайла
+ * \details Учитываются режимы адресации ESD: пакетный, байтовый диапазон и диапазон пакетов.
+ * Из двухбайтовых значений чувствительности берется старший байт. Все значения тайла
+ * заносятся в dec_sens для выдачи в jpwl_dec_bResults; при нехватке памяти для таблицы
+ * значения тайла не выдаются.
+ * \param tile  Порядковый номер тайла
+ * \param first  Индекс первого ESD тайла в dec_markers
+ * \param end  Индекс, следующий за последним ESD тайла
+ * \return Чувствительность тайла (0 - ESD нет)
+ */
+uint8_t dec_esd_sens(uint16_t tile, uint32_t first, uint32_t end)
+{
+	uint8_t* p, * e, Pesd, sens = 0;
+	uint32_t entry, skip;
+	size_t cnt = dec_sens_cnt;
+	_bool_ table = dec_sens_pad(tile + 1) == 0;
+
+	for (; first < end; first++) {
+		p = in_buf + dec_markers[first].pos_in;
+		e = p + dec_markers[first].len + 2;		// конец сегмента
+		Pesd = p[6];
+		skip = (Pesd >> 6) == 0 ? 0 : (Pesd & 0x02 ? 8 : 4);	// адреса начала и конца: по 2 или 4 байта
+		entry = skip + (Pesd & 0x04 ? 2 : 1);
+		if (table && w_table_reserve(NULL, (void**)&dec_sens, &dec_sens_cap, 1, cnt + (e > p + 7 ? (e - p - 7) / entry : 0)))
+			table = _false_;
+		for (p += 7; p + entry <= e; p += entry) {
+			if (p[skip] > sens)
+				sens = p[skip];
+			if (table)
+				dec_sens[cnt++] = p[skip];
+		}
+	}
+	if (table && cnt - dec_sens_cnt <= 0xffff) {
+		dec_sens_tiles[tile] = (uint16_t)(cnt - dec_sens_cnt);
+		dec_sens_cnt = cnt;
+	}
+	return sens;
+}
+
+/**
+ * \brief Коррекция пост-данных EPB, защищающих данные тайла
+ * \details Заголовок тайла уже скорректирован в dec_tile_correct. Формирует сегмент RED
+ * для частично восстановленного тайла и заносит в сегмент SOT длину тайла после удаления
+ * сегментов jpwl.
+ * \param rec  Адрес записи о тайле
+ */
+void dec_tile_data_correct(tile_rec* rec)
+{
+	uint8_t* tile = in_buf + rec->pos, * u;
+	uint32_t i, badparts = 0, tilemark_ln = rec->tilemark_ln;
+	size_t red_first = dec_red_cnt;
+
+	u = tile + SOT_LN + 2;		// начало пост-данных первого EPB - за всеми EPB заголовка
+	for (i = rec->mark_first; i < rec->mark_end; i++)
+		u += dec_markers[i].len + 2;
+	u += dec_markers[rec->mark_first].m.epb.post_len;	// адрес начала защищенных данных следующего EPB
+	for (i = rec->mark_first + 1; i < rec->mark_end; i++) { // обработка всех последующих EPB, защищающих данные
+		badparts += postEPB_correct(in_buf + dec_markers[i].pos_in, u, 13);
+		u += dec_markers[i].m.epb.post_len;	// вычисляем адрес начала защищенных данных следующего EPB
+	}
+	if (badparts > 0) {
+		tile_red_rest_cnt++;		// Инкремент частично восстановленных тайлов
+		tilemark_ln -= dec_red_create(rec, red_first);	// сегмент RED остается в заголовке
+		rec->state = DEC_TILE_PART;
+	}
+	else {
+		tile_all_rest_cnt++;		// Инкремент полностью восстановленных тайлов
+		rec->state = DEC_TILE_FULL;
+	}
+	rec->sot_l -= tilemark_ln;		// новая длина тайла, которая будет после удаления сегментов
+	*(uint32_t*)(tile + 6) = _byteswap_ulong(rec->sot_l); // заносим новую длину в сегмент SOT во входной буфер
+}
+
+/**
+ * \brief Подготовка таблицы позиций тайлов кадра
+ * \details Количество тайлов определяется по скорректированному сегменту SIZ основного заголовка.
+ * Позиции заносятся по номеру тайла Isot из его сегмента SOT, а не по порядку тайлов в потоке,
+ * так как BAD-блок, найденный при поиске тайла, может поглотить несколько тайлов.
+ * Если сегмент SIZ не разбирается, таблица не заполняется
+ */
+void dec_tile_out_init()
+{
+	uint8_t* siz = in_buf + 2;
+	uint32_t x, y, xt, yt, xto, yto;
+	uint64_t total;
+
+	if (in_len < 2 + 38 || siz[0] != 0xff || siz[1] != SIZ_LOW)
+		return;
+	x = _byteswap_ulong(*(uint32_t*)(siz + 6));		// Xsiz
+	y = _byteswap_ulong(*(uint32_t*)(siz + 10));	// Ysiz
+	xt = _byteswap_ulong(*(uint32_t*)(siz + 22));	// XTsiz
+	yt = _byteswap_ulong(*(uint32_t*)(siz + 26));	// YTsiz
+	xto = _byteswap_ulong(*(uint32_t*)(siz + 30));	// XTOsiz
+	yto = _byteswap_ulong(*(uint32_t*)(siz + 34));	// YTOsiz
+	if (!xt || !yt || x <= xto || y <= yto)
+		return;
+	total = (uint64_t)((x - xto - 1) / xt + 1) * ((y - yto - 1) / yt + 1);
+	if (total > 0xffff)			// Isot - 16-битный
+		return;
+	dec_tile_out = (size_t*)w_arena_alloc(&dec_arena, (size_t)total * sizeof(size_t));
+	if (!dec_tile_out)
+		return;
+	memset(dec_tile_out, 0, (size_t)total * sizeof(size_t));
+	dec_tiles_total = (uint32_t)total;
+}
+
+/**
+ * \brief Учет скорректированного тайла в длине выходного потока
+ * \details Вызывается в порядке следования тайлов в потоке
+ * \param rec  Адрес записи о тайле
+ */
+void dec_tile_place(tile_rec* rec)
+{
+	if (rec->state == DEC_TILE_FULL && rec->isot < dec_tiles_total)	// позиция тайла в выходном потоке (без EPC)
+		dec_tile_out[rec->isot] = mh_tile_len;
+	mh_tile_len += rec->sot_l;
+}
+
+/**
+ * \brief Заполнение таблицы позиций тайлов по завершении кадра
+ * \details Тайлы, не восстановленные полностью, получают позицию 0. При использовании RED
+ * остальным заносится позиция в выходном потоке с учетом EPC, оставшегося в основном заголовке,
+ * без RED их позиции, заданные вызывающей стороной, не изменяются
+ */
+void dec_tile_positions_fill()
+{
+	uint32_t i;
+
+	for (i = 0; i < dec_tiles_total; i++) {
+		if (!dec_tile_out[i])
+			_tile_positions[i] = 0;
+		else if (dec_use_red)
+			_tile_positions[i] = dec_tile_out[i] + (dec_red_used ? EPC_LN + 2 : 0);
+	}
+}
+
 /**
  * \brief Коррекция тайла
+ * \details Корректирует заголовок тайла. Данные тайла корректируются сразу же,
+ * а при заданном бюджете декодирования - позже, в dec_budget_run, в порядке чувствительности тайлов.
  * \param tile  Адрес первого байта тайла where скорректированы пре-данные первого EPB, т.е. сегмент SOT - правильный
  * \return Адрес первого байта следующего тайла, у которого скорректировались пре-данные первого EPB, или NULL
  */
 uint8_t* dec_tile_correct(uint8_t* tile)
 {
-	uint8_t* v, * u, * w;
-	uint16_t mark_count_old, i;
-	uint32_t sot_l, d_off, l, tilemark_ln, sot_l_new, rr, badparts = 0;
+	uint8_t* u, * w;
+	uint16_t mark_count_old;
+	uint32_t sot_l, d_off, badparts = 0;
+	size_t rr, red_first;
+	tile_rec rec;
 
-	tilemark_ln = 0;						// длина всех удаляемых из заголовка тайла сегментов
 	sot_l = _byteswap_ulong(*(uint32_t*)(tile + 6)); // извлекаем длину тайла
 	mark_count_old = markers_cnt;			// запоминаем счетчик маркеров для возможного отката массива dec_markers
+	red_first = dec_red_cnt;				// и счетчик интервалов RED
 	errno_t err_c = tile_preEPB_correct(tile, &d_off);
 
 	if (!err_c) {
@@ -637,72 +1216,68 @@ uint8_t* dec_tile_correct(uint8_t* tile)
 		badparts = postEPB_correct(in_buf + dec_markers[mark_count_old].pos_in, u, 25);
 	}
 	if (err_c || badparts > 0) {
-		if (markers_cnt >= MAX_MARKERS)
+		markers_cnt = mark_count_old;		// откат счетчика маркеров
+		dec_red_cnt = red_first;
+		if (DEC_MARKERS_FULL)
 			return NULL;
 		has_bad_blocks = _true_;
-		_tile_positions[tile_count] = 0;
 
-		markers_cnt = mark_count_old;		// откат счетчика маркеров
 		dec_markers[markers_cnt].id = BAD_ID;	// создаем bad блок размером с тайл
 		bad_block_length += sot_l;
 		dec_markers[markers_cnt].len = dec_markers[markers_cnt].m.bad.Lbad = sot_l - 2; // длина bad блока
 		dec_markers[markers_cnt].tile_num = tile_count++;	// BAD-блок нумеруется как тайл
-		dec_markers[markers_cnt++].pos_in = (uint32_t)(tile - in_buf);	// позиция блока - начало тайла
+		dec_markers[markers_cnt++].pos_in = (uint64_t)(tile - in_buf);	// позиция блока - начало тайла
 	}
 	else {					
-		// заголовок тайла скорректирован, приступаем к данным
-		v = tile + SOT_LN + 2 + 5;		// адрес LDPepb первого EPB: сегмент SOT + маркер SOT + смещение LDPepb
-		tilemark_ln += dec_markers[mark_count_old].len + 2;	// добавляем длину сегмента первого EPB
-		u += dec_markers[mark_count_old].m.epb.post_len;	// адрес начала защищенных данных следующего EPB
-		for (i = mark_count_old + 1; i < markers_cnt; i++) { // обработка всех последующих EPB, защищающих данные
-			tilemark_ln += dec_markers[i].len + 2;
-			badparts = postEPB_correct(in_buf + dec_markers[i].pos_in, u, 13);
-			switch (dec_markers[i].m.epb.hprot) {			// вычисляем длину блока пост-данных
-			case 16:									
-			case 32:	l = dec_markers[i].m.epb.post_len; // crc-16 или crc-32 - все данные
-				break;
-			case 160:	l = 64;	// для RS-кодов - длина кодируемого фрагмента
-				break;
-			case 80:	l = 25;
-				break;
-			case 40:	l = 13;
-				break;
-			default:	l = 32;
-			};
-
-			d_off = (uint32_t)(u - tile);	// смещение начала пост-данных EPB отн. начала тайла
-			u += dec_markers[i].m.epb.post_len;	// вычисляем адрес начала защищенных данных следующего EPB
-		};
+		// заголовок тайла скорректирован, данные корректируются в dec_tile_data_correct
+		rec.pos = (uint32_t)(tile - in_buf);
+		rec.sot_l = sot_l;
+		rec.tile_num = tile_count;
+		rec.isot = _byteswap_ushort(*(uint16_t*)(tile + 4));	// сегмент SOT скорректирован
+		rec.mark_first = mark_count_old;
+		rec.mark_end = markers_cnt;
+		rec.tilemark_ln = d_off - (SOT_LN + 2);		// длина всех сегментов EPB
+		rec.state = DEC_TILE_WAIT;
 		// разбор маркеров ESD
 		while (*w == 0xff && *(w + 1) == ESD_LOW) { // обработка очередного маркера ESD
-			if (markers_cnt >= MAX_MARKERS)
+			if (DEC_MARKERS_FULL)
 				return NULL;
 			dec_markers[markers_cnt].id = ESD_MARKER;	// ид. маркера
 			dec_markers[markers_cnt].len = dec_markers[markers_cnt].m.esd.Lesd = _byteswap_ushort(*(uint16_t*)(w + 2));
-			tilemark_ln += dec_markers[markers_cnt].len + 2;	// добавляем длину сегмента ESD
+			rec.tilemark_ln += dec_markers[markers_cnt].len + 2;	// добавляем длину сегмента ESD
 			dec_markers[markers_cnt].tile_num = tile_count; //  индекс разобранного тайла
-			dec_markers[markers_cnt].pos_in = (uint32_t)(w - in_buf);		// позиция во входном буфере
+			dec_markers[markers_cnt].pos_in = (uint64_t)(w - in_buf);		// позиция во входном буфере
 			w += dec_markers[markers_cnt++].len + 2ULL;		// переводим адрес на потенциально следующий ESD
 		};
-
-		if (badparts > 0) {
-			tile_red_rest_cnt++;		// Инкремент частично восстановленных тайлов
-			_tile_positions[tile_count] = 0;
+		rec.sens = dec_esd_sens(tile_count, rec.mark_end, markers_cnt);
+		rec.red_slot = 0;
+		if (dec_use_red) {		// место для сегмента RED - последним в группе маркеров тайла
+			if (DEC_MARKERS_FULL)
+				return NULL;
+			rec.red_slot = markers_cnt;
+			dec_markers[markers_cnt].id = 0;
+			dec_markers[markers_cnt].len = 0;
+			dec_markers[markers_cnt].tile_num = tile_count;
+			dec_markers[markers_cnt++].pos_in = (uint64_t)(tile + SOT_LN + 2 - in_buf);
 		}
-		else
-			tile_all_rest_cnt++;		// Инкремент полностью восстановленных тайлов
-		
+		rec.group_end = markers_cnt;
 		tile_count++;
-		sot_l_new = sot_l - tilemark_ln;	// вычисляем новую длину тайла, которая будет после удаления сегментов
-		mh_tile_len += sot_l_new;
-		*(uint32_t*)(tile + 6) = _byteswap_ulong(sot_l_new); // заносим новую длину в сегмент SOT во входной буфер
+		if (dec_budget_on) {		// коррекция данных откладывается до разбора всех тайлов
+			if (w_table_reserve(&dec_arena, (void**)&dec_tiles, &dec_tiles_cap, sizeof(tile_rec), dec_tiles_cnt + 1))
+				return NULL;
+			dec_tiles[dec_tiles_cnt++] = rec;
+		}
+		else {
+			dec_tile_data_correct(&rec);
+			dec_tile_place(&rec);
+		}
 	}
 
 	// ищем следующий тайл, у которого корректируютcя пре-данные первого EPB
 	tile += sot_l;				// адрес начала следующего тайла
 	if (tile - in_buf > in_len)
 		return NULL;
-	rr = in_len - (uint32_t)(tile - in_buf);	// кол-во байт до конца входного буфера
+	rr = in_len - (size_t)(tile - in_buf);	// кол-во байт до конца входного буфера
 
 	u = tile; // началo поиска
 	if (rr > 80)
@@ -710,41 +1285,112 @@ uint8_t* dec_tile_correct(uint8_t* tile)
 	else if (rr <= 2)
 		return NULL;
 	if (tile == NULL || (rr < 81 && rr > 2)) {
-		if (markers_cnt >= MAX_MARKERS)
+		if (DEC_MARKERS_FULL)
 			return NULL;
 		has_bad_blocks = _true_;
 		dec_markers[markers_cnt].id = BAD_ID;	// создаем bad блок размером с тайл
 		bad_block_length += rr - 2;
-		dec_markers[markers_cnt].len = rr - 4; // длина bad блока
+		dec_markers[markers_cnt].len = (uint32_t)rr - 4; // длина bad блока
 		dec_markers[markers_cnt].tile_num = tile_count++;	
-		dec_markers[markers_cnt++].pos_in = (uint32_t)(u - in_buf);	// позиция блока - начало тайла
+		dec_markers[markers_cnt++].pos_in = (uint64_t)(u - in_buf);	// позиция блока - начало тайла
 		return NULL;
 	}
 	return tile;
 }
 
 /**
- * \brief Копирование данных в выходной буфер
- * \details Выполняет копирование скорректированных данных в выходной буфер.
- * При этом из кодового потока удаляются сегменты маркеров EPB, EPC и ESD.
- * \return Длина выходного буфера
+ * \brief Начало копирования данных кадра в выходной буфер
  */
-uint32_t dec_data_copy()
+void dec_copy_reset()
 {
-	int epc_pos = 0, t_no = -2; // начальный индекс заголовка
-	uint32_t i, j, out_len = 0;
+	dec_out_len = 0;
+	dec_copy_pos = 0;
+	dec_copy_mark = 0;
+	dec_copy_tno = -2;		// начальный индекс заголовка
+}
 
-	for (i = j = 0; i < markers_cnt; i++) {
-		if (dec_markers[i].tile_num != t_no) {	// первый маркер очередного заголовка
-			t_no = dec_markers[i].tile_num;	// запомним индекс этого заголовка
-			for (; j < dec_markers[i].pos_in; j++) // копируем данные, предшествующие найденному маркеру
-				out_buf[out_len++] = in_buf[j]; // в выходной буфер
+/**
+ * \brief Вывод сегмента RED в выходной буфер
+ * \param m  Адрес записи о сегменте RED в dec_markers
+ */
+void dec_red_write(w_marker* m)
+{
+	uint8_t* o = out_buf + dec_out_len;
+	red_interval* r = dec_red + m->m.red.interv_start;
+	uint16_t k;
+
+	o[0] = 0xFF;
+	o[1] = RED_LOW;
+	*(uint16_t*)(o + 2) = _byteswap_ushort((uint16_t)m->len);
+	o[4] = m->m.red.Pred;
+	o += RED_LN + 2;
+	for (k = 0; k < m->m.red.interv_cnt; k++, r++, o += REDINT_LN) {
+		*(uint32_t*)o = _byteswap_ulong(r->start - m->m.red.shift);
+		*(uint32_t*)(o + 4) = _byteswap_ulong(r->end - m->m.red.shift);
+		*(uint16_t*)(o + 8) = _byteswap_ushort(r->errors);
+	}
+	dec_out_len += m->len + 2ULL;
+}
+
+/**
+ * \brief Копирование очередной части данных в выходной буфер
+ * \details Переносит в выходной буфер входные данные от места, на котором остановился
+ * предыдущий вызов, до позиции in_end, пропуская сегменты маркеров jpwl и невосстановимые блоки,
+ * записанные в dec_markers. Позволяет выдавать выходной поток по мере коррекции тайлов.
+ * Выходная позиция никогда не опережает входную, поэтому выходным буфером может служить
+ * сам входной буфер (сжатие на месте).
+ * \param in_end Позиция во входном буфере, до которой следует скопировать данные
+ */
+void dec_copy_until(size_t in_end)
+{
+	uint32_t i;
+	size_t j = dec_copy_pos;
+
+	for (i = dec_copy_mark; i < markers_cnt && dec_markers[i].pos_in < in_end; i++) {
+		if (dec_markers[i].tile_num != dec_copy_tno) {	// первый маркер очередного заголовка
+			dec_copy_tno = dec_markers[i].tile_num;	// запомним индекс этого заголовка
+			if (j < dec_markers[i].pos_in) {	// копируем данные, предшествующие найденному маркеру
+				memmove(out_buf + dec_out_len, in_buf + j, (size_t)dec_markers[i].pos_in - j);
+				dec_out_len += (size_t)dec_markers[i].pos_in - j;
+				j = (size_t)dec_markers[i].pos_in;
+			}
+		}
+		if (dec_markers[i].id == RED_MARKER) {	// сегмент RED не занимает места во входном буфере
+			dec_red_write(&dec_markers[i]);
+			continue;
+		}
+		if (!dec_markers[i].id)		// неиспользованная запись
+			continue;
+		if (dec_markers[i].id == EPC_MARKER && dec_red_used) {	// место для EPC, заполняется в dec_data_copy
+			dec_epc_out = dec_out_len;
+			dec_out_len += EPC_LN + 2;
 		}
 		j += dec_markers[i].len + 2;
 	}
-	if (j < in_len)
-		memcpy_s(out_buf + out_len, (size_t)in_len - j, in_buf + j, (size_t)in_len - j);
+	if (j < in_end) {
+		memmove(out_buf + dec_out_len, in_buf + j, in_end - j);
+		dec_out_len += in_end - j;
+		j = in_end;
+	}
+	dec_copy_mark = i;
+	dec_copy_pos = j;
+}
 
+/**
+ * \brief Копирование данных в выходной буфер
+ * \details Выполняет копирование скорректированных данных в выходной буфер.
+ * При этом из кодового потока удаляются сегменты маркеров EPB, EPC и ESD.
+ * Если вставлены сегменты RED, в основном заголовке остается EPC с Pepc = 0x20.
+ * Данные, уже перенесенные dec_copy_until, повторно не копируются.
+ * \return Длина выходного буфера
+ */
+size_t dec_data_copy()
+{
+	size_t out_len;
+	uint8_t* p;
+
+	dec_copy_until(in_len);
+	out_len = dec_out_len;
 	if (mh_tile_len > out_len) {	// Сумма длин основного заголовка и всех тайлов больше расчетной
 		out_len = mh_tile_len + 2;	// Увеличиваем длину выходного потока
 		out_buf[out_len - 2] = 0xFF;	// Вставляем потерянный маркер конца кодового потока
@@ -754,9 +1400,138 @@ uint32_t dec_data_copy()
 		out_buf[out_len - 2] = 0xFF;
 		out_buf[out_len - 1] = EOC_LOW;
 	}
+	if (dec_red_used) {		// EPC: длина потока известна только сейчас
+		p = out_buf + dec_epc_out;
+		p[0] = 0xFF;
+		p[1] = EPC_LOW;
+		*(uint16_t*)(p + 2) = _byteswap_ushort(EPC_LN);
+		*(uint32_t*)(p + 6) = _byteswap_ulong((uint32_t)out_len);
+		p[10] = 0x20;			// присутствуют RED
+		memcpy(rs_data, p, 4);
+		memcpy(rs_data + 4, p + 6, EPC_LN - 4);
+		*(uint16_t*)(p + 4) = _byteswap_ushort(CRC16(rs_data, EPC_LN));
+	}
+	dec_out_len = out_len;
 	return out_len;
 }
 
+/**
+ * \brief Порядок коррекции тайлов: по убыванию чувствительности, затем по порядку в потоке
+ */
+int dec_tile_rank(const void* a, const void* b)
+{
+	const tile_rec* x = (const tile_rec*)a;
+	const tile_rec* y = (const tile_rec*)b;
+
+	if (x->sens != y->sens)
+		return x->sens > y->sens ? -1 : 1;
+	return x->pos < y->pos ? -1 : (x->pos > y->pos);
+}
+
+/**
+ * \brief Порядок следования тайлов в потоке
+ */
+int dec_tile_order(const void* a, const void* b)
+{
+	const tile_rec* x = (const tile_rec*)a;
+	const tile_rec* y = (const tile_rec*)b;
+
+	return x->pos < y->pos ? -1 : (x->pos > y->pos);
+}
+
+/**
+ * \brief Отказ от коррекции тайла по исчерпании бюджета
+ * \details Первая запись группы маркеров тайла превращается в BAD-блок размером с тайл,
+ * остальные записи группы помечаются неиспользованными
+ * \param rec  Адрес записи о тайле
+ */
+void dec_tile_abandon(tile_rec* rec)
+{
+	uint32_t i;
+
+	has_bad_blocks = _true_;
+	bad_block_length += rec->sot_l;
+	dec_skip_length += rec->sot_l;
+	dec_skip_cnt++;
+	dec_markers[rec->mark_first].id = BAD_ID;
+	dec_markers[rec->mark_first].len = dec_markers[rec->mark_first].m.bad.Lbad = rec->sot_l - 2;
+	dec_markers[rec->mark_first].pos_in = rec->pos;
+	for (i = rec->mark_first + 1; i < rec->group_end; i++)
+		dec_markers[i].id = 0;
+}
+
+/**
+ * \brief Коррекция данных тайлов в пределах бюджета
+ * \details Тайлы корректируются в порядке убывания чувствительности из ESD (без ESD - в порядке
+ * следования в потоке), пока бюджет не исчерпан. Первый по порядку коррекции тайл корректируется
+ * при любом бюджете, так что кадр не остается пустым. Остальные тайлы исключаются из выходного потока
+ * как BAD-блоки.
+ */
+void dec_budget_run()
+{
+	size_t i;
+
+	qsort(dec_tiles, dec_tiles_cnt, sizeof(tile_rec), dec_tile_rank);
+	for (i = 0; i < dec_tiles_cnt && (!i || !dec_budget_over()); i++)
+		dec_tile_data_correct(&dec_tiles[i]);
+	qsort(dec_tiles, dec_tiles_cnt, sizeof(tile_rec), dec_tile_order);
+	for (i = 0; i < dec_tiles_cnt; i++) {
+		if (dec_tiles[i].state == DEC_TILE_WAIT)
+			dec_tile_abandon(&dec_tiles[i]);
+		else
+			dec_tile_place(&dec_tiles[i]);
+	}
+}
+
+/**
+ * \brief Учет EPC, остающегося в основном заголовке при наличии RED
+ * \details Расчетная длина потока сдвигается на длину EPC, позиции тайлов - в dec_tile_positions_fill
+ */
+void dec_red_finish()
+{
+	mh_tile_len += EPC_LN + 2;
+}
+
+/**
+ * \brief Подготовка глобального состояния декодера к новому кадру
+ * \param inp_buffer  Адрес входного буфера
+ * \param inp_len  Длина данных во входном буфере в байтах
+ * \param out_buffer  Адрес выходного буфера
+ */
+void dec_frame_init(uint8_t* inp_buffer, size_t inp_len, uint8_t* out_buffer)
+{
+	in_buf = inp_buffer;
+	in_len = inp_len;
+	out_buf = out_buffer;
+	tile_count = 0;
+	if (dec_arena.used)			// предыдущий кадр не был завершен в jpwl_dec_run
+		w_arena_reset(&dec_arena);
+	dec_markers = NULL;			// таблица прошлого кадра освобождена вместе с ареной
+	dec_markers_cap = 0;
+	markers_cnt = 0;
+	dec_sot = NULL;
+	dec_sot_cap = dec_sot_cnt = 0;
+	dec_sot_built = _false_;
+	dec_tile_pos = NULL;
+	dec_tile_pos_cnt = 0;
+	dec_tile_out = NULL;
+	dec_tiles_total = 0;
+	dec_red = NULL;
+	dec_red_cap = dec_red_cnt = 0;
+	dec_red_used = _false_;
+	dec_tiles = NULL;
+	dec_tiles_cap = dec_tiles_cnt = 0;
+	dec_skip_cnt = 0;
+	dec_skip_length = 0;
+	memset(&dec_rs_stats, 0, sizeof(dec_rs_stats));
+	dec_sens_cnt = 0;
+	dec_sens_tiles_cnt = 0;
+	old_rs_mode = 0;				// RS-код еще не инициализирован
+	mh_tile_len = 0;				// Обнуление суммы длин основного заголовка и тайлов, копируемых в выходной буфер
+	bad_block_length = tile_all_rest_cnt = tile_red_rest_cnt = 0;	// Обнуление статистики корекции тайлов
+	dec_copy_reset();
+}
+
 /**
  * \brief Декодер jpwl
  * \details Выполняет коррекцию данных входного буфера в соответствии со средствами защиты,
@@ -764,28 +1539,21 @@ uint32_t dec_data_copy()
  * Коды завершения:
  * 1 - в кодовом потоке нет средств jpwl, коррекция не нужна
  * 0 - основной заголовок восстановлен, кодовый поток несет данные об изображении, кадр следует отобразить
- * -1 - основной заголовок не восстановлен, кадр изображения следует отбросить
- * -2 - нет ни одного тайла с данными, кадр изображения следует отбросить
- * \param inp_buf  Адрес входного буфера, в котором расположен кодовый поток jpeg2000 часть 2, подвергшийся воздействию ошибок в канале передачи данных
+ * -1 - входной поток пуст, основной заголовок не восстановлен, за ним нет данных или не удалась
+ * обратная перестановка (Ammendment), кадр изображения следует отбросить
+ * \param inp_buffer  Адрес входного буфера, в котором расположен кодовый поток jpeg2000 часть 2, подвергшийся воздействию ошибок в канале передачи данных
  * \param inp_len  Длина данных во входном буфере в байтах
- * \param out_buf  Адрес выходного буфера, в который следует записать скорректированный кодовый поток jpeg2000, возможно с внедренными маркерами EPC и RED(остаточная ошибка)
+ * \param out_buffer  Адрес выходного буфера, в который следует записать скорректированный кодовый поток jpeg2000, возможно с внедренными маркерами EPC и RED(остаточная ошибка).
+ * Может совпадать с inp_buffer: тогда маркеры jpwl удаляются сжатием потока на месте
  * \param out_len  Адрес переменной, в которую будет записана длина данных (в байтах) выходного буфера
  * \return Код завершения
  */
-
-int w_decoder(uint8_t* inp_buffer, uint32_t inp_len, uint8_t* out_buffer, uint32_t* out_len)
+int w_decoder(uint8_t* inp_buffer, size_t inp_len, uint8_t* out_buffer, size_t* out_len)
 {
 	uint8_t* p;
 	int i;
 
-	in_buf = p = inp_buffer;
-	in_len = inp_len;
-	out_buf = out_buffer;
-	tile_count = 0;
-	markers_cnt = 0;
-	old_rs_mode = 0;				// RS-код еще не инициализирован
-	mh_tile_len = 0;				// Обнуление суммы длин основного заголовка и тайлов, копируемых в выходной буфер
-	bad_block_length = tile_all_rest_cnt = tile_red_rest_cnt = 0;	// Обнуление статистики корекции тайлов
+	dec_frame_init(inp_buffer, inp_len, out_buffer);
 	i = dec_mh_correct(&p);			// коррекция основного заголовка
 	has_bad_blocks = _false_;
 	if (i < 0) {					// основной заголовок не корректируется
@@ -795,12 +1563,28 @@ int w_decoder(uint8_t* inp_buffer, uint32_t inp_len, uint8_t* out_buffer, uint32
 		if (!inp_len)
 			return -1;
 		*out_len = inp_len;
-		memcpy(out_buffer, inp_buffer, inp_len);
+		if (out_buffer != inp_buffer)
+			memcpy(out_buffer, inp_buffer, inp_len);
 		return 1;
 	};
+	if (is_ammendment && deinterleave_instream())	// использован Ammendment - обратная перестановка
+		return -1;
+	if (in_len <= (size_t)(p - in_buf))
+		return -1;
+	dec_tile_out_init();
+	p = dec_tile_detect(p);			// поиск первого тайла
 	while (p != NULL) {
+		if (dec_budget_stop()) {	// остаток кадра не разбирается
+			dec_tail_abandon(p);
+			break;
+		}
 		p = dec_tile_correct(p);
 	};
+	if (dec_budget_on)
+		dec_budget_run();
+	if (dec_red_used)
+		dec_red_finish();
+	dec_tile_positions_fill();
 	*out_len = dec_data_copy();
 	return 0;
 }
@@ -819,14 +1603,60 @@ int w_decoder(uint8_t* inp_buffer, uint32_t inp_len, uint8_t* out_buffer, uint32
 uint32_t w_decoder_call(w_dec_params* params)
 {
 	int i;
-	uint32_t o_l;
+	size_t o_l;
 
+	dec_use_red = params->use_red;
+	dec_budget_start(params->budget_us, params->budget_work);
 	i = w_decoder(params->inp_buffer, params->inp_length, params->out_buffer, &o_l);
 	if (i == 0)
 		params->out_length = o_l;
 	return i;
 }
 
+/**
+ * \brief Заполнение результатов и статистики по завершении кадра
+ * \param i_res  Код завершения w_decoder
+ * \param out_length  Длина выходного потока
+ * \param inp_length  Длина входного потока
+ * \param bResults  Адрес структуры для результатов декодирования
+ */
+void dec_results_fill(int i_res, size_t out_length, size_t inp_length, jpwl_dec_bResults* bResults)
+{
+	if (i_res == 1) {
+		stats.not_JPWL++;
+		bResults->out_length = out_length;
+	}
+	else if (i_res == 0) {
+		if (has_bad_blocks == _true_)
+			stats.partially_restored++;
+		else
+			stats.fully_restored++;
+		bResults->out_length = out_length;
+	}
+	else {
+		stats.not_restored++;
+		bResults->out_length = 0;
+		bad_block_length = inp_length;
+	};
+	bResults->all_bad_length = bad_block_length;
+	bResults->tile_all_rest_cnt = tile_all_rest_cnt;
+	bResults->tile_part_rest_cnt = tile_red_rest_cnt;
+	bResults->tile_skip_cnt = dec_skip_cnt;
+	bResults->skip_length = dec_skip_length;
+	bResults->rs = dec_rs_stats;
+	if (i_res == 0 && !dec_sens_pad(tile_count)) {	// тайлы без ESD и невосстановленные - с нулевым количеством
+		bResults->tile_count = tile_count;
+		bResults->tile_sens_cnt = dec_sens_tiles;
+		bResults->pack_sens = dec_sens;
+	}
+	else {
+		bResults->tile_count = 0;
+		bResults->tile_sens_cnt = NULL;
+		bResults->pack_sens = NULL;
+	}
+	w_arena_reset(&dec_arena);		// конец кадра: таблица маркеров больше не нужна
+}
+
 /**
  * \brief Инициализация декодера jpwl
  * \param params  Адрес структуры с параметрами инициализации декодера jpwl
@@ -838,16 +1668,30 @@ void jpwl_dec_init()
 
 /**
  * \brief Запуск декодера jpwl
+ * \details Если bParams->out_buffer равен NULL или inp_buffer, скорректированный поток
+ * формируется во входном буфере сжатием на месте, отдельный выходной буфер не нужен.
+ * Если bParams->use_red равен 1, некорректируемые участки частично восстановленных тайлов
+ * перечисляются в сегментах RED их заголовков, а tile_positions заполняется позициями
+ * полностью восстановленных тайлов в выходном потоке. Выходной поток при этом не длиннее входного.
+ * Если поле DL сегмента EPC нулевое (заголовок от jpwl_enc_stream_begin), длиной кадра считается inp_length.
+ * Таблица tile_positions индексируется номером тайла Isot из сегмента SOT и должна вмещать
+ * все тайлы кадра по сегменту SIZ, позиции тайлов, не восстановленных полностью, обнуляются
  * \param params  Адрес структуры с параметрами инициализации декодера jpwl
+ * \return Код завершения w_decoder: 0 - основной заголовок восстановлен, 1 - в кодовом потоке нет
+ * средств jpwl (поток скопирован без изменений), -1 - входной поток пуст или основной заголовок
+ * не восстановлен, кадр следует отбросить
  */
 __declspec(dllexport)
-errno_t jpwl_dec_run(jpwl_dec_bParams* bParams, jpwl_dec_bResults* bResults, int* tile_positions)
+errno_t jpwl_dec_run(jpwl_dec_bParams* bParams, jpwl_dec_bResults* bResults, size_t* tile_positions)
 {
 	int i_res;
 	w_dec_params dec_par = {
 		.inp_buffer = bParams->inp_buffer,
 		.inp_length = bParams->inp_length,
-		.out_buffer = bParams->out_buffer
+		.out_buffer = bParams->out_buffer ? bParams->out_buffer : bParams->inp_buffer,
+		.use_red = bParams->use_red,
+		.budget_us = bParams->budget_us,
+		.budget_work = bParams->budget_work
 	};
 	memset(&stats, 0, sizeof(stats));
 
@@ -861,29 +1705,235 @@ errno_t jpwl_dec_run(jpwl_dec_bParams* bParams, jpwl_dec_bResults* bResults, int
 	tile_red_rest_cnt = 0;
 	_tile_positions = tile_positions;
 	i_res = w_decoder_call(&dec_par);
-	if (i_res == 1) {
-		stats.not_JPWL++;
-		bResults->out_length = dec_par.inp_length;
+	dec_results_fill(i_res, i_res == 1 ? dec_par.inp_length : dec_par.out_length, bParams->inp_length, bResults);
+	return i_res;
+}
+
+/**
+ * \brief Выдача очередного участка выходного потока функции приема тайлов
+ * \param tile_num Порядковый номер тайла или -1 для основного заголовка
+ */
+void dec_stream_emit(int tile_num)
+{
+	if (ds_tile_cb)
+		ds_tile_cb(ds_user, tile_num, out_buf + ds_out_start, dec_out_len - ds_out_start);
+	ds_out_start = dec_out_len;
+}
+
+/**
+ * \brief Проверка, получены ли данные кадра до заданной позиции
+ * \details Позиции за концом кадра (DL из EPC) не ожидаются
+ * \param need Позиция во входном буфере, до которой нужны данные
+ * \return _true_ - данные получены
+ */
+_bool_ dec_stream_ready(size_t need)
+{
+	return ds_received >= (need < in_len ? need : in_len);
+}
+
+/**
+ * \brief Проверка, потребуется ли поиск тайла по всему оставшемуся кадру
+ * \details Если тайл по адресу v не распознается, dec_tile_detect ищет следующий тайл
+ * до конца кадра, поэтому до получения всего кадра распознавание откладывается.
+ * При наличии таблицы позиций тайлов достаточно дождаться следующего тайла из таблицы
+ * \param v Предполагаемый адрес тайла во входном буфере
+ * \return _true_ - нужно дождаться конца кадра
+ */
+_bool_ dec_stream_resync(uint8_t* v)
+{
+	uint16_t i;
+
+	if (ds_received >= in_len || (size_t)(v - in_buf) + 80 >= in_len || dec_sot_check(v))
+		return _false_;
+	if (!dec_tile_pos)
+		return _true_;
+	// с таблицей позиций достаточно получить заголовок следующего распознаваемого тайла
+	for (i = dec_tile_pos_find((size_t)(v - in_buf) + 1); i < dec_tile_pos_cnt && (size_t)dec_tile_pos[i] + 81 <= in_len; i++) {
+		if (ds_received < (size_t)dec_tile_pos[i] + 81)
+			return _true_;
+		if (dec_sot_check(in_buf + dec_tile_pos[i]))
+			return _false_;
 	}
-	else if (i_res == 0) {
-		if (has_bad_blocks == _true_)
-			stats.partially_restored++;
-		else
-			stats.fully_restored++;
-		bResults->out_length = dec_par.out_length;
+	return _false_;
+}
+
+/**
+ * \brief Коррекция той части кадра, которая уже получена потоковым декодером
+ * \details Основной заголовок корректируется, как только получен весь защищенный EPB участок.
+ * Тайл корректируется, когда получены все его Psot байт и начало следующего тайла,
+ * необходимое для его распознавания (пре-данные первого EPB, 80 байт).
+ * Последний тайл и невосстановимый остаток кадра выдаются после получения всего кадра.
+ */
+void dec_stream_advance()
+{
+	uint8_t* p;
+	uint32_t sot_l;
+	uint16_t t;
+	int i;
+
+	if (ds_state == DEC_STREAM_MH) {
+		if (ds_received < 64 + 96)	// пре-данные и коды четности первого EPB основного заголовка
+			return;
+		in_len = ds_received;
+		markers_cnt = 0;
+		mh_tile_len = 0;
+		i = dec_mh_correct(&p);
+		if (i == -7)				// заголовок получен не полностью
+			return;
+		has_bad_blocks = _false_;
+		if (!i && !dec_epc_dl) {	// до конца кадра тайлы ожидают данных, как если бы кадр занимал весь буфер
+			ds_len_unknown = _true_;
+			in_len = ds_cap;
+		}
+		if (i || is_ammendment || dec_epc_dl > ds_cap || in_len <= (size_t)(p - in_buf)) {
+			ds_state = DEC_STREAM_WHOLE;	// кадр будет обработан целиком в jpwl_dec_stream_end
+			return;
+		}
+		dec_tile_out_init();
+		dec_copy_until((size_t)(p - in_buf));
+		dec_stream_emit(-1);
+		ds_tile = p;
+		ds_state = DEC_STREAM_FIRST;
 	}
-	else {
-		stats.not_restored++;
-		bResults->out_length = 0;
-		bad_block_length = bParams->inp_length;
-	};
-	bResults->all_bad_length = bad_block_length;
-	bResults->tile_all_rest_cnt = tile_all_rest_cnt;
-	bResults->tile_part_rest_cnt = tile_red_rest_cnt;
+	if (ds_state == DEC_STREAM_FIRST) {
+		if (!dec_stream_ready((size_t)(ds_tile - in_buf) + 81) || dec_stream_resync(ds_tile))
+			return;
+		ds_tile_num = tile_count;
+		ds_tile = dec_tile_detect(ds_tile);
+		ds_state = ds_tile ? DEC_STREAM_TILE : DEC_STREAM_TAIL;
+	}
+	while (ds_state == DEC_STREAM_TILE) {
+		sot_l = _byteswap_ulong(*(uint32_t*)(ds_tile + 6));
+		if (!dec_stream_ready((size_t)(ds_tile - in_buf) + sot_l + 81) || dec_stream_resync(ds_tile + sot_l))
+			return;
+		t = tile_count;
+		p = dec_tile_correct(ds_tile);
+		if (p == NULL) {			// последний тайл кадра или невосстановимый остаток
+			ds_tile_num = t;
+			ds_state = DEC_STREAM_TAIL;
+			break;
+		}
+		dec_copy_until((size_t)(p - in_buf));
+		dec_stream_emit(t);
+		ds_tile = p;
+	}
+	if (ds_state == DEC_STREAM_TAIL && ds_received >= in_len) {
+		dec_tile_positions_fill();
+		dec_data_copy();
+		dec_stream_emit(ds_tile_num);
+		ds_state = DEC_STREAM_DONE;
+	}
+}
 
+/**
+ * \brief Начало потокового декодирования кадра jpwl
+ * \details Данные кадра передаются фрагментами в порядке следования (например, по мере
+ * приема пакетов RTP) через jpwl_dec_stream_push. Скорректированные основной заголовок и тайлы
+ * записываются в выходной буфер по мере готовности и передаются функции tile_cb.
+ * Кадр с внутрикадровым чередованием (Ammendment), кадр без средств jpwl и кадр с
+ * невосстановленным основным заголовком обрабатываются целиком в jpwl_dec_stream_end.
+ * \param frame_buf  Адрес буфера, в котором накапливается кадр (коррекция выполняется в нем)
+ * \param frame_cap  Размер буфера frame_buf в байтах
+ * \param out_buffer  Адрес выходного буфера или NULL для сжатия кадра на месте в frame_buf
+ * \param tile_positions  Таблица позиций тайлов, как у jpwl_dec_run
+ * \param tile_cb  Функция приема тайлов или NULL
+ * \param user  Значение, передаваемое функции tile_cb
+ * \return 0 - все нормально, -1 - нет буфера
+ */
+__declspec(dllexport)
+errno_t jpwl_dec_stream_begin(uint8_t* frame_buf, size_t frame_cap, uint8_t* out_buffer, size_t* tile_positions,
+	jpwl_dec_tile_cb tile_cb, void* user)
+{
+	ds_state = 0;
+	if (!frame_buf || !frame_cap)
+		return -1;
+	dec_use_red = _false_;		// EPC выдается до того, как станет известно о RED
+	dec_budget_on = _false_;	// тайлы выдаются в порядке поступления
+	if (!out_buffer)
+		out_buffer = frame_buf;
+	memset(&stats, 0, sizeof(stats));
+	dec_frame_init(frame_buf, 0, out_buffer);
+	_tile_positions = tile_positions;
+	ds_cap = frame_cap;
+	ds_received = 0;
+	ds_out_start = 0;
+	ds_len_unknown = _false_;
+	ds_tile = NULL;
+	ds_tile_num = 0;
+	ds_tile_cb = tile_cb;
+	ds_user = user;
+	ds_state = DEC_STREAM_MH;
 	return 0;
 }
 
+/**
+ * \brief Передача потоковому декодеру очередного фрагмента кадра
+ * \details Если фрагмент уже находится в буфере кадра на своем месте (data равен
+ * frame_buf плюс количество ранее переданных байт), копирование не выполняется
+ * \param data  Адрес фрагмента
+ * \param len  Длина фрагмента в байтах
+ * \return 0 - все нормально, -1 - фрагмент не помещается в буфер кадра, -2 - декодирование не начато
+ */
+__declspec(dllexport)
+errno_t jpwl_dec_stream_push(uint8_t* data, size_t len)
+{
+	if (!ds_state)
+		return -2;
+	if (len > ds_cap - ds_received)
+		return -1;
+	if (data != in_buf + ds_received)
+		memcpy(in_buf + ds_received, data, len);
+	ds_received += len;
+	if (ds_state != DEC_STREAM_WHOLE && ds_state != DEC_STREAM_DONE)
+		dec_stream_advance();
+	return 0;
+}
+
+/**
+ * \brief Завершение потокового декодирования кадра jpwl
+ * \details Недополученный конец кадра заполняется нулями и обрабатывается как поврежденный.
+ * Если поле DL сегмента EPC нулевое (заголовок от jpwl_enc_stream_begin), длиной кадра
+ * считается количество переданных байт.
+ * Результаты и статистика заполняются так же, как в jpwl_dec_run.
+ * \param bResults  Адрес структуры для результатов декодирования
+ * \return Код завершения, как у jpwl_dec_run (-1 также если не получено ни одного байта),
+ * -2 - декодирование не начато
+ */
+__declspec(dllexport)
+errno_t jpwl_dec_stream_end(jpwl_dec_bResults* bResults)
+{
+	jpwl_dec_bParams bParams;
+	errno_t res;
+
+	if (!ds_state)
+		return -2;
+	if (ds_state != DEC_STREAM_MH && ds_state != DEC_STREAM_WHOLE) {
+		if (ds_len_unknown)				// длина кадра - все полученные данные
+			in_len = ds_received;
+		if (ds_received < in_len) {		// часть кадра потеряна
+			memset(in_buf + ds_received, 0, in_len - ds_received);
+			ds_received = in_len;
+		}
+		dec_stream_advance();
+	}
+	if (ds_state == DEC_STREAM_DONE) {
+		dec_results_fill(0, dec_out_len, ds_received, bResults);
+		res = 0;
+	}
+	else {						// кадр целиком
+		bParams.inp_buffer = in_buf;
+		bParams.inp_length = ds_received;
+		bParams.out_buffer = out_buf;
+		bParams.use_red = 0;
+		bParams.budget_us = bParams.budget_work = 0;
+		res = jpwl_dec_run(&bParams, bResults, _tile_positions);
+		if (ds_tile_cb && bResults->out_length)
+			ds_tile_cb(ds_user, -1, bParams.out_buffer, bResults->out_length);
+	}
+	ds_state = 0;
+	return res;
+}
+
 /**
  * \brief Запуск декодера jpwl
  * \param params  Адрес структуры с параметрами инициализации декодера jpwl
@@ -893,3 +1943,101 @@ restore_stats* jpwl_dec_stats()
 {
 	return &stats;
 }
+
+/**
+ * \brief Статистика использования памяти под временные данные кадров декодера jpwl
+ * \param mem_stats  Адрес структуры jpwl_mem_stats для заполнения
+ */
+__declspec(dllexport)
+void jpwl_dec_mem_stats(jpwl_mem_stats* mem_stats)
+{
+	w_arena_stats(&dec_arena, mem_stats);
+}
+
+/**
+ * \brief Освобождение таблиц декодера, вызывается из jpwl_destroy
+ */
+void dec_tables_free()
+{
+	w_arena_free(&dec_arena);
+	dec_markers = NULL;
+	dec_markers_cap = 0;
+	markers_cnt = 0;
+	w_table_free((void**)&dec_sens, &dec_sens_cap);
+	w_table_free((void**)&dec_sens_tiles, &dec_sens_tiles_cap);
+	dec_sens_cnt = dec_sens_tiles_cnt = 0;
+}
+
+/**
+ * \struct dec_batch
+ * \brief Общие данные пакетного декодирования кадров
+ */
+typedef struct {
+	jpwl_dec_frame* frames;		///< Кадры пакета
+	restore_stats* total;		///< Суммарная статистика пакета или NULL
+} dec_batch;
+
+/**
+ * \brief Декодирование одного кадра пакета в потоке пула
+ * \details Статистика кадра добавляется к суммарной атомарно, так как ее накапливают все потоки
+ * \param ctx  Адрес структуры dec_batch
+ * \param index  Номер кадра в пакете
+ */
+void dec_batch_job(void* ctx, size_t index)
+{
+	dec_batch* batch = (dec_batch*)ctx;
+	jpwl_dec_frame* f = batch->frames + index;
+	volatile LONG* t = (volatile LONG*)batch->total;
+
+	f->status = jpwl_dec_run(&f->params, &f->results, f->tile_positions);
+	f->results.tile_count = 0;		// таблицы ESD потока пула освобождаются по завершении пакета
+	f->results.tile_sens_cnt = NULL;
+	f->results.pack_sens = NULL;
+	if (!t)
+		return;
+	InterlockedExchangeAdd(t++, stats.fully_restored);
+	InterlockedExchangeAdd(t++, stats.partially_restored);
+	InterlockedExchangeAdd(t++, stats.not_restored);
+	InterlockedExchangeAdd(t++, stats.not_JPWL);
+	InterlockedExchangeAdd(t++, stats.corrected_rs_bytes);
+	InterlockedExchangeAdd(t, stats.uncorrected_rs_bytes);
+}
+
+/**
+ * \brief Освобождение таблиц потока пула по завершении пакетного декодирования
+ * \param ctx  Не используется
+ */
+void dec_batch_done(void* ctx)
+{
+	dec_tables_free();
+}
+
+/**
+ * \brief Пакетное декодирование независимых кадров jpwl
+ * \details Кадры распределяются по потокам, у каждого потока свои таблицы декодера.
+ * Результат каждого кадра заносится в его структуру jpwl_dec_frame, статистика всех кадров
+ * суммируется в total. Статистика jpwl_dec_stats вызывающего потока не изменяется.
+ * Значения чувствительности из ESD (pack_sens) в пакетном режиме не выдаются.
+ * \param frames  Адрес массива кадров
+ * \param count  Количество кадров
+ * \param threads  Количество потоков, 0 - по количеству процессоров
+ * \param total  Адрес структуры для суммарной статистики пакета или NULL
+ * \return 0 - все кадры обработаны, иначе количество отброшенных кадров (status < 0)
+ */
+__declspec(dllexport)
+errno_t jpwl_dec_run_batch(jpwl_dec_frame* frames, size_t count, int threads, restore_stats* total)
+{
+	dec_batch batch = { frames, total };
+	restore_stats own = stats;
+	errno_t failed = 0;
+	size_t i;
+
+	if (total)
+		memset(total, 0, sizeof(restore_stats));
+	if (!w_pool_run(dec_batch_job, dec_batch_done, &batch, count, threads))
+		stats = own;			// кадры декодировал вызывающий поток
+	for (i = 0; i < count; i++)
+		if (frames[i].status < 0)
+			failed++;
+	return failed;
+}
@@ -10,12 +10,22 @@ extern "C" __declspec(dllimport)
 #endif
 void jpwl_dec_init();
 
+/**
+ * \brief Запуск декодера jpwl
+ * \details Таблицы и статистика декодера хранятся в локальной памяти вызывающего потока (см. W_TLS),
+ * поэтому кадры можно декодировать в нескольких потоках одновременно, а jpwl_dec_stats и
+ * jpwl_dec_mem_stats возвращают данные последнего кадра своего потока.
+ * Таблица tile_positions индексируется номером тайла Isot и должна вмещать все тайлы кадра по сегменту SIZ;
+ * позиции тайлов, не восстановленных полностью, обнуляются
+ * \return 0 - основной заголовок восстановлен, 1 - в кодовом потоке нет средств jpwl,
+ * -1 - входной поток пуст или основной заголовок не восстановлен, кадр следует отбросить
+ */
 #ifndef __cplusplus
 __declspec(dllimport)
 #else
 extern "C" __declspec(dllimport)
 #endif
-errno_t jpwl_dec_run(jpwl_dec_bParams * bParams, jpwl_dec_bResults * bResult, int* tile_positions);
+errno_t jpwl_dec_run(jpwl_dec_bParams * bParams, jpwl_dec_bResults * bResult, size_t* tile_positions);
 
 #ifndef __cplusplus
 __declspec(dllimport)
@@ -37,3 +47,39 @@ __declspec(dllimport)
 extern "C" __declspec(dllimport)
 #endif
 restore_stats* jpwl_dec_stats();
+
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+void jpwl_dec_mem_stats(jpwl_mem_stats* mem_stats);
+
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_dec_stream_begin(uint8_t* frame_buf, size_t frame_cap, uint8_t* out_buffer, size_t* tile_positions,
+	jpwl_dec_tile_cb tile_cb, void* user);
+
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_dec_stream_push(uint8_t* data, size_t len);
+
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_dec_stream_end(jpwl_dec_bResults* bResults);
+
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_dec_run_batch(jpwl_dec_frame* frames, size_t count, int threads, restore_stats* total);
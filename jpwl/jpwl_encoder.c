@@ -10,8 +10,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "crc.h"
+#include "jpwl_alloc.h"
 #include "jpwl_types.h"
 #include "jpwl_params.h"
+#include "jpwl_pool.h"
 
 #ifdef RS_OPTIMIZED
 #include "rs64/rs64.h"
@@ -26,27 +28,50 @@
 
 #define W_OPTIMIZED
 
-#define MARKER_COUNT_CHECK if(enc_markers_cnt==MAX_MARKERS) return(-1);
-#define INTERV_COUNT_CHECK if(enc_interv_count==MAX_INTERVALS) return(-4);
-
-int_struct e_intervals[MAX_INTERVALS];	///< Буфер для интервалов чувствительности данных тайлов
-
-unsigned long AllMarkers_len;	///< Длина всех созданных маркеров
-unsigned long amm_len;			///< Длина выходного потока при применении Ammendment
-unsigned char* cur_pack;	//ссылка на чувствительность тек. пакета для 
-_bool_ empty_stream;			///< Флаг пустого потока, состоящего только из основного заголовка
-unsigned short enc_interv_count;	///< Счетчик записей об интервалах чувствительности в массиве e_intervals
-w_marker enc_markers[MAX_MARKERS]; ///< Массив маркеров jpwl
-unsigned short enc_markers_cnt;		///< Счетчик маркеров в массиве enc_markers 
-unsigned short epb_count;		///< Количество EPB блоков в тайлах
-unsigned long enc_epc_dl;			///< Длина выходного кодового потока
-unsigned char* epc_point;		///< Адрес для записи карты EPB блоков в сегмент EPC
-unsigned long h_length[MAX_TILES + 1]; ///< Массив длин заголовков
-unsigned char imatrix[MAX_OUT_SIZE];	///< Массив для выполнения внутрикадрового чередования выходного потока
-unsigned short pack_count;		///< Счетчик пакетов в данных о чувствительности
-unsigned long Psot_new[MAX_TILES]; ///< Массив обновленных значений длин Psot тайлов 
-unsigned short tile_count;		///< Счетчик тайлов
-w_enc_params w_params;	///< Структура с параметрами кодера jpwl
+#define MARKER_COUNT_CHECK if(w_table_reserve(&enc_arena, (void**)&enc_markers, &enc_markers_cap, sizeof(w_marker), (size_t)enc_markers_cnt + 1)) return(-1);
+#define INTERV_COUNT_CHECK if(w_table_reserve(&enc_arena, (void**)&e_intervals, &enc_interv_cap, sizeof(int_struct), (size_t)enc_interv_count + 2)) return(-4);
+#define UEP_CODES 16		///< Количество RS-кодов, из которых выбирается защита интервала при UEP
+
+#define SENS_DB_RANGE 60.0	///< Диапазон вклада пакетов в искажение (дБ), отображаемый на шкалу чувствительности 0 - 255
+
+const uint8_t uep_codes[UEP_CODES] = { 37, 38, 40, 43, 45, 48, 51, 53, 56, 64, 75, 80, 85, 96, 112, 128 };	///< RS(n,32) для UEP по возрастанию силы кода
+
+W_TLS int_struct* e_intervals;	///< Таблица интервалов чувствительности данных тайлов
+W_TLS size_t enc_interv_cap;		///< Ёмкость таблицы e_intervals
+
+W_TLS size_t AllMarkers_len;	///< Длина всех созданных маркеров
+W_TLS size_t amm_len;			///< Длина выходного потока при применении Ammendment
+W_TLS unsigned char* cur_pack;	//ссылка на чувствительность тек. пакета для 
+W_TLS _bool_ empty_stream;			///< Флаг пустого потока, состоящего только из основного заголовка
+W_TLS uint32_t enc_interv_count;	///< Счетчик записей об интервалах чувствительности в таблице e_intervals
+W_TLS w_marker* enc_markers;		///< Таблица маркеров jpwl
+W_TLS size_t enc_markers_cap;		///< Ёмкость таблицы enc_markers
+W_TLS uint32_t enc_markers_cnt;		///< Счетчик маркеров в таблице enc_markers 
+W_TLS unsigned short epb_count;		///< Количество EPB блоков в тайлах
+W_TLS size_t enc_epc_dl;			///< Длина выходного кодового потока
+W_TLS unsigned char* epc_point;		///< Адрес для записи карты EPB блоков в сегмент EPC
+W_TLS size_t* h_length;			///< Таблица длин заголовков: [0] - основной заголовок, [i + 1] - заголовок i-го тайла
+W_TLS size_t h_length_cap;		///< Ёмкость таблицы h_length
+W_TLS unsigned short pack_count;		///< Счетчик пакетов в данных о чувствительности
+W_TLS uint32_t* Psot_new;			///< Таблица обновленных значений длин Psot тайлов 
+W_TLS size_t Psot_new_cap;		///< Ёмкость таблицы Psot_new
+W_TLS size_t* enc_tile_pos;		///< Таблица позиций тайлов во входном потоке для jpwl_enc_bResults
+W_TLS size_t enc_tile_pos_cap;	///< Ёмкость таблицы enc_tile_pos
+W_TLS uint8_t (*enc_tile_hdr)[TILE_HEADER_COPY];	///< Таблица начальных байт заголовков тайлов для jpwl_enc_bResults
+W_TLS size_t enc_tile_hdr_cap;	///< Ёмкость таблицы enc_tile_hdr
+W_TLS unsigned short tile_count;		///< Счетчик тайлов
+W_TLS _bool_ enc_tile_hints;		///< В EPC текущего кадра отведено место под таблицу позиций тайлов
+W_TLS w_enc_params w_params;	///< Структура с параметрами кодера jpwl
+W_TLS w_arena enc_arena;		///< Арена для таблиц и промежуточных буферов текущего кадра
+W_TLS w_marker enc_stream_mh[2];	///< Маркеры EPB и EPC основного заголовка при потоковом кодировании
+W_TLS size_t enc_stream_mh_len;	///< Длина защищенного основного заголовка при потоковом кодировании, 0 - поток не начат
+W_TLS size_t enc_stream_len;		///< Суммарная длина выданных при потоковом кодировании данных
+W_TLS unsigned short enc_stream_tiles;	///< Количество тайлов, выданных при потоковом кодировании
+W_TLS unsigned short enc_tile_first;	///< Номер в кадре тайла, с которого начинается обработка (для tile_codes)
+W_TLS unsigned char wcoder_mh_param;	///< Параметр защиты основного заголовка (см. jpwl_params.h)
+W_TLS unsigned char wcoder_th_param;	///< Параметр защиты заголовков тайлов
+W_TLS unsigned char wcoder_data_param;	///< Параметр защиты данных тайлов
+W_TLS _bool_ interleave_use;		///< Режим внутрикадрового чередования
 
 /**
  * \brief Поиск заданного маркера в буфере
@@ -78,22 +103,76 @@ uint8_t* mark_search(uint8_t* buf, uint8_t marker, uint8_t terminated_marker, ad
 }
 
 /**
- * \brief  Инициализация переменных и массивов кодера и проверка корректности значений параметров кодера, полученных из ПО ПИИ
- * \param inp_buf Ссылка на буфер с входным кодовым потоком
- * \return Возвращает код завершения: 0 - параметры корректны
+ * \brief Подсчет тайлов кодового потока по цепочке сегментов SOT
+ * \details Переходит от тайла к тайлу по значению Psot, не просматривая данные тайлов побайтно.
+ * Результат используется для начального резервирования таблиц кодера, поэтому
+ * при нарушенной цепочке SOT достаточно вернуть оценку снизу.
+ * \param inp_buf Ссылка на начало кодового потока
+ * \param inp_len Длина кодового потока в байтах
+ * \return Количество тайлов
  */
-int w_enc_init(uint8_t* inp_buf)
+uint32_t enc_tiles_count(uint8_t* inp_buf, size_t inp_len)
 {
-	if (enc_markers_cnt == 0)
-		memset(enc_markers, 0, sizeof(w_marker) * MAX_MARKERS);
-	else					// последующие обнуления - enc_markers_cnt элементов
-		memset(enc_markers, 0, sizeof(w_marker) * enc_markers_cnt);
+	uint8_t* v = NULL, * p;
+	uint32_t psot, count = 0;
+
+	p = mark_search(inp_buf, SOT_LOW, EOC_LOW, &v);
+	while (p != NULL && (size_t)(p - inp_buf) + SOT_LN + 2 <= inp_len
+		&& *p == 0xff && *(p + 1) == SOT_LOW) {
+		count++;
+		psot = _byteswap_ulong(*(uint32_t*)(p + 6));
+		if (psot == 0)		// последний тайл продолжается до маркера EOC
+			break;
+		p += psot;
+	}
+	return count;
+}
+
+/**
+ * \brief  Сброс переменных и таблиц кодера перед разметкой очередного кадра или его части
+ * \details Таблицы резервируются по ожидаемому количеству тайлов: на каждый тайл
+ * EPB заголовка и EPB данных, при дроблении интервалов таблицы растут по мере необходимости.
+ * \param tiles Ожидаемое количество тайлов
+ * \return Возвращает код завершения: 0 - все нормально, -1 - ошибка выделения памяти
+ */
+errno_t enc_frame_reset(size_t tiles)
+{
+	if (enc_arena.used)			// предыдущий кадр не был завершен сбросом арены
+		w_arena_reset(&enc_arena);
+	enc_markers = NULL;			// таблицы прошлого кадра освобождены вместе с ареной
+	enc_markers_cap = 0;
+	e_intervals = NULL;
+	enc_interv_cap = 0;
+	h_length = NULL;
+	h_length_cap = 0;
+	Psot_new = NULL;
+	Psot_new_cap = 0;
+	if (w_table_reserve(&enc_arena, (void**)&enc_markers, &enc_markers_cap, sizeof(w_marker), 2 + tiles * 2)
+		|| w_table_reserve(&enc_arena, (void**)&e_intervals, &enc_interv_cap, sizeof(int_struct), tiles + 1)
+		|| w_table_reserve(&enc_arena, (void**)&h_length, &h_length_cap, sizeof(size_t), tiles + 1)
+		|| w_table_reserve(&enc_arena, (void**)&Psot_new, &Psot_new_cap, sizeof(uint32_t), tiles))
+		return -1;
 	enc_markers_cnt = 0;
 	enc_interv_count = 0;
 	pack_count = 0;
 	AllMarkers_len = 0;
 	epb_count = 0;
+	enc_tile_hints = _false_;
 	empty_stream = _false_;
+	enc_tile_first = 0;
+	return 0;
+}
+
+/**
+ * \brief  Инициализация переменных и таблиц кодера и проверка корректности значений параметров кодера, полученных из ПО ПИИ
+ * \param inp_buf Ссылка на буфер с входным кодовым потоком
+ * \param inp_len Длина входного кодового потока в байтах
+ * \return Возвращает код завершения: 0 - параметры корректны, -1 - ошибка выделения памяти
+ */
+int w_enc_init(uint8_t* inp_buf, size_t inp_len)
+{
+	if (enc_frame_reset(enc_tiles_count(inp_buf, inp_len)))
+		return -1;
 	// Определяем наличие в кодовом потоке маркеров SOP
 	uint8_t* unused = NULL;
 	uint8_t* marker = mark_search(inp_buf, SOD_LOW, EOC_LOW, &unused);
@@ -191,9 +270,9 @@ int enc_mh_markers_create(addr_char* codestream)
 		marker = mark_search(buf, EOC_LOW, EMPTY_LOW, &v);	// Ищем EOC
 		if (marker == NULL)	// Нет EOC
 			return -2;
-		enc_epc_dl = (uint32_t)(marker - buf + 2);			// Длина входного кодового потока из осн. заголовка + маркер EOC
+		enc_epc_dl = (size_t)(marker - buf + 2);			// Длина входного кодового потока из осн. заголовка + маркер EOC
 	}
-	h_length[0] = (uint32_t)(marker - buf) - 1;		// Запомнили смещение посл. байта заголовка отн. его начала
+	h_length[0] = (size_t)(marker - buf) - 1;		// Запомнили смещение посл. байта заголовка отн. его начала
 	// формируем в l длину сегмента маркера SIZ
 	v = (uint8_t*)&l; 
 	*v = *(buf + 5); 
@@ -272,6 +351,106 @@ int enc_mh_markers_create(addr_char* codestream)
 	return 0;
 }
 
+/**
+ * \brief  Параметр защиты данных тайла
+ * \param tile Номер тайла в кадре
+ * \return Элемент tile_codes или wcoder_data, если для тайла код не задан
+ */
+uint8_t enc_tile_code(uint32_t tile)
+{
+	if (w_params.tile_codes && tile < w_params.tile_codes_cnt)
+		return w_params.tile_codes[tile];
+	return wcoder_data_param;
+}
+
+/**
+ * \brief  Выбор RS-кода для пакета при неравномерной защите данных (UEP)
+ * \details Чувствительность отсчитывается от наибольшей в тайле: самые чувствительные
+ * пакеты защищаются кодом RS(128,32), наименее чувствительные - кодом RS(37,32)
+ * \param sens Чувствительность пакета
+ * \param max_sens Наибольшая чувствительность пакетов тайла
+ * \return Длина кодового слова n кода RS(n,32)
+ */
+uint8_t enc_uep_code(uint8_t sens, uint8_t max_sens)
+{
+	if (max_sens == 0)
+		return uep_codes[0];
+	return uep_codes[((uint32_t)sens * (UEP_CODES - 1) + max_sens / 2) / max_sens];
+}
+
+/**
+ * \brief  Разбиение данных тайла на интервалы чувствительности для неравномерной защиты (UEP)
+ * \details Границы пакетов определяются по маркерам SOP; если маркеров не хватает,
+ * оставшиеся данные тайла делятся между оставшимися пакетами поровну.
+ * Соседние пакеты с одинаковым RS-кодом объединяются в один интервал (защищаемый одним EPB),
+ * интервал, не помещающийся в один EPB, дробится. Интервалы заносятся в e_intervals начиная
+ * с enc_interv_count, по завершении enc_interv_count указывает на последний интервал тайла
+ * \param buf Ссылка на начало тайла
+ * \param p_start Ссылка на начало первого пакета тайла
+ * \param data_end Ссылка на первый байт за данными тайла
+ * \param packets Количество пакетов тайла
+ * \param sens Чувствительность пакетов тайла
+ * \return Количество интервалов тайла или -4 - недостаточно места в массиве для интервалов чувствительности
+ */
+int enc_uep_intervals(uint8_t* buf, uint8_t* p_start, uint8_t* data_end, uint16_t packets, uint8_t* sens)
+{
+	uint8_t* pack, * next;
+	uint8_t max_sens = 0, code;
+	uint32_t start, end, len, room, intrv_max, i_s = enc_interv_count;
+	int_struct* cur;
+	_bool_ sop;
+	int n = 0;
+	uint16_t i;
+
+	for (i = 0; i < packets; i++)
+		if (sens[i] > max_sens)
+			max_sens = sens[i];
+	sop = p_start[0] == 0xff && p_start[1] == SOP_LOW;	// пакеты начинаются с маркеров SOP
+	pack = p_start;
+	for (i = 0; i < packets && pack < data_end; i++, pack = next) {
+		next = data_end;
+		if (i + 1 < packets) {
+			if (sop) {				// ищем маркер SOP следующего пакета
+				for (next = pack + 2; next + 1 < data_end && (next[0] != 0xff || next[1] != SOP_LOW); next++);
+				if (next + 1 >= data_end)
+					sop = _false_;
+			}
+			if (!sop)
+				next = pack + (data_end - pack) / (packets - i);
+		}
+		code = enc_uep_code(sens[i], max_sens);
+		intrv_max = (uint32_t)((MAX_EPBSIZE - EPB_LN - PRE_RSCODE_SIZE) / (code - 32)) * 32;
+		start = (uint32_t)(pack - buf);
+		end = (uint32_t)(next - buf);		// первый байт за пакетом
+		while (start < end) {
+			cur = n ? e_intervals + i_s + n - 1 : NULL;
+			if (!cur || cur->code != code || cur->end + 1 - cur->start >= intrv_max) {	// начинаем новый интервал
+				if (w_table_reserve(&enc_arena, (void**)&e_intervals, &enc_interv_cap, sizeof(int_struct), (size_t)i_s + n + 2))
+					return -4;
+				cur = e_intervals + i_s + n++;
+				cur->start = start;
+				cur->end = start - 1;
+				cur->code = code;
+				cur->sens = sens[i];
+			}
+			room = intrv_max - (uint32_t)(cur->end + 1 - cur->start);
+			len = end - start < room ? end - start : room;
+			cur->end += len;
+			start += len;
+			if (sens[i] > cur->sens)
+				cur->sens = sens[i];
+		}
+	}
+	if (!n) {						// пустой тайл
+		e_intervals[i_s].end = (uint32_t)(data_end - buf) - 1;
+		e_intervals[i_s].code = uep_codes[0];
+		e_intervals[i_s].sens = 0;
+		n = 1;
+	}
+	enc_interv_count = i_s + n - 1;
+	return n;
+}
+
 /**
  * \brief  Создание маркеров jpwl в  заголовке тайла
  * \details Побочный эффект:
@@ -287,31 +466,38 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 	uint8_t* buf_start)
 {
 	uint8_t* p, * v, * g, * p_start, * buf_new, * buf;
-	uint8_t epb_ind, data_p, rs, ses;
-	uint16_t i_s, i_k;
-	uint32_t l, l_rs;
+	uint8_t epb_ind, rs, ses, data_code;
+	uint32_t i_s, i_k;
+	uint32_t l, l_rs, esd_ln;
+	uint64_t pos;
 	int i, d, intrv_max, intrv_ln, AllTileEpb_ln;
 	double dd;
 	epb_ms* epb;
+	esd_ms* esd;
 
 	if (empty_stream) {		// Если поток не содержит тайлов
 		*tile = NULL;
 		return 0;
 	};
+	data_code = enc_tile_code(enc_tile_first + tile_count);
+	if (w_table_reserve(&enc_arena, (void**)&h_length, &h_length_cap, sizeof(size_t), (size_t)tile_count + 2)
+		|| w_table_reserve(&enc_arena, (void**)&Psot_new, &Psot_new_cap, sizeof(uint32_t), (size_t)tile_count + 1))
+		return -1;
+	INTERV_COUNT_CHECK
 	AllTileEpb_ln = 0;
 	v = NULL;
 	buf = *tile;
 	p = mark_search(buf, SOD_LOW, EOC_LOW, &v);	// ищем  маркер SOD - конец заголовка тайла 
 	if (p == NULL)								// нет маркера SOD - ошибочный кодовый поток
 		return -2;
-	h_length[tile_count + 1] = (uint32_t)(p - buf) + 1; // смещение последнего байта заголовка тайла относительно начала
+	h_length[tile_count + 1] = (size_t)(p - buf) + 1; // смещение последнего байта заголовка тайла относительно начала
 	p += 2;								// устанавливаем p на начало первого пакета данных тайла
 	p_start = p;							// p_start - начало первого пакета в тайле			
 	g = mark_search(buf + 2, SOT_LOW, EOC_LOW, &v);	// ищем следующий маркер  SOT 
 	buf_new = g;							// ссылка на следующий тайл или NULL, усли он отсутствует
 	if (g == NULL) {						// нет маркера SOT - найден маркер конца EOC (т.е. тайл явл. последним)
 		g = v + 2;							// устанавливаем g на адрес первого байта после конца данных последнего тайла
-		enc_epc_dl = (uint32_t)(g - buf_start);	// длина входного кодового потока
+		enc_epc_dl = (size_t)(g - buf_start);	// длина входного кодового потока
 	};
 	i_s = enc_interv_count;					// индекс начального интервала данных о чувствительности пакетов тайла
 										// в массиве e_intervals
@@ -329,9 +515,15 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 	i_k++;
 	e_intervals[enc_interv_count].start = (uint32_t)(p_start - buf);	// начало интервала - начало тайла
 
-	if (wcoder_data_param >= 37) {
+	if (data_code == 1) {		// UEP: по интервалу на группу пакетов с одинаковым RS-кодом
+		d = enc_uep_intervals(buf, p_start, g, tile_packets[tile_count], pack_sens + pack_count);
+		if (d < 0)
+			return d;
+		i_k = d;
+	}
+	else if (data_code >= 37) {
 		e_intervals[enc_interv_count].sens = ses;		// чувствительность интервала
-		rs = e_intervals[enc_interv_count].code = wcoder_data_param;
+		rs = e_intervals[enc_interv_count].code = data_code;
 		// и вычисляем максимально возможную длину интервала
 		// для одного EPB	
 		intrv_max = (int)(floor((double)(MAX_EPBSIZE - EPB_LN - PRE_RSCODE_SIZE) 
@@ -362,17 +554,26 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 	INTERV_COUNT_CHECK
 		enc_interv_count++;
 	pack_count += tile_packets[tile_count];			// прибавляем в pack_count кол-во обработанных значений о чувствительности
+	// длина ESD вместе с маркером: по байту на пакет или по записи на интервал чувствительности
+	if (w_params.esd_mode == 1)
+		esd_ln = ESD_LN + tile_packets[tile_count] + 2;
+	else if (w_params.esd_mode == 2)
+		esd_ln = ESD_LN + ESDINT_LN * i_k + 2;
+	else
+		esd_ln = 0;
+	if (esd_ln > MAX_EPBSIZE)
+		return -3;
 				
 	// создаем блоки EPB в заголовке тайла
 	epb_count++;								// Подсчет количества EPB блоков для реализации Ammendment
 	epb_ind = 0;									// индекс текущего EPB в заголовке
 	MARKER_COUNT_CHECK
 		enc_markers[enc_markers_cnt].id = EPB_MARKER;			// значение маркера
-	l = (uint32_t)(buf - buf_start) + SOT_LN + 2;		// смещение относительно начала всего кодового потока
+	pos = (uint64_t)(buf - buf_start) + SOT_LN + 2;		// смещение относительно начала всего кодового потока
 												// куда будет вставляться маркер EPB для защиты заголовка тайлша
 												// туда же (т.е. после него) будут вставляться EPBдля защиты данных и ESD
-	enc_markers[enc_markers_cnt].pos_in = l;				// после сегмента SOT
-	enc_markers[enc_markers_cnt].pos_out = l + AllMarkers_len;	// поз. вых буфера = поз. входн. буфера + длина всех добавленных ранее сегментов
+	enc_markers[enc_markers_cnt].pos_in = pos;				// после сегмента SOT
+	enc_markers[enc_markers_cnt].pos_out = pos + AllMarkers_len;	// поз. вых буфера = поз. входн. буфера + длина всех добавленных ранее сегментов
 	epb = &enc_markers[enc_markers_cnt].m.epb;			// ссылка на EPB в Union и инкремент кол-ва созданных маркеров
 	enc_markers[enc_markers_cnt].tile_num = tile_count;			// индекс текущего тайла
 	epb->index = 0;
@@ -383,6 +584,7 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 
 	// вычисляем длину пост-данных 
 	d = (uint32_t)(p_start - buf) - SOT_LN - 2; // длина  заголовка от окончания сегмента SOT до конца заголовка
+	d += esd_ln;							// ESD следует за группой EPB и входит в пост-данные первого EPB
 	epb->post_len = d;
 	if (wcoder_th_param == 1) {
 		epb->k_post = 25;
@@ -414,50 +616,51 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 	AllMarkers_len += l_rs + 2;
 	enc_markers[enc_markers_cnt++].len = epb->Lepb; // Длина EPB без маркера
 	AllTileEpb_ln = epb->Lepb + 2;	// длина всего EPB вместе с маркером
-	if (wcoder_data_param == 0)	// нет защиты данных, больше EPB не будет
+	if (data_code == 0)	// нет защиты данных, больше EPB не будет
 		epb->Depb = 0xC0;			// последний в заголовке, упакованный, индекс=0
 	else
 		epb->Depb = 0x80;			// не последний в заголовке, упакованный, индекс=0
 	epb->LDPepb = epb->pre_len + epb->post_len +	// защищаемая длина пре-данных + пост-данных
 											// + длина всех данных тайла, если пост-данные заголовка и данные тайла не защищаются
-		((wcoder_th_param == 0 && wcoder_data_param == 0) ? e_intervals[enc_interv_count - 1].end - e_intervals[enc_interv_count - 1].start + 1 : 0);
+		((wcoder_th_param == 0 && data_code == 0) ? e_intervals[enc_interv_count - 1].end - e_intervals[enc_interv_count - 1].start + 1 : 0);
 	// формируем поле Pepb с описанием метода защиты данных табл. А.6-А.8
 	epb->Pepb = get_Pepb(wcoder_th_param);
 		// создаем переменное количество блоков для защиты данных 
 		// по 1 блоку на каждый интервал чувствительности
-	if (wcoder_data_param != 0) {
+	if (data_code != 0) {
 		for (i = 0; i < i_k; i++) {
 			MARKER_COUNT_CHECK
 				epb_count++;								// Подсчет количества EPB блоков для реализации Ammendment
 			enc_markers[enc_markers_cnt].id = EPB_MARKER;			// значение маркера
-			enc_markers[enc_markers_cnt].pos_in = l;				// после сегмента SOT
-			enc_markers[enc_markers_cnt].pos_out = l + AllMarkers_len;	// позиция в вых. буфере 
+			enc_markers[enc_markers_cnt].pos_in = pos;				// после сегмента SOT
+			enc_markers[enc_markers_cnt].pos_out = pos + AllMarkers_len;	// позиция в вых. буфере 
 			epb = &enc_markers[enc_markers_cnt].m.epb;			// ссылка на EPB в Union и инкремент кол-ва созданных маркеров
 			//			epb->latest=(i==i_k-1?_true_:_false_);	// последний в заголовке, если обрабатывается последний интервал
 															// и не последний, если не последний интервал
 			//			epb->packed=_true_;					// упакованный
 			enc_markers[enc_markers_cnt].tile_num = tile_count;			// индекс текущего тайла
 			epb->index = ++epb_ind;				// индекс EPB в заголовке
-			epb->hprot = wcoder_data_param;
+			rs = data_code == 1 ? e_intervals[i_s + i].code : data_code;	// при UEP у каждого интервала свой код
+			epb->hprot = rs;
 			epb->k_pre = 13;
 			epb->n_pre = 40;
 			epb->pre_len = EPB_LN + 2;			// заголовок EPB + маркер EPB
 			// вычисляем длину пост-данных 
 			epb->post_len = d = (int)(e_intervals[i_s + i].end - e_intervals[i_s + i].start + 1); // длина  интервала чувствительности		
-			if (wcoder_data_param >= 37) {
+			if (rs >= 37) {
 				epb->k_post = 32;
-				epb->n_post = wcoder_data_param;
+				epb->n_post = rs;
 			}
 			else {
 				epb->k_post = 0;
 				epb->n_post = 0;
 			};
 			// вычисляем длину сегмента маркера для разных вариантов защиты
-			if (wcoder_data_param >= 37) //  RS-код
+			if (rs >= 37) //  RS-код
 				l_rs = (uint16_t)(ceil((double)d / epb->k_post)) * (epb->n_post - epb->k_post);
-			else if (wcoder_data_param == 16)				// CRC-16
+			else if (rs == 16)				// CRC-16
 				l_rs = 2;
-			else if (wcoder_data_param == 32)				// CRC-32
+			else if (rs == 32)				// CRC-32
 				l_rs = 4;
 			else										// нет защиты
 				l_rs = 0;
@@ -474,12 +677,26 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 				epb->Depb = 0x80 | (uint8_t)(epb->index & 0x3f);	// не последний в заголовке, упакованный
 			epb->LDPepb = epb->pre_len + epb->post_len;	// защищаемая длина пре-данных + пост-данных
 			// формируем поле Pepb с описанием метода защиты данных табл. А.6-А.8
-			data_p = wcoder_data_param;
-			if (data_p == 1)
-				data_p = epb->n_post;
-			epb->Pepb = get_Pepb(data_p);
+			epb->Pepb = get_Pepb(rs);
 		}
 	}
+	if (esd_ln) {					// ESD - сразу за последним EPB заголовка тайла
+		MARKER_COUNT_CHECK
+		enc_markers[enc_markers_cnt].id = ESD_MARKER;
+		enc_markers[enc_markers_cnt].pos_in = pos;
+		enc_markers[enc_markers_cnt].pos_out = pos + AllMarkers_len;
+		enc_markers[enc_markers_cnt].tile_num = tile_count;
+		esd = &enc_markers[enc_markers_cnt].m.esd;
+		esd->addrm = w_params.esd_mode - 1;	// 0 - пакетный режим, 1 - байтовый диапазон
+		esd->interv_start = i_s;
+		esd->interv_cnt = i_k;
+		esd->Lesd = (uint16_t)(esd_ln - 2);
+		esd->Cesd = 0;					// ESD относится ко всем компонентам
+		esd->Pesd = esd->addrm ? ESD_PESD_BYTE_RANGE : ESD_PESD_PACKETS;
+		enc_markers[enc_markers_cnt++].len = esd->Lesd;
+		AllMarkers_len += esd_ln;
+		AllTileEpb_ln += esd_ln;
+	}
 
 	for (i = 0; i < i_k; i++) {
 		e_intervals[i + i_s].start += AllTileEpb_ln;
@@ -494,6 +711,21 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 	return 0;
 }
 
+/**
+ * \brief  Приведение кодов завершения функций разметки маркеров к кодам w_encoder_call
+ * \param  exit_code Код завершения enc_mh_markers_create или enc_th_markers_create
+ * \return Код завершения в терминах w_encoder_call
+ */
+errno_t enc_markers_error(int exit_code)
+{
+	switch (exit_code)
+	{
+	case -1: return -4;
+	case -4: return -5;
+	default: return exit_code;
+	};
+}
+
 /**
  * \brief Создание маркеров jpwl в массиве enc_markers
  * \details Вызывает функции создания маркеров в основном заголовке и заголовках тайлов
@@ -505,46 +737,33 @@ int enc_th_markers_create(addr_char* tile, uint16_t* tile_packets, uint8_t* pack
 errno_t enc_w_markers_create(uint8_t* inp_buf, uint8_t* out_buf, uint16_t* tile_packets, uint8_t* pack_sens)
 {
 	uint8_t* p = inp_buf;
-	int exit_code, i;
-	uint32_t epc_plus_size, epb0_plus_size, l_rs;
+	int exit_code;
+	uint32_t i, epc_plus_size, epb0_plus_size, l_rs;
 	double f;
 
 	exit_code = enc_mh_markers_create(&p);
-	if (exit_code) {
-		switch (exit_code)
-		{
-		case -1: return -4;
-		case -2: return -2;
-		case -3: return -3;
-		case -4: return -5;
-		};
-	}
+	if (exit_code)
+		return enc_markers_error(exit_code);
 	// цикл, перебирающий тайлы
 	pack_count = 0;
 	for (tile_count = 0; p != NULL; tile_count++) {
 		exit_code = enc_th_markers_create(&p, tile_packets, pack_sens, inp_buf);
-		if (exit_code) { // создаем маркеры в заголовке тайла
-			switch (exit_code)
-			{
-			case -1: return -4;
-			case -2: return -2;
-			case -3: return -3;
-			case -4: return -5;
-			};
-		}
-		if (tile_count == (MAX_TILES - 1) && p != NULL)
-			return -1;
+		if (exit_code) // создаем маркеры в заголовке тайла
+			return enc_markers_error(exit_code);
 	};
-	// Здесь в случае использования внутрикадрового интерлейсинга отводится 
-	// место под карту EPB в маркере EPC и изменяются размеры маркеров EPC и EPB основного заголовка
+	// Здесь в случае использования внутрикадрового интерлейсинга и таблицы позиций тайлов отводится 
+	// место под карту EPB и таблицу в маркере EPC и изменяются размеры маркеров EPC и EPB основного заголовка
 	epc_plus_size = w_params.interleave_used ? 6 + 10 * epb_count : 0;		// Увеличение размера EPC при использовании Ammendment
-	epb0_plus_size = 0;				// Увеличение размера первого EPB при использовании Ammendment
-	if (w_params.interleave_used) {	// Коррекция длин и позиций маркеров при использовании Ammendment
+	enc_tile_hints = w_params.tile_hints ? _true_ : _false_;
+	if (enc_tile_hints)
+		epc_plus_size += 6 + 4 * tile_count;	// ID, Lid, количество тайлов и смещения SOT
+	epb0_plus_size = 0;				// Увеличение размера первого EPB при использовании информативных методов
+	if (epc_plus_size) {	// Коррекция длин и позиций маркеров при использовании информативных методов
 		enc_markers[1].len += (uint16_t)epc_plus_size;	// Коррекция длины EPC
 		enc_markers[1].m.epc.Lepc = (uint16_t)enc_markers[1].len;
 		enc_markers[1].m.epc.Pepc |= 0x80;	// Установка в EPC признака использования информативных методов
 		enc_markers[0].m.epb.LDPepb += epc_plus_size;	// Увеличиваем длину защищаемых данных для первого EPB
-		enc_markers[0].len = (uint16_t)enc_markers[0].m.epb.LDPepb;
+		enc_markers[0].len = enc_markers[0].m.epb.LDPepb;
 		enc_markers[0].m.epb.post_len += epc_plus_size;	// Увеличиваем длину пост-данных для первого EPB
 
 		f = (double)enc_markers[0].m.epb.post_len;
@@ -558,9 +777,12 @@ errno_t enc_w_markers_create(uint8_t* inp_buf, uint8_t* out_buf, uint16_t* tile_
 		else										// нет защиты
 			l_rs = 0;
 		l_rs += EPB_LN + 96;			// + длина постоянной части + длина RS-кодов для пре данных
+		if (l_rs > MAX_EPBSIZE || enc_markers[1].len > MAX_EPBSIZE)
+			return -3; // одного EPB мало
 
-		epb0_plus_size = (uint16_t)(l_rs - enc_markers[0].m.epb.Lepb);	// вычисляем добавку к длине сегмента первого EPB при использовании Ammendment
-		enc_markers[0].m.epb.Lepb = (uint16_t)enc_markers[0].len = (uint16_t)l_rs;	// Обновляем длину сегмента первого EPB
+		epb0_plus_size = (uint16_t)(l_rs - enc_markers[0].m.epb.Lepb);	// вычисляем добавку к длине сегмента первого EPB при использовании информативных методов
+		enc_markers[0].len = (uint16_t)l_rs;	// Обновляем длину сегмента первого EPB
+		enc_markers[0].m.epb.Lepb = (uint16_t)l_rs;
 		enc_markers[1].pos_out += epb0_plus_size;			// Корректируем позицию EPC в вых. буфере на величину увеличения первого EPB
 		h_length[0] += epc_plus_size + epb0_plus_size;		// Коррекция длины основного заголовка
 		for (i = 2; i < enc_markers_cnt; i++) {		// Коррекция позиции в выходном буфере всех маркеров после EPC на величину увеличения первого EPB и EPC
@@ -597,6 +819,31 @@ void enc_data_copy(uint8_t* inp_buf, uint8_t* out_buf) {
 		memcpy(o_b, inp_buf, (size_t)enc_epc_dl - j);
 }
 
+/**
+ * \brief  Раздвижка данных кодового потока jpeg2000 часть1 на месте под сегменты маркеров jpwl
+ * \details Аналог enc_data_copy для случая, когда входной и выходной буферы совпадают.
+ *		Каждый маркер сдвигает все последующие данные вперед, поэтому участки
+ *		переносятся с конца потока к началу, и еще не перенесенные данные не затираются.
+ *		Буфер должен вмещать выходной поток целиком (см. jpwl_enc_plan)
+ * \param buf Буфер, содержащий кодовый поток jpeg2000 часть1
+ */
+void enc_data_move(uint8_t* buf) {
+	size_t shift = 0, out_start;
+	uint32_t i;
+
+	for (i = 0; i < enc_markers_cnt; i++)		// суммарная длина всех сегментов с маркерами
+		shift += enc_markers[i].len + 2ULL;
+	out_start = enc_markers[enc_markers_cnt - 1].pos_out + enc_markers[enc_markers_cnt - 1].len + 2;
+	if (enc_epc_dl > out_start)		// данные после последнего маркера
+		memmove(buf + out_start, buf + out_start - shift, enc_epc_dl - out_start);
+	for (i = enc_markers_cnt; i-- > 0;) {
+		shift -= enc_markers[i].len + 2ULL;	// длина сегментов, вставленных перед участком
+		out_start = i ? enc_markers[i - 1].pos_out + enc_markers[i - 1].len + 2 : 0;
+		if (enc_markers[i].pos_out > out_start && shift)
+			memmove(buf + out_start, buf + out_start - shift, enc_markers[i].pos_out - out_start);
+	}
+}
+
 /**
  * \brief Копирование в выходной буфер маркера и сегмента маркера EPB кроме входящих в сегмент кодов четности
  * \param epb Ссылка на структуру w_marker с параметрами маркера EPB
@@ -608,10 +855,8 @@ void enc_epb_copy(w_marker* marker, uint8_t* out_buf) {
 	epb_ms* e = &marker->m.epb;
 
 	// первый EPB в заголовке - следует скорректировать в сегменте маркера SOT адрес старшего байта Psot
-	if (marker->tile_num >= 0 && e->index == 0) {
-		uint32_t* p = (uint32_t*)(Psot_new + marker->tile_num); // адрес мл. байта нового значения Psot
-		*(uint32_t*)(c - 6) = _byteswap_ulong(*p);
-	};
+	if (marker->tile_num >= 0 && e->index == 0)
+		*(uint32_t*)(c - 6) = _byteswap_ulong(Psot_new[marker->tile_num]);
 	*(uint16_t*)c = _byteswap_ushort(marker->id);
 	c += 2;
 	*(uint16_t*)c = _byteswap_ushort(e->Lepb);
@@ -626,7 +871,7 @@ void enc_epb_copy(w_marker* marker, uint8_t* out_buf) {
 		epc_point += 4;		
 		*(uint16_t*)epc_point = _byteswap_ushort(e->Lepb); // Запись Lebp 2 байта
 		epc_point += 2;		
-		*(uint32_t*)epc_point = _byteswap_ulong(marker->pos_out); // Запись Oepb
+		*(uint32_t*)epc_point = _byteswap_ulong((uint32_t)marker->pos_out); // Запись Oepb (32 бита по T.810)
 		epc_point += 4;
 	}
 }
@@ -641,6 +886,7 @@ void enc_epb_copy(w_marker* marker, uint8_t* out_buf) {
 void enc_epc_copy(w_marker* marker, unsigned char* out_buf) {
 	uint8_t* c = out_buf + marker->pos_out;
 	uint16_t Lid;
+	uint32_t i;
 	epc_ms* e = &marker->m.epc;
 
 	*(uint16_t*)c = _byteswap_ushort(marker->id);
@@ -649,9 +895,22 @@ void enc_epc_copy(w_marker* marker, unsigned char* out_buf) {
 	c += 2;
 	*(uint16_t*)c = _byteswap_ushort(e->Pcrc);
 	c += 2;
-	*(uint32_t*)c = _byteswap_ulong(e->DL);
+	*(uint32_t*)c = _byteswap_ulong((uint32_t)e->DL);
 	c += 4;
 	*c++ = e->Pepc;
+	if (enc_tile_hints) {	// Таблица позиций тайлов: смещения маркеров SOT от начала потока
+		*(uint16_t*)c = _byteswap_ushort(INF_TILE_POS_ID);
+		c += 2;
+		*(uint16_t*)c = _byteswap_ushort((uint16_t)(2 + 4 * tile_count));
+		c += 2;
+		*(uint16_t*)c = _byteswap_ushort(tile_count);
+		c += 2;
+		for (i = 2; i < enc_markers_cnt; i++)
+			if (enc_markers[i].id == EPB_MARKER && enc_markers[i].tile_num >= 0 && enc_markers[i].m.epb.index == 0) {
+				*(uint32_t*)c = _byteswap_ulong((uint32_t)enc_markers[i].pos_out - (SOT_LN + 2));	// первый EPB сразу за SOT
+				c += 4;
+			}
+	}
 	if (w_params.interleave_used) {	// Используем Ammendment
 		*c++ = 0x02;				// ID=0x0200 - внутрикадровое чередование
 		*c++ = 0x00;
@@ -686,7 +945,7 @@ void enc_esd_copy(w_marker* marker, uint8_t* out_buf, uint16_t* tile_packets) {
 	if (e->addrm == 1 && e->interv_cnt == 0) { // байтовый диапазон без интервалов
 		*(uint32_t*)c = 0;	// смещение начала заголовка 
 		c += 4;
-		*(uint32_t*)c = _byteswap_ulong(h_length[marker->tile_num + 1]); // смещение последнего байта заголовка
+		*(uint32_t*)c = _byteswap_ulong((uint32_t)h_length[marker->tile_num + 1]); // смещение последнего байта заголовка
 		c += 4;
 		*c++ = 0xff;
 	}
@@ -714,7 +973,7 @@ void enc_esd_copy(w_marker* marker, uint8_t* out_buf, uint16_t* tile_packets) {
  * \param pack_sens Массив данных об относительной чувствительности пакетов к ошибках (значения 0 - 255). В массиве pack_sens сначала идут данные о пакетах первого по порядку тайла в порядке расположения пакетов, затем второго и т.д.
  */
 void enc_markers_copy(uint8_t* out_buf, uint16_t* tile_packets, uint8_t* pack_sens) {
-	int i;
+	uint32_t i;
 
 	cur_pack = pack_sens;
 	for (i = 0; i < enc_markers_cnt; i++)	// перебор маркеров из массива enc_markers
@@ -743,7 +1002,8 @@ void enc_fill_epb(uint8_t* out_buf)
 	uint8_t data_buf[64];
 	uint8_t* tile_adr = out_buf;	// адрес текущего тайла
 	uint16_t crc16_buf;
-	int i, j, l = 0, n_rs_old, k_rs_old, n_rs, k_rs;
+	uint32_t i;
+	int j, l = 0, n_rs_old, k_rs_old, n_rs, k_rs;
 	uint32_t crc32_buf;
 	int_struct* cur_int;
 	epb_ms* e;
@@ -786,6 +1046,8 @@ void enc_fill_epb(uint8_t* out_buf)
 					tile_adr = out_buf + enc_markers[i].pos_out - SOT_LN - 2;
 					// адрес начала пост-данных: началo тайла + смещение последнего байта заголовка тайла - длина пост-данных + 1
 					postdata_start = tile_adr + h_length[enc_markers[i].tile_num + 1] - e->post_len + 1;
+					if (e->Depb & 0x40)		// данные тайла не защищаются (tile_codes): его интервал без EPB
+						cur_int++;
 				}
 			}
 			else {	// не первый EPB в заголовке (защита данных тайла)
@@ -848,33 +1110,41 @@ void enc_fill_epb(uint8_t* out_buf)
 
 /**
  * \brief Вычисление контрольной суммы для сегмента EPC и занесение ее в выходной буфер
- * \return Нет возвращаемого значения
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
  */
-void enc_epc_crc()
+errno_t enc_epc_crc()
 {
-	uint8_t* c;
+	uint8_t* c, * scratch;
 	uint16_t l_epc, crc;
 
+	scratch = (uint8_t*)w_arena_alloc(&enc_arena, (size_t)enc_markers[1].len + 2);
+	if (!scratch)
+		return -1;
 	c = w_params.out_buffer + enc_markers[1].pos_out;	// Адрес начала EPC в выходном буфере
 	l_epc = (uint16_t)(enc_markers[1].len + 2);		// Длина сегмента вместе с маркером
-	memcpy(imatrix, c, 4);
-	memcpy(imatrix + 4, c + 6, l_epc - 6ULL);
-	crc = CRC16(imatrix, l_epc - 2);
+	memcpy(scratch, c, 4);
+	memcpy(scratch + 4, c + 6, l_epc - 6ULL);
+	crc = CRC16(scratch, l_epc - 2);
 	*(uint16_t*)(c + 4) = _byteswap_ushort(crc);
+	return 0;
 }
 
 /**
  * \brief Внетрикадровая перестановка выходного потока согласно Ammendment
- * \return Нет возвращаемого значения
+ * \details Буфер перестановки imatrix берется из арены кадра.
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
  */
-void interleave_outstream()
+errno_t interleave_outstream()
 {
-	uint8_t* c;
-	uint32_t Nc, Nr, Len, i, j, k = 0;
+	uint8_t* c, * imatrix;
+	size_t Nc, Nr, Len, i, j, k = 0;
 
 	Len = enc_epc_dl - (h_length[0] + 1);		// Длина переставляемых данных: общая длина минус основной заголовок
-	Nc = (uint32_t)ceil(sqrt((double)Len));	// Количество столбцов
-	Nr = (uint32_t)ceil(((double)Len / Nc));			// Количество строк
+	Nc = (size_t)ceil(sqrt((double)Len));	// Количество столбцов
+	Nr = (size_t)ceil(((double)Len / Nc));			// Количество строк
+	imatrix = (uint8_t*)w_arena_alloc(&enc_arena, Nc * Nr);
+	if (!imatrix)
+		return -1;
 	c = w_params.out_buffer + h_length[0] + 1;
 	for (j = 0; j < Nc; j++) {
 		for (i = 0; i < Nr; i++) {
@@ -884,36 +1154,89 @@ void interleave_outstream()
 		}
 	}
 mcop:
-	memcpy(w_params.out_buffer + h_length[0] + 1, imatrix, (size_t)Nc * Nr);
+	for (i++; j < Nc; j++, i = 0)	// дополнение матрицы нулями, а не содержимым арены
+		for (; i < Nr; i++)
+			imatrix[i * Nc + j] = 0;
+	memcpy(w_params.out_buffer + h_length[0] + 1, imatrix, Nc * Nr);
 	amm_len = h_length[0] + 1 + Nc * Nr;
+	return 0;
+}
+
+/**
+ * \brief Длина выходного кодового потока по рассчитанной в enc_w_markers_create раскладке маркеров
+ * \details При использовании Ammendment переставляемые данные дополняются до полной матрицы Nc x Nr
+ * \return Длина выходного кодового потока в байтах
+ */
+size_t enc_out_length()
+{
+	size_t Nc, Nr, Len;
+
+	if (!w_params.interleave_used)
+		return enc_epc_dl;
+	Len = enc_epc_dl - (h_length[0] + 1);
+	Nc = (size_t)ceil(sqrt((double)Len));
+	Nr = (size_t)ceil(((double)Len / Nc));
+	return h_length[0] + 1 + Nc * Nr;
+}
+
+/**
+ * \brief Заполнение таблиц позиций и начальных байт заголовков тайлов для jpwl_enc_bResults
+ * \details Выполняется до переноса данных, так как в режиме кодирования на месте
+ *		входной поток затирается
+ * \param inp_buf Ссылка на буфер с входным кодовым потоком
+ * \return 0 - все нормально, -1 - ошибка выделения памяти
+ */
+errno_t enc_tile_tables_fill(uint8_t* inp_buf)
+{
+	int tileNum = -1;
+
+	if (w_table_reserve(NULL, (void**)&enc_tile_pos, &enc_tile_pos_cap, sizeof(size_t), (size_t)tile_count + 1)
+		|| w_table_reserve(NULL, (void**)&enc_tile_hdr, &enc_tile_hdr_cap, TILE_HEADER_COPY, (size_t)tile_count + 1))
+		return -1;
+	for (uint32_t i = 0; i < enc_markers_cnt; i++) {
+		if (enc_markers[i].tile_num == tileNum) continue;
+		tileNum = enc_markers[i].tile_num;
+		enc_tile_pos[tileNum] = (size_t)enc_markers[i].pos_in;
+		memcpy(enc_tile_hdr[tileNum], inp_buf + enc_markers[i].pos_in, TILE_HEADER_COPY);
+	}
+	return 0;
 }
 
 /**
  * \brief Кодер jpwl
  * \param  inbuf Ссылка на начало буфера, в котором находится кодовый поток jpeg200 часть 1
- * \param  outbuf  Ссылка на начало буфера, в который будет помещен кодовый поток jpeg200 часть 2 с внедренными в него средствами защиты от ошибок jpwl
+ * \param  outbuf  Ссылка на начало буфера, в который будет помещен кодовый поток jpeg200 часть 2 с внедренными в него средствами защиты от ошибок jpwl.
+ *		Может совпадать с inbuf - тогда кодирование выполняется на месте
  * \param  tile_packets  Массив, содержащий количество пакетов в каждом тайле потока: tile_packets[i] - количество пакетов i-го по порядку от начала кодового потока тайла
  * \param  pack_sens Массив данных об относительной чувствительности пакетов к ошибках (значения 0 - 254). В массиве pack_sens сначала идут данные о пакетах первого по порядку тайла в порядке расположения пакетов, затем второго и т.д.
+ * \param  inp_len Длина входного кодового потока в байтах
  * \param out_len  Адрес переменной в которую заносится длина выходного кодированного потока (количество байт, записанных в outbuf)
  */
-errno_t w_encoder(uint8_t* inp_buf, uint8_t* out_buf, uint16_t* tile_packets,
-	uint8_t* pack_sens, uint32_t* out_len)
+errno_t w_encoder(uint8_t* inp_buf, size_t inp_len, uint8_t* out_buf, uint16_t* tile_packets,
+	uint8_t* pack_sens, size_t* out_len)
 {
 	int exit_code;
 
-	if (w_enc_init(inp_buf)) {
-		return -6;		// если неверные значеня параметров - выход
+	if (w_enc_init(inp_buf, inp_len)) {
+		return -1;		// нет памяти под таблицы кодера - выход
 	};
 	exit_code = enc_w_markers_create(inp_buf, out_buf, tile_packets, pack_sens);
 	if (exit_code) {
 		return exit_code;
 	};
-	enc_data_copy(inp_buf, out_buf);
+	if (enc_tile_tables_fill(inp_buf))
+		return -1;
+	if (inp_buf == out_buf)
+		enc_data_move(out_buf);		// кодирование на месте
+	else
+		enc_data_copy(inp_buf, out_buf);
 	enc_markers_copy(out_buf, tile_packets, pack_sens); // копирование маркеров в вых. буфер
-	enc_epc_crc();					// Вычисление контрольной суммы для сегмента EPC
+	if (enc_epc_crc())				// Вычисление контрольной суммы для сегмента EPC
+		return -1;
 	enc_fill_epb(out_buf);			// заполнение блоков EPB кодами четности
 	if (w_params.interleave_used) { // Используем Ammendment
-		interleave_outstream();
+		if (interleave_outstream())
+			return -1;
 		*out_len = amm_len;			// Длина при использовании Ammendment
 	}
 	else
@@ -921,12 +1244,24 @@ errno_t w_encoder(uint8_t* inp_buf, uint8_t* out_buf, uint16_t* tile_packets,
 	return 0;
 }
 
+/**
+ * \brief  Перенос параметров защиты в рабочие переменные кодера
+ * \param  params Cсылка на структуру w_enc_params со значениями параметров кодера
+ */
+void enc_params_apply(w_enc_params* params)
+{
+	wcoder_mh_param = params->wcoder_mh;
+	wcoder_th_param = params->wcoder_th;
+	wcoder_data_param = params->wcoder_data;
+	interleave_use = params->interleave_used;
+}
+
 /**
  * \brief  Yстановкa параметров кодера
  * \param  params Cсылка на структуру w_enc_params со значениями параметров кодера
  * \return Код завершения: 
  *  0 - все нормально
- * -1 - недостаточно места в буферах для тайлов
+ * -1 - ошибка выделения памяти под таблицы кодера
  * -2 - неверная структура кодового потока jpeg2000 часть 1
  * -3 - слишком большой заголовок, недостаточно одного EPB
  * -4 - недостаточно места в массиве для размещения всех маркеров
@@ -937,13 +1272,11 @@ errno_t w_encoder_call(w_enc_params* params)
 {
 	int res;
 
-	wcoder_mh_param = params->wcoder_mh;
-	wcoder_th_param = params->wcoder_th;
-	wcoder_data_param = params->wcoder_data;
-	interleave_use = params->interleave_used;
-	res = w_encoder(params->inp_buffer, params->out_buffer, params->tile_packets,
+	enc_params_apply(params);
+	res = w_encoder(params->inp_buffer, params->inp_length, params->out_buffer, params->tile_packets,
 		params->packet_sense, &(params->wcoder_out_len));
-	params->wcoder_mh_len = h_length[0] + 1; // Записываем длину основного заголовка
+	if (!res)
+		params->wcoder_mh_len = h_length[0] + 1; // Записываем длину основного заголовка
 	return res;
 }
 
@@ -959,6 +1292,10 @@ void jpwl_enc_set_default_params(jpwl_enc_params* params)
 	params->wcoder_data = 64;
 	params->jpwl_enc_mode = 1;		// Использовать jpwl
 	params->interleave_used = 0;	// Использовать Ammendment
+	params->tile_hints = 0;		// Таблица позиций тайлов в EPC
+	params->esd_mode = 0;		// ESD в заголовках тайлов
+	params->tile_codes = NULL;	// Один код защиты данных для всех тайлов
+	params->tile_codes_cnt = 0;
 }
 
 /**
@@ -973,12 +1310,17 @@ void jpwl_enc_init(jpwl_enc_params* params)
 	w_params.wcoder_data = params->wcoder_data;
 	w_params.interleave_used = params->interleave_used;
 	w_params.jpwl_enc_mode = params->jpwl_enc_mode;
+	w_params.tile_hints = params->tile_hints;
+	w_params.esd_mode = params->esd_mode;
+	w_params.tile_codes = params->tile_codes;
+	w_params.tile_codes_cnt = params->tile_codes ? params->tile_codes_cnt : 0;
 }
 
 /**
  * \brief  Запуск кодера jpwl
  * \param  inp_buf Cсылка на входной буфер
- * \param  out_buf Cсылка на выходной буфер
+ * \param  out_buf Cсылка на выходной буфер; может совпадать с inp_buf - тогда кодирование
+ *		выполняется на месте, и размер буфера должен быть не меньше длины из jpwl_enc_plan
  * \param  bParams Cсылка на структуру jpwl_enc_bParams с дополнительными данными для кодера
  * \param  bResults Cсылка на структуру jpwl_enc_bResults с дополнительными результатами кодера
  */
@@ -991,34 +1333,369 @@ errno_t jpwl_enc_run(uint8_t* inp_buf, uint8_t* out_buf,
 	addr_char ac;
 
 	w_params.inp_buffer = inp_buf;
+	w_params.inp_length = bParams->stream_len;
 	w_params.out_buffer = out_buf;
 	w_params.tile_packets = bParams->tile_packets;
 	w_params.packet_sense = bParams->pack_sens;
 	if (w_params.jpwl_enc_mode) {		// кодирование при использовании jpwl
 		res = w_encoder_call(&w_params);
-		if (res)
+		if (res) {
+			w_arena_reset(&enc_arena);
 			return -1;
+		}
 		bResults->wcoder_out_len = w_params.wcoder_out_len;
 		bResults->wcoder_mh_len = w_params.wcoder_mh_len;
-		int tileNum = -1;
-		for (int i = 0; i < enc_markers_cnt; i++) {
-			if (enc_markers[i].tile_num == tileNum) continue;
-			tileNum = enc_markers[i].tile_num;
-			bResults->tile_position[tileNum] = enc_markers[i].pos_in;
-			memcpy(bResults->tile_headers[tileNum], inp_buf + enc_markers[i].pos_in, sizeof(bResults->tile_headers[0]));
-		}
+		bResults->tile_count = tile_count;
+		bResults->tile_position = enc_tile_pos;
+		bResults->tile_headers = enc_tile_hdr;
+		w_arena_reset(&enc_arena);		// конец кадра: таблицы маркеров больше не нужны
 	}
 	else {
-		memcpy(out_buf, inp_buf, bParams->stream_len);
+		if (out_buf != inp_buf)
+			memcpy(out_buf, inp_buf, bParams->stream_len);
 		bResults->wcoder_out_len = bParams->stream_len;
+		bResults->tile_count = 0;
+		bResults->tile_position = NULL;
+		bResults->tile_headers = NULL;
 		v = mark_search(inp_buf, SOT_LOW, EOC_LOW, &ac); // поиск первого тайла
 		if (v == NULL)
 			return -2;
-		bResults->wcoder_mh_len = (uint32_t)(v - inp_buf);	// длина основного заголовка
+		bResults->wcoder_mh_len = (size_t)(v - inp_buf);	// длина основного заголовка
 	};
 	return 0;
 }
 
+/**
+ * \brief  Расчет точной длины выходного потока кодера jpwl без кодирования
+ * \details Выполняет разметку маркеров jpwl с текущими параметрами кодера, не обращаясь
+ *		к выходному буферу. Полученная длина равна wcoder_out_len, который вернет jpwl_enc_run
+ *		для того же потока. Для кодирования на месте (out_buf == inp_buf в jpwl_enc_run)
+ *		входной буфер должен иметь размер не менее этой длины
+ * \param  inp_buf Cсылка на входной буфер
+ * \param  bParams Cсылка на структуру jpwl_enc_bParams с дополнительными данными для кодера
+ * \param  out_len Адрес переменной, в которую заносится длина выходного потока
+ * \return Код завершения как у w_encoder_call
+ */
+__declspec(dllexport)
+errno_t jpwl_enc_plan(uint8_t* inp_buf, jpwl_enc_bParams* bParams, size_t* out_len)
+{
+	errno_t res;
+
+	if (!w_params.jpwl_enc_mode) {	// поток копируется без изменений
+		*out_len = bParams->stream_len;
+		return 0;
+	}
+	enc_params_apply(&w_params);
+	if (w_enc_init(inp_buf, bParams->stream_len))
+		res = -1;
+	else
+		res = enc_w_markers_create(inp_buf, NULL, bParams->tile_packets, bParams->pack_sens);
+	if (!res)
+		*out_len = enc_out_length();
+	w_arena_reset(&enc_arena);
+	return res;
+}
+
+/**
+ * \brief  Копирование части кодового потока в арену с добавлением ограничителя
+ * \details Функции разметки ищут конец заголовка или тайла по следующему маркеру SOT,
+ *		поэтому за скопированными данными ставится маркер SOT
+ * \param  buf Ссылка на данные
+ * \param  len Длина данных в байтах
+ * \return Ссылка на копию в арене или NULL при нехватке памяти
+ */
+uint8_t* enc_stream_staging(uint8_t* buf, size_t len)
+{
+	uint8_t* staging = (uint8_t*)w_arena_alloc(&enc_arena, len + 2);
+
+	if (staging) {
+		memcpy(staging, buf, len);
+		staging[len] = 0xFF;
+		staging[len + 1] = SOT_LOW;
+	}
+	return staging;
+}
+
+/**
+ * \brief  Защита основного заголовка при потоковом кодировании
+ * \param  mh_buf Cсылка на основной заголовок jpeg2000 часть 1
+ * \param  mh_len Длина основного заголовка в байтах
+ * \param  out_buf Cсылка на буфер для защищенного основного заголовка
+ * \return Код завершения как у w_encoder_call
+ */
+errno_t enc_stream_mh_create(uint8_t* mh_buf, size_t mh_len, uint8_t* out_buf)
+{
+	uint8_t* p;
+	int exit_code;
+
+	if (enc_frame_reset(1))
+		return -1;
+	p = enc_stream_staging(mh_buf, mh_len);
+	if (!p)
+		return -1;
+	mh_buf = p;
+	exit_code = enc_mh_markers_create(&p);
+	if (exit_code)
+		return enc_markers_error(exit_code);
+	enc_epc_dl = mh_len + AllMarkers_len;
+	enc_markers[1].m.epc.DL = 0;		// длина потока станет известна в jpwl_enc_stream_end
+	w_params.out_buffer = out_buf;
+	enc_data_copy(mh_buf, out_buf);
+	enc_markers_copy(out_buf, NULL, NULL);
+	if (enc_epc_crc())
+		return -1;
+	enc_fill_epb(out_buf);
+	memcpy(enc_stream_mh, enc_markers, sizeof(enc_stream_mh));
+	enc_stream_mh_len = enc_epc_dl;
+	return 0;
+}
+
+/**
+ * \brief  Защита одного тайла при потоковом кодировании
+ * \details Позиции маркеров тайла отсчитываются от начала тайла, поэтому разметка
+ *		не зависит от предыдущих тайлов
+ * \param  tile_buf Cсылка на тайл (от маркера SOT до конца данных тайла)
+ * \param  tile_len Длина тайла в байтах, должна совпадать с Psot
+ * \param  packets Количество пакетов тайла
+ * \param  pack_sens Cсылка на значения чувствительности пакетов тайла
+ * \param  out_buf Cсылка на буфер для защищенного тайла
+ * \param  out_len Адрес переменной, в которую заносится длина защищенного тайла
+ * \return Код завершения как у w_encoder_call
+ */
+errno_t enc_stream_tile_create(uint8_t* tile_buf, size_t tile_len, uint16_t packets, uint8_t* pack_sens,
+	uint8_t* out_buf, size_t* out_len)
+{
+	uint8_t* p;
+	int exit_code;
+
+	if (tile_len < SOT_LN + 4ULL || tile_buf[0] != 0xFF || tile_buf[1] != SOT_LOW
+		|| _byteswap_ulong(*(uint32_t*)(tile_buf + 6)) != tile_len)
+		return -2;
+	if (enc_frame_reset(1))
+		return -1;
+	p = enc_stream_staging(tile_buf, tile_len);
+	if (!p)
+		return -1;
+	tile_buf = p;
+	tile_count = 0;
+	enc_tile_first = enc_stream_tiles;
+	exit_code = enc_th_markers_create(&p, &packets, pack_sens, tile_buf);
+	if (exit_code)
+		return enc_markers_error(exit_code);
+	enc_epc_dl = tile_len + AllMarkers_len;
+	w_params.out_buffer = out_buf;
+	enc_data_copy(tile_buf, out_buf);
+	enc_markers_copy(out_buf, &packets, pack_sens);
+	enc_fill_epb(out_buf);
+	*out_len = enc_epc_dl;
+	return 0;
+}
+
+/**
+ * \brief  Начало потокового кодирования jpwl: защита основного заголовка
+ * \details Защищенный основной заголовок можно передавать сразу: поле DL сегмента EPC в нем
+ *		нулевое, и декодер (jpwl_dec_run, jpwl_dec_stream_*) считает длиной кадра длину принятых данных.
+ *		jpwl_enc_stream_end исправляет DL, контрольную сумму EPC и коды четности
+ *		EPB в копии заголовка, сохраненной вызывающей стороной, для хранения кадра целиком.
+ *		Внутрикадровое чередование (Ammendment) требует всего кадра и в потоковом режиме недоступно
+ * \param  mh_buf Cсылка на основной заголовок jpeg2000 часть 1 (от SOC до первого SOT)
+ * \param  mh_len Длина основного заголовка в байтах
+ * \param  out_buf Cсылка на буфер для защищенного основного заголовка
+ * \param  out_len Адрес переменной, в которую заносится длина защищенного основного заголовка
+ * \return Код завершения как у w_encoder_call
+ */
+__declspec(dllexport)
+errno_t jpwl_enc_stream_begin(uint8_t* mh_buf, size_t mh_len, uint8_t* out_buf, size_t* out_len)
+{
+	errno_t res;
+
+	enc_stream_len = 0;
+	enc_stream_mh_len = 0;
+	enc_stream_tiles = 0;
+	if (!w_params.jpwl_enc_mode) {		// без jpwl данные передаются без изменений
+		memcpy(out_buf, mh_buf, mh_len);
+		enc_stream_len = enc_stream_mh_len = *out_len = mh_len;
+		return 0;
+	}
+	if (w_params.interleave_used)
+		return -6;
+	enc_params_apply(&w_params);
+	res = enc_stream_mh_create(mh_buf, mh_len, out_buf);
+	w_arena_reset(&enc_arena);
+	if (res) {
+		enc_stream_mh_len = 0;
+		return res;
+	}
+	enc_stream_len = *out_len = enc_stream_mh_len;
+	return 0;
+}
+
+/**
+ * \brief  Потоковое кодирование jpwl очередного тайла
+ * \details Тайлы передаются по одному в порядке следования в кодовом потоке
+ * \param  tile_buf Cсылка на тайл (от маркера SOT до конца данных тайла)
+ * \param  tile_len Длина тайла в байтах, должна совпадать с Psot
+ * \param  packets Количество пакетов тайла
+ * \param  pack_sens Cсылка на значения чувствительности пакетов тайла
+ * \param  out_buf Cсылка на буфер для защищенного тайла
+ * \param  out_len Адрес переменной, в которую заносится длина защищенного тайла
+ * \return Код завершения как у w_encoder_call
+ */
+__declspec(dllexport)
+errno_t jpwl_enc_stream_tile(uint8_t* tile_buf, size_t tile_len, uint16_t packets, uint8_t* pack_sens,
+	uint8_t* out_buf, size_t* out_len)
+{
+	errno_t res;
+
+	if (!enc_stream_mh_len)		// поток не начат
+		return -2;
+	if (!w_params.jpwl_enc_mode) {
+		memcpy(out_buf, tile_buf, tile_len);
+		*out_len = tile_len;
+		enc_stream_len += tile_len;
+		return 0;
+	}
+	enc_params_apply(&w_params);
+	res = enc_stream_tile_create(tile_buf, tile_len, packets, pack_sens, out_buf, out_len);
+	w_arena_reset(&enc_arena);
+	if (!res) {
+		enc_stream_len += *out_len;
+		enc_stream_tiles++;
+	}
+	return res;
+}
+
+/**
+ * \brief  Завершение потокового кодирования jpwl
+ * \details Выдает маркер EOC и заносит окончательную длину потока в основной заголовок,
+ *		ранее выданный jpwl_enc_stream_begin, пересчитывая контрольную сумму EPC и коды четности EPB
+ * \param  mh_buf Cсылка на защищенный основной заголовок, выданный jpwl_enc_stream_begin
+ * \param  out_buf Cсылка на буфер для маркера EOC (2 байта)
+ * \param  out_len Адрес переменной, в которую заносится длина данных в out_buf
+ * \return 0 - все нормально, -1 - ошибка выделения памяти, -2 - поток не начат
+ */
+__declspec(dllexport)
+errno_t jpwl_enc_stream_end(uint8_t* mh_buf, uint8_t* out_buf, size_t* out_len)
+{
+	errno_t res = 0;
+
+	if (!enc_stream_mh_len)
+		return -2;
+	out_buf[0] = 0xFF;
+	out_buf[1] = EOC_LOW;
+	*out_len = 2;
+	enc_stream_len += 2;
+	if (w_params.jpwl_enc_mode) {
+		enc_params_apply(&w_params);
+		if (enc_frame_reset(1))
+			res = -1;
+		else {
+			memcpy(enc_markers, enc_stream_mh, sizeof(enc_stream_mh));
+			enc_markers_cnt = 2;
+			h_length[0] = enc_stream_mh_len - 1;
+			enc_markers[1].m.epc.DL = (unsigned long)enc_stream_len;
+			w_params.out_buffer = mh_buf;
+			enc_markers_copy(mh_buf, NULL, NULL);
+			res = enc_epc_crc();
+			if (!res)
+				enc_fill_epb(mh_buf);
+		}
+		w_arena_reset(&enc_arena);
+	}
+	enc_stream_mh_len = 0;
+	return res;
+}
+
+/**
+ * \brief  Статистика использования памяти под временные данные кадров кодера jpwl
+ * \param  stats Cсылка на структуру jpwl_mem_stats для заполнения
+ */
+__declspec(dllexport)
+void jpwl_enc_mem_stats(jpwl_mem_stats* stats)
+{
+	w_arena_stats(&enc_arena, stats);
+}
+
+/**
+ * \brief  Освобождение таблиц кодера текущего потока
+ */
+void enc_tables_free()
+{
+	w_arena_free(&enc_arena);
+	enc_markers = NULL;
+	enc_markers_cap = 0;
+	e_intervals = NULL;
+	enc_interv_cap = 0;
+	h_length = NULL;
+	h_length_cap = 0;
+	Psot_new = NULL;
+	Psot_new_cap = 0;
+	w_table_free((void**)&enc_tile_pos, &enc_tile_pos_cap);
+	w_table_free((void**)&enc_tile_hdr, &enc_tile_hdr_cap);
+	enc_markers_cnt = 0;
+}
+
+/**
+ * \struct enc_batch
+ * \brief Общие данные пакетного кодирования кадров
+ */
+typedef struct {
+	jpwl_enc_frame* frames;		///< Кадры пакета
+	w_enc_params params;		///< Параметры кодера вызывающего потока
+} enc_batch;
+
+/**
+ * \brief  Кодирование одного кадра пакета в потоке пула
+ * \param  ctx Адрес структуры enc_batch
+ * \param  index Номер кадра в пакете
+ */
+void enc_batch_job(void* ctx, size_t index)
+{
+	enc_batch* batch = (enc_batch*)ctx;
+	jpwl_enc_frame* f = batch->frames + index;
+
+	w_params = batch->params;
+	f->status = jpwl_enc_run(f->inp_buffer, f->out_buffer, &f->params, &f->results);
+	f->results.tile_position = NULL;	// таблицы потока освобождаются по завершении пакета
+	f->results.tile_headers = NULL;
+}
+
+/**
+ * \brief  Освобождение таблиц потока пула по завершении пакетного кодирования
+ * \param  ctx Не используется
+ */
+void enc_batch_done(void* ctx)
+{
+	enc_tables_free();
+	dec_tables_free();
+}
+
+/**
+ * \brief  Пакетное кодирование независимых кадров jpwl
+ * \details Кадры распределяются по потокам, у каждого потока свои таблицы кодера.
+ *		Все кадры кодируются с параметрами, установленными jpwl_enc_init в вызывающем потоке.
+ *		Результат каждого кадра заносится в его структуру jpwl_enc_frame; таблицы позиций
+ *		и заголовков тайлов в пакетном режиме не выдаются (tile_position и tile_headers равны NULL)
+ * \param  frames Cсылка на массив кадров
+ * \param  count Количество кадров
+ * \param  threads Количество потоков, 0 - по количеству процессоров
+ * \return 0 - все кадры закодированы, иначе количество кадров с ненулевым status
+ */
+__declspec(dllexport)
+errno_t jpwl_enc_run_batch(jpwl_enc_frame* frames, size_t count, int threads)
+{
+	enc_batch batch = { frames, w_params };
+	errno_t failed = 0;
+	size_t i;
+
+	w_pool_run(enc_batch_job, enc_batch_done, &batch, count, threads);
+	w_params = batch.params;
+	for (i = 0; i < count; i++)
+		if (frames[i].status)
+			failed++;
+	return failed;
+}
+
 __declspec(dllexport)
 errno_t jpwl_init()
 {
@@ -1042,6 +1719,8 @@ void jpwl_destroy()
 #ifdef RS_OPTIMIZED
 	rs_destroy();
 #endif // RS_OPTIMIZED
+	enc_tables_free();
+	dec_tables_free();
 }
 
 __declspec(dllexport)
@@ -1071,3 +1750,49 @@ void sens_create(unsigned char* input, unsigned short* tile_packets, unsigned ch
 		p_no += tile_packets[j];				// наращиваем тек. номер пакета на кол-во записанных пакетов
 	}
 }
+
+/**
+ * \brief  Вычисление чувствительности пакетов по их вкладу в искажение изображения
+ * \details Ошибка в пакете делает непригодными и все следующие за ним пакеты тайла,
+ *		поэтому чувствительность пакета определяется суммой вкладов этого пакета и всех
+ *		последующих пакетов тайла. Суммы переводятся в децибелы относительно наибольшей
+ *		в кадре, и диапазон SENS_DB_RANGE дБ отображается на значения 1 - 255.
+ *		Пакеты, потеря которых не увеличивает искажение, получают чувствительность 0
+ * \param  tiles Количество тайлов
+ * \param  tile_packets Количество пакетов в каждом тайле
+ * \param  pack_dist Уменьшение искажения (например, MSE), которое дает каждый пакет;
+ *		значения идут в том же порядке, что и в pack_sens. Массив используется как рабочий
+ *		и на выходе содержит суммарные вклады
+ * \param  pack_sens Массив для значений чувствительности пакетов
+ */
+__declspec(dllexport)
+void sens_from_distortion(uint16_t tiles, uint16_t* tile_packets, float* pack_dist, uint8_t* pack_sens)
+{
+	float* d, tail, max_tail = 0;
+	double db;
+	uint32_t p_no = 0, n;
+	uint16_t j;
+	int i;
+
+	for (j = 0; j < tiles; j++) {			// суммы вкладов от пакета до конца тайла
+		d = pack_dist + p_no;
+		tail = 0;
+		for (i = tile_packets[j] - 1; i >= 0; i--) {
+			if (d[i] > 0)
+				tail += d[i];
+			d[i] = tail;
+		}
+		if (tile_packets[j] && d[0] > max_tail)
+			max_tail = d[0];
+		p_no += tile_packets[j];
+	}
+	for (n = 0; n < p_no; n++) {
+		if (pack_dist[n] <= 0 || max_tail <= 0) {
+			pack_sens[n] = 0;
+			continue;
+		}
+		db = 10.0 * log10(pack_dist[n] / max_tail);	// не больше 0
+		db = 255.0 * (1.0 + db / SENS_DB_RANGE);
+		pack_sens[n] = db < 1.0 ? 1 : (uint8_t)(db + 0.5);
+	}
+}
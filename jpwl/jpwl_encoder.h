@@ -14,6 +14,10 @@ void jpwl_enc_set_default_params(jpwl_enc_params *params);
 
 /**
  * brief  Инициализация значений параметров кодера jpwl, переданных из ПО ПИИ
+ * details Параметры хранятся в локальной памяти вызывающего потока (см. W_TLS) и не действуют
+ *		на кодирование в других потоках: каждый поток, вызывающий jpwl_enc_run, jpwl_enc_plan
+ *		или jpwl_enc_stream_*, вызывает jpwl_enc_init сам. jpwl_enc_run_batch берет параметры
+ *		вызывающего потока
  * param  params Cсылка на структуру jpwl_enc_params со значениями параметров кодера jpwl
  */
 #ifndef __cplusplus
@@ -24,9 +28,9 @@ extern "C" __declspec(dllimport)
 void jpwl_enc_init(jpwl_enc_params *params);
 
 /**
- * brief  Запуск кодера jpwl
+ * brief  Запуск кодера jpwl с параметрами, заданными jpwl_enc_init в этом же потоке
  * param  inp_buffer Cсылка на входной буфер
- * param  out_buffer Cсылка на выходной буфер
+ * param  out_buffer Cсылка на выходной буфер (может совпадать с inp_buffer, см. jpwl_enc_plan)
  * param  bParams Cсылка на структуру jpwl_enc_bParams с дополнительными данными для кодера
  * param  bResult Cсылка на структуру jpwl_enc_bResults с дополнительными результатами кодера
  */
@@ -39,6 +43,102 @@ errno_t jpwl_enc_run(uint8_t* inp_buffer, uint8_t* out_buffer,
 							   jpwl_enc_bParams *bParams,
 							   jpwl_enc_bResults *bResult);
 
+/**
+ * brief  Расчет точной длины выходного потока кодера jpwl без кодирования
+ * param  inp_buffer Cсылка на входной буфер
+ * param  bParams Cсылка на структуру jpwl_enc_bParams с дополнительными данными для кодера
+ * param  out_len Адрес переменной, в которую заносится длина выходного потока
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_enc_plan(uint8_t* inp_buffer, jpwl_enc_bParams* bParams, size_t* out_len);
+
+/**
+ * brief  Начало потокового кодирования jpwl: защита основного заголовка
+ * details Заголовок можно передавать сразу: DL в EPC нулевое, декодер берет длину кадра по принятым данным
+ * param  mh_buffer Cсылка на основной заголовок jpeg2000 часть 1 (от SOC до первого SOT)
+ * param  mh_len Длина основного заголовка в байтах
+ * param  out_buffer Cсылка на буфер для защищенного основного заголовка
+ * param  out_len Адрес переменной, в которую заносится длина защищенного основного заголовка
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_enc_stream_begin(uint8_t* mh_buffer, size_t mh_len, uint8_t* out_buffer, size_t* out_len);
+
+/**
+ * brief  Потоковое кодирование jpwl очередного тайла
+ * param  tile_buffer Cсылка на тайл (от маркера SOT до конца данных тайла)
+ * param  tile_len Длина тайла в байтах, должна совпадать с Psot
+ * param  packets Количество пакетов тайла
+ * param  pack_sens Cсылка на значения чувствительности пакетов тайла
+ * param  out_buffer Cсылка на буфер для защищенного тайла
+ * param  out_len Адрес переменной, в которую заносится длина защищенного тайла
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_enc_stream_tile(uint8_t* tile_buffer, size_t tile_len, uint16_t packets, uint8_t* pack_sens,
+	uint8_t* out_buffer, size_t* out_len);
+
+/**
+ * brief  Завершение потокового кодирования jpwl: маркер EOC и исправление DL в основном заголовке
+ * param  mh_buffer Cсылка на защищенный основной заголовок, выданный jpwl_enc_stream_begin
+ * param  out_buffer Cсылка на буфер для маркера EOC (2 байта)
+ * param  out_len Адрес переменной, в которую заносится длина данных в out_buffer
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_enc_stream_end(uint8_t* mh_buffer, uint8_t* out_buffer, size_t* out_len);
+
+/**
+ * brief  Статистика использования памяти под временные данные кадров кодера jpwl
+ * param  stats Cсылка на структуру jpwl_mem_stats для заполнения
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+void jpwl_enc_mem_stats(jpwl_mem_stats* stats);
+
+/**
+ * brief  Пакетное кодирование независимых кадров jpwl в нескольких потоках
+ * param  frames Cсылка на массив кадров
+ * param  count Количество кадров
+ * param  threads Количество потоков, 0 - по количеству процессоров
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+errno_t jpwl_enc_run_batch(jpwl_enc_frame* frames, size_t count, int threads);
+
+/**
+ * brief  Вычисление чувствительности пакетов по их вкладу в искажение изображения
+ * param  tiles Количество тайлов
+ * param  tile_packets Количество пакетов в каждом тайле
+ * param  pack_dist Уменьшение искажения, которое дает каждый пакет (на выходе - суммарные вклады)
+ * param  pack_sens Массив для значений чувствительности пакетов
+ */
+#ifndef __cplusplus
+__declspec(dllimport)
+#else
+extern "C" __declspec(dllimport)
+#endif
+void sens_from_distortion(uint16_t tiles, uint16_t* tile_packets, float* pack_dist, uint8_t* pack_sens);
+
 #ifndef _TEST
 #define _TEST
 #endif
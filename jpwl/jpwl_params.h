@@ -3,6 +3,16 @@
 #include <stdint.h>
 
 #define RS_OPTIMIZED
+/**
+ * \brief Класс памяти состояния кодера и декодера
+ * \details Параметры защиты (wcoder_*), таблицы и статистика кодера и декодера хранятся в локальной
+ * памяти потока, чтобы кадры могли обрабатываться параллельно (jpwl_enc_run_batch, jpwl_dec_run_batch).
+ * Поэтому параметры, заданные jpwl_enc_init, действуют только в вызвавшем ее потоке: поток, который
+ * вызывает jpwl_enc_run, jpwl_enc_plan или jpwl_enc_stream_*, должен сам вызвать jpwl_enc_init,
+ * а jpwl_dec_stats и jpwl_*_mem_stats возвращают данные кадров своего потока.
+ * Пакетные функции передают рабочим потокам параметры вызывающего потока.
+ */
+#define W_TLS __declspec(thread)
 
 #define ESD_PACKETS _true_		/**< пакетный режим данных о чувствительности */
 #define ESD_BYTE_RANGE _false_	/**< режим байтового диапазона данных о чувствительности */
@@ -34,7 +44,7 @@ int (*decode_RS)(uint8_t* data, uint8_t* parity, int n, int k);
  * 112 - RS-код RS(112,32)
  * 128 - RS-код RS(128,32)
  */
-unsigned char wcoder_mh_param;
+extern W_TLS unsigned char wcoder_mh_param;
 
 /**
  * \brief Параметр защиты  заголовка tile (возможные значения см. ниже)
@@ -43,7 +53,7 @@ unsigned char wcoder_mh_param;
  * 1 - предопределенная защита - RS(80,25)
  * Остальные - см. выше
  */
-unsigned char wcoder_th_param;
+extern W_TLS unsigned char wcoder_th_param;
 
 /**
  * \brief Параметр защиты данных кодового потока jpeg2000 часть 1 (возможные значения см. ниже)
@@ -51,10 +61,11 @@ unsigned char wcoder_th_param;
  * 0 - защита отсутствует
  * 1 - неравномерная защита от ошибок UEP - используются RS-коды
  * от 37 до 128 в зависимости от значений чувствительности пакетов,
- * которые передаются кодером jpeg2000 часть 1
+ * которые передаются кодером jpeg2000 часть 1 (наиболее чувствительным пакетам тайла -
+ * RS(128,32), наименее чувствительным - RS(37,32), по одному EPB на группу соседних пакетов с одинаковым кодом)
  * Остальные - см. выше
  */
-unsigned char wcoder_data_param;
+extern W_TLS unsigned char wcoder_data_param;
 
 /**
  * \brief Режим использования внутрикадрового чередования
@@ -63,4 +74,4 @@ unsigned char wcoder_data_param;
  * _false_ - чередование не используется
  * В данной версии возможность внутрикадрового чередования зарезервирована, но не реализована
  */
-_bool_ interleave_use;
+extern W_TLS _bool_ interleave_use;
@@ -0,0 +1,65 @@
+﻿#include <Windows.h>
+#include <stdlib.h>
+#include "jpwl_pool.h"
+
+#define POOL_MAX_THREADS 64		///< Наибольшее количество потоков пула (ограничение WaitForMultipleObjects)
+
+/**
+ * \struct w_pool
+ * \brief Общие данные потоков пула
+ */
+typedef struct {
+	w_pool_job job;				///< Функция обработки элемента
+	w_pool_done done;			///< Функция завершения потока
+	void* ctx;					///< Общие данные задания
+	size_t count;				///< Количество элементов
+	volatile LONG64 next;		///< Номер следующего необработанного элемента
+} w_pool;
+
+/**
+ * \brief Поток пула
+ * \param param Адрес структуры w_pool
+ */
+static DWORD WINAPI w_pool_thread(LPVOID param)
+{
+	w_pool* pool = (w_pool*)param;
+	size_t i;
+
+	while ((i = (size_t)InterlockedIncrement64(&pool->next) - 1) < pool->count)
+		pool->job(pool->ctx, i);
+	if (pool->done)
+		pool->done(pool->ctx);
+	return 0;
+}
+
+int w_pool_run(w_pool_job job, w_pool_done done, void* ctx, size_t count, int threads)
+{
+	HANDLE handles[POOL_MAX_THREADS];
+	SYSTEM_INFO si;
+	w_pool pool = { job, done, ctx, count, 0 };
+	int i, n = 0;
+	size_t k;
+
+	if (threads <= 0) {
+		GetSystemInfo(&si);
+		threads = (int)si.dwNumberOfProcessors;
+	}
+	if (threads > POOL_MAX_THREADS)
+		threads = POOL_MAX_THREADS;
+	if ((size_t)threads > count)
+		threads = (int)count;
+	for (i = 0; i < threads; i++) {
+		handles[n] = CreateThread(NULL, 0, w_pool_thread, &pool, 0, NULL);
+		if (handles[n])
+			n++;
+	}
+	if (!n) {					// потоки не созданы - все делает вызывающий поток
+		for (k = 0; k < count; k++)
+			job(ctx, k);
+		return 0;
+	}
+	WaitForMultipleObjects(n, handles, TRUE, INFINITE);
+	for (i = 0; i < n; i++)
+		CloseHandle(handles[i]);
+	return n;
+}
@@ -0,0 +1,32 @@
+﻿#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "jpwl_types.h"
+
+/**
+ * \brief Обработка одного элемента пакетного задания
+ * \param ctx Общие данные задания
+ * \param index Номер элемента
+ */
+typedef void (*w_pool_job)(void* ctx, size_t index);
+
+/**
+ * \brief Завершение работы потока пула: освобождение его таблиц
+ * \param ctx Общие данные задания
+ */
+typedef void (*w_pool_done)(void* ctx);
+
+/**
+ * \brief Обработка count элементов пакетного задания потоками пула
+ * \details Каждый поток берет очередной необработанный элемент, пока они не закончатся.
+ * Состояние кодера и декодера у каждого потока свое (W_TLS), поэтому элементы обрабатываются
+ * независимо. Перед завершением поток вызывает done. Если не удалось создать ни одного потока,
+ * задание выполняется в вызывающем потоке (done при этом не вызывается).
+ * \param job Функция обработки элемента
+ * \param done Функция завершения потока или NULL
+ * \param ctx Общие данные задания
+ * \param count Количество элементов
+ * \param threads Количество потоков, 0 - по количеству процессоров
+ * \return Количество потоков, выполнявших задание (0 - вызывающий поток)
+ */
+int w_pool_run(w_pool_job job, w_pool_done done, void* ctx, size_t count, int threads);
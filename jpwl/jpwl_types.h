@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include <stdint.h>
+#include <stddef.h>
 
 #define _true_ 0x01
 #define _false_ 0x00
@@ -13,6 +14,7 @@
 #define EOC_MARKER 0xffD9
 #define SIZ_MARKER 0xff51
 #define SOP_MARKER 0xff91
+#define RED_MARKER 0xff69
 #define BAD_ID	0x0123
 #define EPC_LOW 0x68
 #define EPB_LOW 0x66
@@ -42,18 +44,20 @@
 #define EPC_LN 9		/**< Длина постоянной части сегмента марокера EPC Lepc+Pcrc+DL+Pepc */
 #define ESD_LN 5		/**< Длина постоянной части сегмента марокера ESD Lesd+Cesd+Pesd */
 #define SOT_LN 10		/**< Длина сегмента маркера SOT без самого маркера */
+#define RED_LN 3		/**< Длина постоянной части сегмента марокера RED Lred+Pred */
 
 #define ESDINT_LN 9	/**< Длина записи об одном интервале ESD в режиме байтового диапазона: адрес начала (4 байта) + адрес конца (4 байта) + чувствительность (1 байт) */
+#define REDINT_LN 10	/**< Длина записи об одном интервале RED: адрес начала (4 байта) + адрес конца (4 байта) + уровень ошибки (2 байта) */
+#define RED_PRED 0x7B	/**< Pred сегмента RED: байтовый диапазон, 4 байта на адрес, уровень ошибки не определен */
+#define ESD_PESD_PACKETS 0x00	/**< Pesd сегмента ESD в пакетном режиме: относительная чувствительность, 1 байт на значение */
+#define ESD_PESD_BYTE_RANGE 0x42	/**< Pesd сегмента ESD в режиме байтового диапазона: 4 байта на адрес, 1 байт на значение */
 #define MAX_EPBSIZE 65535	/**< Максимальная длина сегмента маркера EPB - определяется кол-вом байт, отводимых под длину сегмента в спецификации T.810 (2 байта беззнаковое число) */
 #define PRE_RSCODE_SIZE (40-13) /**< Длина RS-кода для защиты заголовка не первого EPB в заголовке, т.е. EPB, используемого для защиты данных */
-#define MAX_MARKERS 8096	/**< Максимальное количество маркеров */
-#define MAX_TILES 1024		/**< Максимальное количество тайлов */
+#define TILE_HEADER_COPY 16	/**< Количество байт заголовка тайла, возвращаемых кодером для каждого тайла */
 
-#define MAX_OUT_SIZE	(1UL << 24)	/**< Максимальный размер выходного кодового потока */
-
-#define MAX_BADPARTS 13500	/// Макс. кол-во некорректируемых фрагментов пост-данных блока EPB
-#define MAX_INTERVALS 6553 /// Макс. кол-во интервалов RED - 1 REd по 10 байт на 1 интервал
 #define TILE_MINLENGTH 80	/// Минимальная длина тайла
+#define INF_AMMENDMENT_ID 0x0200	/**< Идентификатор информативного метода EPC: внутрикадровое чередование (Ammendment) */
+#define INF_TILE_POS_ID 0x0201	/**< Идентификатор информативного метода EPC: таблица позиций тайлов (Pid: количество тайлов, 2 байта + смещения SOT от начала потока, по 4 байта) */
 #define JPWL_CODES 16
 
 typedef unsigned char _bool_;
@@ -106,14 +110,35 @@ typedef struct {
 							// 1 - байтовый диапазон,
 							// 2 - диапазон пакетов
 							// 3 - зарезервировано
-	unsigned short interv_start;	// номер первого элемента массива e_intervals
+	uint32_t interv_start;	// номер первого элемента массива e_intervals
 									// с которого начинаются записи этого ESD
-	unsigned short interv_cnt;		// кол-во записей в массиве e_intervals
+	uint32_t interv_cnt;		// кол-во записей в массиве e_intervals
 	unsigned short Lesd;	// длина сегмента маркера без самого маркера
 	unsigned short Cesd;	// определяет, какой компонент ESD указывается
 	unsigned char Pesd;		// описывает опции ESD
 } esd_ms;
 
+/**
+ * \struct red_ms
+ * \brief Структура данных для маркера RED
+ */
+typedef struct {
+	unsigned char Pred;		///< Параметры RED
+	uint32_t interv_start;	///< Номер первой записи таблицы интервалов RED, относящейся к этому сегменту
+	uint16_t interv_cnt;	///< Количество интервалов в сегменте
+	uint32_t shift;			///< Разность между позицией байта во входном буфере и его смещением от начала тайла в выходном потоке
+} red_ms;
+
+/**
+ * \struct red_interval
+ * \brief Интервал кодового потока с остаточными ошибками
+ */
+typedef struct {
+	uint32_t start;		///< Первый байт интервала
+	uint32_t end;		///< Последний байт интервала
+	uint16_t errors;	///< Уровень ошибки: 0xFFFF - не определен
+} red_interval;
+
 /**
  * \struct bad_block
  * \brief Структура для описания невосстановимого блока данных
@@ -122,6 +147,33 @@ typedef struct {
 	unsigned long Lbad;	///< длина невосстановимого блока
 } bad_block;
 
+/**
+ * \struct sot_cand
+ * \brief Кандидат на начало тайла (пара байт FF 90) при поиске тайлов в декодере
+ */
+typedef struct {
+	uint32_t pos;		///< Позиция во входном буфере
+	uint8_t score;		///< Оценка правдоподобия заголовка тайла
+} sot_cand;
+
+/**
+ * \struct tile_rec
+ * \brief Тайл, заголовок которого скорректирован декодером, а данные корректируются отдельно
+ */
+typedef struct {
+	uint32_t pos;			///< Позиция тайла во входном буфере
+	uint32_t sot_l;			///< Длина тайла (после коррекции данных - без удаленных сегментов)
+	uint32_t tilemark_ln;	///< Длина удаляемых из заголовка тайла сегментов EPB и ESD
+	uint32_t mark_first;	///< Индекс первого EPB тайла в таблице маркеров
+	uint32_t mark_end;		///< Индекс, следующий за последним EPB тайла
+	uint32_t red_slot;		///< Индекс записи, зарезервированной под сегмент RED, 0 - не зарезервирована
+	uint32_t group_end;		///< Индекс, следующий за последней записью тайла в таблице маркеров
+	uint16_t tile_num;		///< Порядковый номер тайла в кадре
+	uint16_t isot;			///< Номер тайла Isot из скорректированного сегмента SOT
+	uint8_t sens;			///< Чувствительность тайла по данным ESD
+	uint8_t state;			///< Состояние коррекции данных тайла
+} tile_rec;
+
 /**
  * \struct w_marker
  * \brief Структура данных для описания одного из маркеров jpwl или невосстановимого блока
@@ -132,12 +184,13 @@ typedef struct {
 		epb_ms epb;
 		epc_ms epc;
 		esd_ms esd;
+		red_ms red;
 		bad_block bad;
 	} m;				/// Описание маркера или блока
 	int tile_num;		/// индекс заголовка Tile, в котором этот маркер расположен (-1 - основной заголовок)
-	unsigned long pos_in;	/// Позиция маркера во входном буфере
-	unsigned long pos_out;	/// Позиция маркера в выходном буфере
-	unsigned long len;		/// Длирна сегмента маркера без самого маркера
+	uint64_t pos_in;	/// Позиция маркера во входном буфере
+	uint64_t pos_out;	/// Позиция маркера в выходном буфере
+	uint32_t len;		/// Длирна сегмента маркера без самого маркера
 } w_marker;
 
 /**
@@ -164,11 +217,36 @@ typedef struct {
 	uint32_t uncorrected_rs_bytes;
 } restore_stats;
 
+/**
+ * \struct rs_frame_stats
+ * \brief Статистика кодовых слов RS, защищающих данные тайлов (коды 37-128), за один кадр
+ */
+typedef struct {
+	uint32_t codewords;		/// Количество декодированных кодовых слов
+	uint32_t failed;		/// Количество некорректируемых кодовых слов
+	uint32_t symbols;		/// Количество символов в скорректированных кодовых словах
+	uint32_t corrected;		/// Количество исправленных символов в них
+} rs_frame_stats;
+
+/**
+ * \struct jpwl_mem_stats
+ * \brief Статистика использования памяти под временные данные кадра в кодере или декодере JPWL
+ */
+typedef struct {
+	size_t arena_size;		/// Размер блока памяти для временных данных кадра
+	size_t high_water;		/// Максимальный объем временных данных одного кадра
+	size_t last_frame;		/// Объем временных данных последнего кадра
+	uint32_t heap_allocs;	/// Количество выделений памяти из кучи с момента запуска
+} jpwl_mem_stats;
+
 typedef struct {
 	unsigned char* inp_buffer;
-	unsigned long inp_length;
+	size_t inp_length;
 	unsigned char* out_buffer;
-	unsigned long out_length;	/// Длина данных записанных в выходной буфер
+	size_t out_length;	/// Длина данных записанных в выходной буфер
+	unsigned char use_red;	/// 1 - в заголовки частично восстановленных тайлов заносятся сегменты RED
+	uint32_t budget_us;		/// Бюджет времени декодирования кадра в микросекундах, 0 - без ограничения
+	uint32_t budget_work;	/// Бюджет работы: количество RS-кодовых слов и проверок CRC, 0 - без ограничения
 } w_dec_params;
 
 /**
@@ -177,8 +255,12 @@ typedef struct {
  */
 typedef struct {
 	unsigned char* inp_buffer;
-	unsigned long inp_length;
-	unsigned char* out_buffer;
+	size_t inp_length;
+	unsigned char* out_buffer;	/// NULL или inp_buffer - скорректированный поток формируется во входном буфере
+	unsigned char use_red;		/// 1 - отмечать некорректируемые участки тайлов сегментами RED, 0 - не отмечать
+	uint32_t budget_us;			/// Бюджет времени декодирования кадра в микросекундах, 0 - без ограничения
+	uint32_t budget_work;		/// Бюджет работы: количество декодируемых RS-кодовых слов и проверок CRC, 0 - без ограничения
+								/// (при любом бюджете первый тайл кадра разбирается, а самый чувствительный - корректируется)
 } jpwl_dec_bParams;
 
 /**
@@ -188,10 +270,36 @@ typedef struct {
 typedef struct {
 	unsigned short tile_all_rest_cnt;	/// Количество полностью восстановленных тайлов кадра
 	unsigned short tile_part_rest_cnt;	/// Количество частично восстановленных тайлов кадра
-	unsigned long out_length;			/// Длина данных записанных в выходной буфер
-	unsigned long all_bad_length;		/// Общее количество недекодированных данных кадра
+	size_t out_length;			/// Длина данных записанных в выходной буфер
+	size_t all_bad_length;		/// Общее количество недекодированных данных кадра
+	unsigned short tile_skip_cnt;	/// Количество тайлов, отброшенных по исчерпании бюджета декодирования
+	size_t skip_length;			/// Количество байт, отброшенных по исчерпании бюджета (входит в all_bad_length)
+	rs_frame_stats rs;			/// Статистика кодовых слов RS защиты данных кадра (для оценки канала)
+	unsigned short tile_count;	/// Количество тайлов кадра (записей в tile_sens_cnt)
+	unsigned short* tile_sens_cnt;	/// Количество значений чувствительности из ESD по тайлам (0 - тайл без ESD или не восстановлен)
+	unsigned char* pack_sens;	/// Значения чувствительности из ESD подряд по тайлам: пакетов (пакетный режим) или интервалов (таблицы декодера, действительны до следующего запуска)
 } jpwl_dec_bResults;
 
+/**
+ * \struct jpwl_dec_frame
+ * \brief Кадр пакетного декодирования JPWL (jpwl_dec_run_batch)
+ */
+typedef struct {
+	jpwl_dec_bParams params;	/// Входные параметры декодирования кадра
+	jpwl_dec_bResults results;	/// Результаты декодирования кадра
+	size_t* tile_positions;		/// Таблица позиций тайлов кадра, как у jpwl_dec_run
+	errno_t status;				/// Код завершения jpwl_dec_run для кадра (меньше 0 - кадр отброшен)
+} jpwl_dec_frame;
+
+/**
+ * \brief Функция приема участков выходного потока от потокового декодера JPWL
+ * \details tile_num: -1 - основной заголовок (или весь кадр, если он обрабатывался целиком),
+ * иначе порядковый номер тайла в кадре. Последний вызов кадра включает маркер EOC.
+ * tile_len = 0 - тайл не восстановлен и исключен из выходного потока.
+ * Данные находятся в выходном буфере декодера и действительны до начала следующего кадра.
+ */
+typedef void (*jpwl_dec_tile_cb)(void* user, int tile_num, uint8_t* tile_data, size_t tile_len);
+
 typedef struct {
 	unsigned char wcoder_mh;
 	unsigned char wcoder_th;
@@ -201,9 +309,14 @@ typedef struct {
 	unsigned char* out_buffer;
 	unsigned short* tile_packets;
 	unsigned char* packet_sense;
-	unsigned long wcoder_out_len;	/// длина выходного кодового потока
-	unsigned long wcoder_mh_len;	/// длина основного заголовка в байтах
+	size_t inp_length;		/// длина входного кодового потока
+	size_t wcoder_out_len;	/// длина выходного кодового потока
+	size_t wcoder_mh_len;	/// длина основного заголовка в байтах
 	unsigned char jpwl_enc_mode;	/// 1 - использовать, 0 - не использовать
+	unsigned char tile_hints;	/// 1 - в EPC заносится таблица позиций тайлов, 0 - не заносится
+	unsigned char esd_mode;		/// ESD в заголовках тайлов: 0 - нет, 1 - пакетный режим, 2 - байтовый диапазон
+	unsigned char* tile_codes;	/// Защита данных по тайлам (значения как у wcoder_data) или NULL
+	unsigned short tile_codes_cnt;	/// Количество элементов tile_codes
 } w_enc_params;
 
 /**
@@ -216,6 +329,10 @@ typedef struct {
 	unsigned char wcoder_data;
 	unsigned char interleave_used;	/// 1 - используется, 0 - не используется
 	unsigned char jpwl_enc_mode;	/// 1 - использовать, 0 - не использовать
+	unsigned char tile_hints;	/// 1 - заносить в EPC таблицу позиций тайлов, 0 - не заносить
+	unsigned char esd_mode;		/// ESD в заголовках тайлов: 0 - не создавать, 1 - пакетный режим, 2 - байтовый диапазон (интервалы чувствительности)
+	unsigned char* tile_codes;	/// Защита данных i-го тайла кадра (значения как у wcoder_data) или NULL - wcoder_data для всех тайлов; массив не копируется и должен существовать до конца кодирования
+	unsigned short tile_codes_cnt;	/// Количество элементов tile_codes, тайлы за его пределами защищаются по wcoder_data
 } jpwl_enc_params;
 
 /**
@@ -223,7 +340,7 @@ typedef struct {
 * \brief Структура для передачи побочных параметров кодеру jpwl
 */
 typedef struct {
-	unsigned long stream_len;		/// длина входного кодового потока
+	size_t stream_len;		/// длина входного кодового потока
 	unsigned short* tile_packets;	/// указатель на первый эл-т массива с кол-вом пакетов по тайлам
 	unsigned char* pack_sens;		/// указатель на первый эл-т массива со значениями чувствительности пакетов тайлов
 } jpwl_enc_bParams;
@@ -233,8 +350,21 @@ typedef struct {
 * \brief Структура для возврата побочных результатов из кодера jpwl
 */
 typedef struct {
-	unsigned long wcoder_out_len;	/// длина выходного кодового потока jpwl
-	unsigned long wcoder_mh_len;	/// длина основного заголовка в байтах после кодера jpwl
-	int tile_position[MAX_TILES];
-	uint8_t tile_headers[MAX_TILES][16];
+	size_t wcoder_out_len;	/// длина выходного кодового потока jpwl
+	size_t wcoder_mh_len;	/// длина основного заголовка в байтах после кодера jpwl
+	uint32_t tile_count;	/// количество тайлов в кодовом потоке
+	size_t* tile_position;	/// позиции тайлов во входном потоке (таблица кодера, действительна до следующего запуска)
+	uint8_t (*tile_headers)[TILE_HEADER_COPY];	/// начальные байты заголовков тайлов (таблица кодера)
 } jpwl_enc_bResults;
+
+/**
+* \struct jpwl_enc_frame
+* \brief Кадр пакетного кодирования jpwl (jpwl_enc_run_batch)
+*/
+typedef struct {
+	uint8_t* inp_buffer;		/// входной буфер кадра
+	uint8_t* out_buffer;		/// выходной буфер кадра (может совпадать с inp_buffer, см. jpwl_enc_plan)
+	jpwl_enc_bParams params;	/// побочные параметры кодера для кадра
+	jpwl_enc_bResults results;	/// побочные результаты кодера (tile_position и tile_headers равны NULL)
+	errno_t status;				/// код завершения jpwl_enc_run для кадра
+} jpwl_enc_frame;